@@ -28,6 +28,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <net/if_arp.h>
 #include <sys/socket.h>
@@ -61,6 +62,10 @@
 #define IEEE80211_RADIOTAP_F_FRAG	0x08
 #endif
 
+#ifndef IEEE80211_RADIOTAP_F_FCS
+#define IEEE80211_RADIOTAP_F_FCS	0x10
+#endif
+
 #ifndef IEEE80211_RADIOTAP_TX_FLAGS
 #define IEEE80211_RADIOTAP_TX_FLAGS     (1 << 15)
 #define IEEE80211_RADIOTAP_F_TX_CTS     0x0002
@@ -101,11 +106,39 @@
 #define NL80211_CHAN_WIDTH_160          5
 #define NL80211_CHAN_WIDTH_5            6
 #define NL80211_CHAN_WIDTH_10           7
+#define NL80211_CHAN_WIDTH_320          13
 
 struct mac80211_lorcon {
-	void *nlhandle;
-    int nl80211id;
+    /* Synchronous requests go over the shared nl80211 control socket */
     int ifidx;
+
+    /* Separate non-blocking socket for asynchronous channel changes, opened
+     * on first use, so their acks never mix with the synchronous calls */
+    void *async_nlhandle;
+    int async_nl80211id;
+    int async_ifidx;
+
+    /* Phy index for the capability cache, -1 until looked up */
+    int wiphy;
+
+    /* Current channel, from our own changes and from nl80211, so getting
+     * the channel doesn't go to the kernel each time.  The event listener
+     * updates it from whichever thread services it, so it is only touched
+     * under chan_lock */
+    pthread_mutex_t chan_lock;
+    int chan_valid;
+    lorcon_channel_t chan_cur;
+
+    /* Channel switch notifications; opened on first use */
+    void *event_nlhandle;
+    int event_tried;
+
+    /* Channels asked for by asynchronous changes still in flight */
+    struct {
+        unsigned int seq;
+        lorcon_channel_t channel;
+    } async_req[LORCON_CHANNEL_MAX_PENDING];
+    int async_num_req;
 };
 
 /* Monitor, inject, and injmon are all the same method, open a new vap */
@@ -149,11 +182,6 @@ int mac80211_openmon_cb(lorcon_t *context) {
 		return -1;
 	}
 
-	if (nl80211_connect(context->vapname, &(extras->nlhandle), &(extras->nl80211id),
-						&(extras->ifidx), context->errstr) < 0) {
-		return -1;
-	}
-
 	pcaperr[0] = '\0';
 
 	if ((context->pcap = pcap_open_live(context->vapname, LORCON_MAX_PACKET_LEN, 
@@ -171,7 +199,6 @@ int mac80211_openmon_cb(lorcon_t *context) {
 	if (context->inject_fd < 0) {
 		snprintf(context->errstr, LORCON_STATUS_MAX, "failed to create injection "
 				 "socket: %s", strerror(errno));
-		nl80211_disconnect(extras->nlhandle);
 		pcap_close(context->pcap);
 		return -1;
 	}
@@ -184,10 +211,11 @@ int mac80211_openmon_cb(lorcon_t *context) {
 				 strerror(errno));
 		close(context->inject_fd);
 		pcap_close(context->pcap);
-		nl80211_disconnect(extras->nlhandle);
 		return -1;
 	}
 
+	extras->ifidx = if_req.ifr_ifindex;
+
 	memset(&sa_ll, 0, sizeof(sa_ll));
 	sa_ll.sll_family = AF_PACKET;
 	sa_ll.sll_protocol = htons(ETH_P_ALL);
@@ -198,7 +226,6 @@ int mac80211_openmon_cb(lorcon_t *context) {
 				 "socket: %s", strerror(errno));
 		close(context->inject_fd);
 		pcap_close(context->pcap);
-		nl80211_disconnect(extras->nlhandle);
 		return -1;
 	}
 
@@ -209,26 +236,134 @@ int mac80211_openmon_cb(lorcon_t *context) {
 				 "injection socket: %s", strerror(errno));
 		close(context->inject_fd);
 		pcap_close(context->pcap);
-		nl80211_disconnect(extras->nlhandle);
 		return -1;
 	}
 
 	return 1;
 }
 
-int mac80211_setchan_cb(lorcon_t *context, int channel) {
+/* Record the channel the interface is now on */
+static void mac80211_chan_store(struct mac80211_lorcon *extras,
+		const lorcon_channel_t *channel) {
+	pthread_mutex_lock(&(extras->chan_lock));
+	extras->chan_cur = *channel;
+	extras->chan_valid = 1;
+	pthread_mutex_unlock(&(extras->chan_lock));
+}
+
+/* Forget the channel so the next get asks the kernel */
+static void mac80211_chan_invalidate(struct mac80211_lorcon *extras) {
+	pthread_mutex_lock(&(extras->chan_lock));
+	extras->chan_valid = 0;
+	pthread_mutex_unlock(&(extras->chan_lock));
+}
+
+/* Copy out the cached channel; 0 if there is none */
+static int mac80211_chan_load(struct mac80211_lorcon *extras,
+		lorcon_channel_t *ret_channel) {
+	int valid;
+
+	pthread_mutex_lock(&(extras->chan_lock));
+	if ((valid = extras->chan_valid))
+		*ret_channel = extras->chan_cur;
+	pthread_mutex_unlock(&(extras->chan_lock));
+
+	return valid;
+}
+
+static void mac80211_chan_store_basic(struct mac80211_lorcon *extras, int channel) {
+	lorcon_channel_t c;
+
+	memset(&c, 0, sizeof(lorcon_channel_t));
+	c.channel = wifi_chan_to_freq(channel);
+	c.type = LORCON_CHANNEL_BASIC;
+
+	mac80211_chan_store(extras, &c);
+}
+
+static void mac80211_chan_event(struct nl80211_event *event, void *aux) {
+	lorcon_t *context = (lorcon_t *) aux;
 	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	lorcon_channel_t c;
 
-	if (nl80211_setchannel_cache(extras->ifidx, extras->nlhandle, extras->nl80211id,
-                channel, 0, context->errstr) < 0) {
-		return -1;
+	if (event->type != NL80211_EVENT_CH_SWITCH ||
+			event->chan.ifindex != extras->ifidx)
+		return;
+
+	if (event->chan.freq == 0) {
+		mac80211_chan_invalidate(extras);
+		return;
+	}
+
+	nl80211_chaninfo_channel(&(event->chan), &c);
+	mac80211_chan_store(extras, &c);
+}
+
+/* Events for this interface from the process-wide listener, see
+ * lorcon_enable_events() */
+int mac80211_event_cb(lorcon_t *context, const lorcon_event_t *event) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	switch (event->type) {
+		case LORCON_EVENT_CHANNEL:
+			if (event->channel.channel == 0)
+				mac80211_chan_invalidate(extras);
+			else
+				mac80211_chan_store(extras, &(event->channel));
+			break;
+		case LORCON_EVENT_IF_REMOVED:
+		case LORCON_EVENT_PHY_REMOVED:
+		case LORCON_EVENT_LOST:
+			mac80211_chan_invalidate(extras);
+			break;
 	}
 
 	return 0;
 }
 
-int mac80211_getchan_cb(lorcon_t *context) {
-	int ch;
+/* Bring the cached channel up to date: apply any channel switches the
+ * kernel announced, and ask it directly if we don't know the channel */
+static int mac80211_chan_refresh(lorcon_t *context, lorcon_channel_t *ret_channel) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	struct nl80211_chaninfo info;
+	void *nl_sock;
+	int nl80211_id, ch, r;
+
+	if (context->ev_registered) {
+		/* The process listener also sees our channel switches; don't run
+		 * user handlers from in here, they may free this context */
+		if (lorcon_events_update() < 0)
+			mac80211_chan_invalidate(extras);
+	} else {
+		if (!extras->event_tried) {
+			extras->event_tried = 1;
+
+			/* Without events we only know about our own changes */
+			if (nl80211_event_connect(&(extras->event_nlhandle),
+						NL80211_EVENT_GROUP_MLME, context->errstr) < 0)
+				extras->event_nlhandle = NULL;
+		}
+
+		if (extras->event_nlhandle != NULL &&
+				nl80211_event_process(extras->event_nlhandle, mac80211_chan_event,
+					context, context->errstr) < 0)
+			mac80211_chan_invalidate(extras);
+	}
+
+	if (mac80211_chan_load(extras, ret_channel))
+		return 0;
+
+	if (nl80211_control_acquire(&nl_sock, &nl80211_id, context->errstr) == 0) {
+		r = nl80211_get_interface_channel(extras->ifidx, nl_sock, nl80211_id,
+				&info, context->errstr);
+		nl80211_control_release(r < 0);
+
+		if (r == 0) {
+			nl80211_chaninfo_channel(&info, ret_channel);
+			mac80211_chan_store(extras, ret_channel);
+			return 0;
+		}
+	}
 
 	if ((ch = iwconfig_get_channel(context->vapname, context->errstr)) < 0) {
 		// Fall back to parent if vap doesn't act right (mac80211 seems to do this)
@@ -236,12 +371,52 @@ int mac80211_getchan_cb(lorcon_t *context) {
 			return -1;
 	}
 
-	return ch;
+	memset(ret_channel, 0, sizeof(lorcon_channel_t));
+	ret_channel->channel = wifi_chan_to_freq(ch);
+	ret_channel->type = LORCON_CHANNEL_BASIC;
+
+	mac80211_chan_store(extras, ret_channel);
+
+	return 0;
 }
 
-int mac80211_setchan_ht_cb(lorcon_t *context, lorcon_channel_t *channel) {
+int mac80211_setchan_cb(lorcon_t *context, int channel) {
 	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	void *nl_sock;
+	int nl80211_id, r;
+
+	if (nl80211_control_acquire(&nl_sock, &nl80211_id, context->errstr) < 0)
+		return -1;
+
+	r = nl80211_setchannel_cache(extras->ifidx, nl_sock, nl80211_id,
+			channel, 0, context->errstr);
+	nl80211_control_release(r < 0);
+
+	if (r < 0) {
+		/* A failed change may have left the radio anywhere */
+		mac80211_chan_invalidate(extras);
+		return -1;
+	}
+
+	mac80211_chan_store_basic(extras, channel);
+
+	return 0;
+}
+
+int mac80211_getchan_cb(lorcon_t *context) {
+	lorcon_channel_t c;
+
+	if (mac80211_chan_refresh(context, &c) < 0)
+		return -1;
+
+	return wifi_freq_to_chan(c.channel);
+}
 
+int mac80211_getchan_ht_cb(lorcon_t *context, lorcon_channel_t *ret_channel) {
+	return mac80211_chan_refresh(context, ret_channel);
+}
+
+static int mac80211_chan_width(lorcon_channel_t *channel) {
     int nlflags = 0;
 
     switch (channel->type) {
@@ -264,18 +439,185 @@ int mac80211_setchan_ht_cb(lorcon_t *context, lorcon_channel_t *channel) {
         case LORCON_CHANNEL_10MHZ:
             nlflags = NL80211_CHAN_WIDTH_10;
             break;
+        case LORCON_CHANNEL_EHT320:
+            nlflags = NL80211_CHAN_WIDTH_320;
+            break;
     }
 
+    return nlflags;
+}
+
+int mac80211_setchan_ht_cb(lorcon_t *context, lorcon_channel_t *channel) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	void *nl_sock;
+	int nl80211_id, r;
+
+	if (nl80211_control_acquire(&nl_sock, &nl80211_id, context->errstr) < 0)
+		return -1;
+
+	r = nl80211_setfrequency_cache(extras->ifidx, nl_sock, nl80211_id,
+			channel->channel, mac80211_chan_width(channel), channel->center_freq_1,
+			channel->center_freq_2, context->errstr);
+	nl80211_control_release(r < 0);
+
+	if (r < 0) {
+		mac80211_chan_invalidate(extras);
+		return -1;
+	}
+
+	mac80211_chan_store(extras, channel);
+
+	return 0;
+}
+
+static int mac80211_async_open(lorcon_t *context) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (extras->async_nlhandle != NULL)
+		return 0;
 
-	if (nl80211_setfrequency_cache(extras->ifidx, extras->nlhandle, extras->nl80211id,
-                channel->channel, nlflags, channel->center_freq_1, channel->center_freq_2,
-                context->errstr) < 0) {
+	if (nl80211_async_connect(context->vapname, &(extras->async_nlhandle),
+				&(extras->async_nl80211id), &(extras->async_ifidx),
+				context->errstr) < 0) {
+		extras->async_nlhandle = NULL;
 		return -1;
 	}
 
 	return 0;
 }
 
+/* Remember what an async change asked for, so the cached channel can be
+ * updated when it completes.  lorcon caps how many are in flight */
+static void mac80211_async_track(struct mac80211_lorcon *extras, unsigned int seq,
+		unsigned int freq, lorcon_channel_t *channel) {
+	int n;
+
+	if (extras->async_num_req >= LORCON_CHANNEL_MAX_PENDING)
+		return;
+
+	n = extras->async_num_req++;
+
+	extras->async_req[n].seq = seq;
+
+	if (channel != NULL) {
+		extras->async_req[n].channel = *channel;
+	} else {
+		memset(&(extras->async_req[n].channel), 0, sizeof(lorcon_channel_t));
+		extras->async_req[n].channel.channel = freq;
+		extras->async_req[n].channel.type = LORCON_CHANNEL_BASIC;
+	}
+}
+
+int mac80211_setchan_async_cb(lorcon_t *context, int channel, unsigned int *ret_id) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (mac80211_async_open(context) < 0)
+		return -1;
+
+	if (nl80211_setchannel_async(extras->async_ifidx, extras->async_nlhandle,
+				extras->async_nl80211id, channel, 0, ret_id, context->errstr) < 0)
+		return -1;
+
+	mac80211_async_track(extras, *ret_id, wifi_chan_to_freq(channel), NULL);
+
+	return 0;
+}
+
+int mac80211_setchan_ht_async_cb(lorcon_t *context, lorcon_channel_t *channel,
+		unsigned int *ret_id) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (mac80211_async_open(context) < 0)
+		return -1;
+
+	if (nl80211_setfrequency_async(extras->async_ifidx, extras->async_nlhandle,
+				extras->async_nl80211id, channel->channel, mac80211_chan_width(channel),
+				channel->center_freq_1, channel->center_freq_2, ret_id,
+				context->errstr) < 0)
+		return -1;
+
+	mac80211_async_track(extras, *ret_id, 0, channel);
+
+	return 0;
+}
+
+int mac80211_chanfd_cb(lorcon_t *context) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (mac80211_async_open(context) < 0)
+		return -1;
+
+	return nl80211_async_fd(extras->async_nlhandle);
+}
+
+static void mac80211_chan_reply(unsigned int seq, int error, void *aux) {
+	lorcon_t *context = (lorcon_t *) aux;
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	int x;
+
+	for (x = 0; x < extras->async_num_req; x++) {
+		if (extras->async_req[x].seq != seq)
+			continue;
+
+		if (error == 0)
+			mac80211_chan_store(extras, &(extras->async_req[x].channel));
+		else
+			mac80211_chan_invalidate(extras);
+
+		extras->async_num_req--;
+		memmove(&(extras->async_req[x]), &(extras->async_req[x + 1]),
+				sizeof(extras->async_req[0]) * (extras->async_num_req - x));
+		break;
+	}
+
+	lorcon_channel_done(context, seq, error);
+}
+
+int mac80211_chancomplete_cb(lorcon_t *context) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (extras->async_nlhandle == NULL)
+		return 0;
+
+	return nl80211_async_complete(extras->async_nlhandle, mac80211_chan_reply,
+			context, context->errstr);
+}
+
+const lorcon_phy_caps_t *mac80211_getphycaps_cb(lorcon_t *context) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (extras->wiphy < 0 &&
+			(extras->wiphy = nl80211_get_wiphy_index(context->vapname)) < 0 &&
+			(extras->wiphy = nl80211_get_wiphy_index(context->ifname)) < 0) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				"Could not find the phy for %s", context->ifname);
+		return NULL;
+	}
+
+	return nl80211_phycap_get(extras->wiphy, context->errstr);
+}
+
+int mac80211_getsurvey_cb(lorcon_t *context, lorcon_survey_entry_t **ret_entries) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+	void *nl_sock;
+	int nl80211_id, r;
+
+	if (extras->ifidx <= 0) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				"Interface %s is not open", context->ifname);
+		return -1;
+	}
+
+	if (nl80211_control_acquire(&nl_sock, &nl80211_id, context->errstr) < 0)
+		return -1;
+
+	r = nl80211_get_survey(extras->ifidx, nl_sock, nl80211_id,
+			ret_entries, context->errstr);
+	nl80211_control_release(r < 0);
+
+	return r;
+}
+
 int mac80211_getmac_cb(lorcon_t *context, uint8_t **mac) {
 	/* 802.11 MACs are always 6 */
 	uint8_t int_mac[6];
@@ -408,6 +750,12 @@ int mac80211_sendpacket(lorcon_t *context, lorcon_packet_t *packet) {
     }
 
 	if (packet->lcpa != NULL) {
+        /* Forged with lcpf_add_fcs, tell the kernel not to add another */
+        if (lcpa_find_name(packet->lcpa, "80211FCS") != NULL) {
+            basic_rtap_hdr.flags |= IEEE80211_RADIOTAP_F_FCS;
+            mcs_rtap_hdr.flags |= IEEE80211_RADIOTAP_F_FCS;
+        }
+
 		len = lcpa_size(packet->lcpa);
 		freebytes = 1;
 		bytes = (u_char *) malloc(sizeof(u_char) * len);
@@ -443,6 +791,33 @@ int mac80211_sendpacket(lorcon_t *context, lorcon_packet_t *packet) {
 	return ret;
 }
 
+/* Close the per-context netlink sockets.  Changes still in flight can't be
+ * answered any more, so they fail; both sockets reopen on next use */
+int mac80211_close_cb(lorcon_t *context) {
+	struct mac80211_lorcon *extras = (struct mac80211_lorcon *) context->auxptr;
+
+	if (extras->async_nlhandle != NULL) {
+		nl80211_disconnect(extras->async_nlhandle);
+		extras->async_nlhandle = NULL;
+	}
+
+	while (extras->async_num_req > 0) {
+		extras->async_num_req--;
+		lorcon_channel_done(context, extras->async_req[extras->async_num_req].seq,
+				-ECANCELED);
+		mac80211_chan_invalidate(extras);
+	}
+
+	if (extras->event_nlhandle != NULL) {
+		nl80211_disconnect(extras->event_nlhandle);
+		extras->event_nlhandle = NULL;
+	}
+
+	extras->event_tried = 0;
+
+	return 0;
+}
+
 int mac80211_ifconfig_cb(lorcon_t *context, int up) {
 	return ifconfig_ifupdown(context->vapname, context->errstr, up);
 }
@@ -452,11 +827,15 @@ int drv_mac80211_init(lorcon_t *context) {
 		(struct mac80211_lorcon *) malloc(sizeof(struct mac80211_lorcon));
 
 	memset(extras, 0, sizeof(struct mac80211_lorcon));
+	extras->wiphy = -1;
+	pthread_mutex_init(&(extras->chan_lock), NULL);
 
 	context->openinject_cb = mac80211_openmon_cb;
 	context->openmon_cb = mac80211_openmon_cb;
 	context->openinjmon_cb = mac80211_openmon_cb;
 
+	context->close_cb = mac80211_close_cb;
+
 	context->ifconfig_cb = mac80211_ifconfig_cb;
 
 	context->sendpacket_cb = mac80211_sendpacket;
@@ -465,6 +844,16 @@ int drv_mac80211_init(lorcon_t *context) {
 	context->getchan_cb = mac80211_getchan_cb;
 
     context->setchan_ht_cb = mac80211_setchan_ht_cb;
+	context->getchan_ht_cb = mac80211_getchan_ht_cb;
+
+	context->setchan_async_cb = mac80211_setchan_async_cb;
+	context->setchan_ht_async_cb = mac80211_setchan_ht_async_cb;
+	context->chanfd_cb = mac80211_chanfd_cb;
+	context->chancomplete_cb = mac80211_chancomplete_cb;
+
+	context->getphycaps_cb = mac80211_getphycaps_cb;
+	context->getsurvey_cb = mac80211_getsurvey_cb;
+	context->event_cb = mac80211_event_cb;
 
 	context->getmac_cb = mac80211_getmac_cb;
 	context->setmac_cb = mac80211_setmac_cb;
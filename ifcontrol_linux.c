@@ -27,10 +27,32 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "ifcontrol_linux.h"
 #include "lorcon.h"
 
+static pthread_mutex_t ifconfig_control_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ifconfig_control_fd = -1;
+
+int ifconfig_control_socket(void)
+{
+	int fd;
+
+	if ((fd = __atomic_load_n(&ifconfig_control_fd, __ATOMIC_ACQUIRE)) >= 0)
+		return fd;
+
+	pthread_mutex_lock(&ifconfig_control_lock);
+
+	if ((fd = ifconfig_control_fd) < 0 &&
+		(fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0)
+		__atomic_store_n(&ifconfig_control_fd, fd, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&ifconfig_control_lock);
+
+	return fd;
+}
+
 char *ifconfig_get_sysdriver(const char *in_dev) 
 {
 	char devlinktarget[512];
@@ -70,7 +92,7 @@ int ifconfig_set_flags(const char *in_dev, char *errstr, short flags)
 	struct ifreq ifr;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "SetIFFlags: Failed to create AF_INET "
 			 "DGRAM socket. %d:%s", errno, strerror(errno));
@@ -83,12 +105,9 @@ int ifconfig_set_flags(const char *in_dev, char *errstr, short flags)
 	if (ioctl(skfd, SIOCSIFFLAGS, &ifr) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX, "%s %s",
 				 __FUNCTION__, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
-
 	return 0;
 }
 
@@ -97,7 +116,7 @@ int ifconfig_get_flags(const char *in_dev, char *errstr, short *flags)
 	struct ifreq ifr;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "GetIFFlags: Failed to create AF_INET "
 			 "DGRAM socket. %d:%s", errno, strerror(errno));
@@ -110,14 +129,11 @@ int ifconfig_get_flags(const char *in_dev, char *errstr, short *flags)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "GetIFFlags: interface %s: %s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
 	(*flags) = ifr.ifr_flags;
 
-	close(skfd);
-
 	return 0;
 }
 
@@ -139,7 +155,7 @@ int ifconfig_get_hwaddr(const char *in_dev, char *errstr, uint8_t * ret_hwaddr)
 	struct ifreq ifr;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Getting HWAddr: failed to create AF_INET "
 			 "DGRAM socket. %d:%s", errno, strerror(errno));
@@ -151,14 +167,11 @@ int ifconfig_get_hwaddr(const char *in_dev, char *errstr, uint8_t * ret_hwaddr)
 	if (ioctl(skfd, SIOCGIFHWADDR, &ifr) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "%s %s", in_dev, __FUNCTION__, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
 	memcpy(ret_hwaddr, ifr.ifr_hwaddr.sa_data, 6);
 
-	close(skfd);
-
 	return 0;
 }
 
@@ -167,7 +180,7 @@ int ifconfig_set_hwaddr(const char *in_dev, char *errstr, uint8_t * in_hwaddr)
 	struct ifreq ifr;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Setting HWAddr: failed to create AF_INET "
 			 "DGRAM socket. %d:%s", errno, strerror(errno));
@@ -183,7 +196,6 @@ int ifconfig_set_hwaddr(const char *in_dev, char *errstr, uint8_t * in_hwaddr)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Getting HWAddr: interface %s: %s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -193,12 +205,9 @@ int ifconfig_set_hwaddr(const char *in_dev, char *errstr, uint8_t * in_hwaddr)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Setting HWAddr: interface %s: %s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
-
 	return 0;
 }
 
@@ -207,7 +216,7 @@ int ifconfig_set_mtu(const char *in_dev, char *errstr, uint16_t in_mtu)
 	struct ifreq ifr;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Setting MTU: failed to create AF_INET "
 			 "DGRAM socket. %d:%s", errno, strerror(errno));
@@ -220,12 +229,9 @@ int ifconfig_set_mtu(const char *in_dev, char *errstr, uint16_t in_mtu)
 	if (ioctl(skfd, SIOCSIFMTU, &ifr) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "%s %s", in_dev, __FUNCTION__, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
-
 	return 0;
 }
 
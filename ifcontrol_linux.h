@@ -61,6 +61,11 @@ char *ifconfig_get_sysdriver(const char *in_dev);
 /* Check if an attribute (ie, file) exists in the /sys path for an interface */
 int ifconfig_get_sysattr(const char *in_dev, const char *attr);
 
+/* AF_INET socket for interface ioctls, shared by every caller and thread;
+ * opened on first use and kept for the life of the process.  Never close
+ * it.  Returns -1 with errno set if it can't be opened */
+int ifconfig_control_socket(void);
+
 int ifconfig_set_flags(const char *in_dev, char *errstr, short flags);
 int ifconfig_delta_flags(const char *in_dev, char *errstr, short flags);
 int ifconfig_get_flags(const char *in_dev, char *errstr, short *flags);
@@ -27,6 +27,7 @@
 #include <math.h>
 
 #include "iwcontrol.h"
+#include "ifcontrol_linux.h"
 #include "lorcon.h"
 
 #ifndef rintf
@@ -53,21 +54,19 @@ void iwfloat2freq(double in_val, struct iw_freq *out_freq)
 
 int floatchan2int(float in_chan)
 {
-    if (in_chan == 0)
-        return 0;
-
-    if (in_chan == 2484)
-        return 14;
-    else if (in_chan < 2484)
-        return (in_chan - 2407) / 5;
-    else if (in_chan >= 4910 && in_chan <= 4980)
-        return (in_chan - 4000) / 5;
-    else if (in_chan <= 45000)
-        return (in_chan - 5000) / 5;
-    else if (in_chan >= 58320 && in_chan <= 64800)
-        return (in_chan - 56160) / 2160;
-
-    return in_chan;
+	unsigned int chan;
+
+	if (in_chan == 0)
+		return 0;
+
+	/* Drivers may report a channel number rather than a frequency */
+	if (in_chan < 250)
+		return in_chan;
+
+	if ((chan = lorcon_freq_to_chan((unsigned int) rintf(in_chan), NULL)) == 0)
+		return in_chan;
+
+	return chan;
 }
 
 int iwconfig_set_ssid(const char *in_dev, char *errstr, char *in_essid)
@@ -83,7 +82,7 @@ int iwconfig_set_ssid(const char *in_dev, char *errstr, char *in_essid)
 		snprintf(essid, IW_ESSID_MAX_SIZE + 1, "%s", in_essid);
 	}
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create ioctl socket to set SSID on %s: %s",
 			 in_dev, strerror(errno));
@@ -100,11 +99,9 @@ int iwconfig_set_ssid(const char *in_dev, char *errstr, char *in_essid)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to set SSID on %s: %s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
 	return 0;
 }
 
@@ -114,7 +111,7 @@ int iwconfig_get_ssid(const char *in_dev, char *errstr, char *in_essid)
 	int skfd;
 	char essid[IW_ESSID_MAX_SIZE + 1];
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create socket to fetch SSID on %s: %s",
 			 in_dev, strerror(errno));
@@ -130,14 +127,12 @@ int iwconfig_get_ssid(const char *in_dev, char *errstr, char *in_essid)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to fetch SSID from %s: %s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
 	snprintf(in_essid, min(IW_ESSID_MAX_SIZE, wrq.u.essid.length) + 1, "%s",
 		 (char *)wrq.u.essid.pointer);
 
-	close(skfd);
 	return 0;
 }
 
@@ -146,7 +141,7 @@ int iwconfig_get_name(const char *in_dev, char *errstr, char *in_name)
 	struct iwreq wrq;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create socket to get name on %s: %s",
 			 in_dev, strerror(errno));
@@ -159,13 +154,11 @@ int iwconfig_get_name(const char *in_dev, char *errstr, char *in_name)
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to get name on %s :%s", in_dev,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
 	snprintf(in_name, IFNAMSIZ, "%s", wrq.u.name);
 
-	close(skfd);
 	return 0;
 }
 
@@ -187,7 +180,7 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 
 	memset(priv, 0, sizeof(priv));
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create socket to set private ioctl "
 			 "on %s: %s", in_dev, strerror(errno));
@@ -205,7 +198,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to retrieve list of private ioctls on %s: %s",
 			 in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -216,7 +208,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to find private ioctl '%s' on %s", 
 			 privcmd, in_dev);
-		close(skfd);
 		return -2;
 	}
 
@@ -233,7 +224,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 			snprintf(errstr, LORCON_STATUS_MAX,
 				 "Unable to find subioctl '%s' on %s", 
 				 privcmd, in_dev);
-			close(skfd);
 			return -2;
 		}
 
@@ -248,7 +238,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to set values for private ioctl '%s' on %s",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -256,7 +245,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "'%s' on %s does not accept integer parameters.",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -266,7 +254,6 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Private ioctl '%s' on %s expects more than "
 			 "2 arguments.", privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -300,11 +287,9 @@ int iwconfig_set_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to set private ioctl '%s' on %s: %s", privcmd,
 			 in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
 	return 0;
 }
 
@@ -320,7 +305,7 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 
 	memset(priv, 0, sizeof(priv));
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create socket to fetch private ioctl "
 			 "on %s: %s", in_dev, strerror(errno));
@@ -338,7 +323,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to retrieve list of private ioctls on %s: %s",
 			 in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -349,7 +333,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to find private ioctl '%s' on %s", privcmd,
 			 in_dev);
-		close(skfd);
 		return -2;
 	}
 
@@ -366,7 +349,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 			snprintf(errstr, LORCON_STATUS_MAX,
 				 "Unable to find subioctl '%s' on %s", privcmd,
 				 in_dev);
-			close(skfd);
 			return -2;
 		}
 
@@ -381,7 +363,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to get values for private ioctl '%s' on %s",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -389,7 +370,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Private ioctl '%s' on %s does not return "
 			 "integer parameters.", privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -400,7 +380,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 			 "Private ioctl '%s' on %s returns more than 1 "
 			 "parameter and we can't handle that at the moment.",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -430,7 +409,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to call get private ioctl '%s' on %s: %s",
 			 privcmd, in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -442,7 +420,6 @@ int iwconfig_get_intpriv(const char *in_dev, const char *privcmd,
 	/* Return the value of the ioctl */
 	(*val) = ((__s32 *) buffer)[0];
 
-	close(skfd);
 	return 0;
 }
 
@@ -460,7 +437,7 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 
 	memset(priv, 0, sizeof(priv));
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to create socket to set private ioctl "
 			 "on %s: %s", in_dev, strerror(errno));
@@ -478,7 +455,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to retrieve list of private ioctls on %s: %s",
 			 in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -489,7 +465,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to find private ioctl '%s' on %s", 
 			 privcmd, in_dev);
-		close(skfd);
 		return -2;
 	}
 
@@ -506,7 +481,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 			snprintf(errstr, LORCON_STATUS_MAX,
 				 "Unable to find subioctl '%s' on %s", 
 				 privcmd, in_dev);
-			close(skfd);
 			return -2;
 		}
 
@@ -521,7 +495,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Unable to set values for private ioctl '%s' on %s",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -529,7 +502,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "'%s' on %s does not accept char parameters.",
 			 privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 
@@ -539,7 +511,6 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 	if (nargs > 1) {
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Private ioctl '%s' on %s expects more than 1 arguments.", privcmd, in_dev);
-		close(skfd);
 		return -1;
 	}
 #endif
@@ -570,11 +541,9 @@ int iwconfig_set_charpriv(const char *in_dev, const char *privcmd,
 		snprintf(errstr, LORCON_STATUS_MAX,
 			 "Failed to set private ioctl '%s' on %s: %s", privcmd,
 			 in_dev, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
 	return 0;
 }
 
@@ -587,7 +556,7 @@ int iwconfig_get_levels(const char *in_dev, char *in_err, int *level,
 	char buffer[sizeof(struct iw_range) * 2];
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to create AF_INET DGRAM socket %d:%s", errno,
 			 strerror(errno));
@@ -605,7 +574,6 @@ int iwconfig_get_levels(const char *in_dev, char *in_err, int *level,
 	if (ioctl(skfd, SIOCGIWRANGE, &wrq) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to fetch signal range, %s", strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -621,7 +589,6 @@ int iwconfig_get_levels(const char *in_dev, char *in_err, int *level,
 	if (ioctl(skfd, SIOCGIWSTATS, &wrq) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to fetch signal stats, %s", strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
@@ -629,7 +596,6 @@ int iwconfig_get_levels(const char *in_dev, char *in_err, int *level,
 	   if (stats.qual.level <= range.max_qual.level) {
 	   *level = 0;
 	   *noise = 0;
-	   close(skfd);
 	   return 0;
 	   }
 	 */
@@ -637,8 +603,6 @@ int iwconfig_get_levels(const char *in_dev, char *in_err, int *level,
 	*level = stats.qual.level - 0x100;
 	*noise = stats.qual.noise - 0x100;
 
-	close(skfd);
-
 	return 0;
 }
 
@@ -647,7 +611,7 @@ int iwconfig_get_channel(const char *in_dev, char *in_err)
 	struct iwreq wrq;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to create AF_INET DGRAM socket %d:%s", errno,
 			 strerror(errno));
@@ -661,11 +625,9 @@ int iwconfig_get_channel(const char *in_dev, char *in_err)
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "channel get ioctl failed %d:%s", errno,
 			 strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
 	return (floatchan2int(iwfreq2float(&wrq)));
 }
 
@@ -674,7 +636,7 @@ int iwconfig_set_channel(const char *in_dev, char *in_err, int in_ch)
 	struct iwreq wrq;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to create AF_INET DGRAM socket %d:%s", errno,
 			 strerror(errno));
@@ -706,12 +668,10 @@ int iwconfig_set_channel(const char *in_dev, char *in_err, int in_ch)
 			snprintf(in_err, LORCON_STATUS_MAX,
 				 "Failed to set channel %d %d:%s", in_ch, errno,
 				 strerror(errno));
-			close(skfd);
 			return -1;
 		}
 	}
 
-	close(skfd);
 	return 0;
 }
 
@@ -720,7 +680,7 @@ int iwconfig_get_mode(const char *in_dev, char *in_err)
 	struct iwreq wrq;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to create AF_INET DGRAM socket %d:%s", errno,
 			 strerror(errno));
@@ -733,12 +693,9 @@ int iwconfig_get_mode(const char *in_dev, char *in_err)
 	if (ioctl(skfd, SIOCGIWMODE, &wrq) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "mode get ioctl failed %d:%s", errno, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
-
 	return (wrq.u.mode);
 }
 
@@ -747,7 +704,7 @@ int iwconfig_set_mode(const char *in_dev, char *in_err, int tx80211_mode)
 	struct iwreq wrq;
 	int skfd;
 
-	if ((skfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	if ((skfd = ifconfig_control_socket()) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "Failed to create AF_INET DGRAM socket %d:%s", errno,
 			 strerror(errno));
@@ -763,11 +720,9 @@ int iwconfig_set_mode(const char *in_dev, char *in_err, int tx80211_mode)
 	if (ioctl(skfd, SIOCSIWMODE, &wrq) < 0) {
 		snprintf(in_err, LORCON_STATUS_MAX,
 			 "mode set ioctl failed %d:%s", errno, strerror(errno));
-		close(skfd);
 		return -1;
 	}
 
-	close(skfd);
 	return 0;
 }
 
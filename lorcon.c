@@ -24,13 +24,17 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include <pcap.h>
 
 #include "lorcon.h"
 #include "lorcon_packet.h"
 #include "lorcon_int.h"
-#include "wifi_ht_channels.h"
+#include "nl80211_control.h"
 
 
 #include "drv_mac80211.h"
@@ -156,12 +160,19 @@ lorcon_t *lorcon_create(const char *interface, lorcon_driver_t *driver) {
 	context->errstr[0] = 0;
 
 	context->timeout_ms = 0;
+	context->nonblock = 0;
+	context->validate_fcs = 0;
 
 	memset(context->original_mac, 0, 6);
 
 	context->handler_cb = NULL;
 	context->handler_user = NULL;
 
+	context->control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	context->control_pending = 0;
+	context->wakeup_cb = NULL;
+	context->wakeup_aux = NULL;
+
 	context->close_cb = NULL;
 	context->openinject_cb = NULL;
 	context->openmon_cb = NULL;
@@ -181,6 +192,8 @@ lorcon_t *lorcon_create(const char *interface, lorcon_driver_t *driver) {
 	context->wepkeys = NULL;
 
 	if ((*(driver->init_func))(context) < 0) {
+		if (context->control_fd >= 0)
+			close(context->control_fd);
 		free(context);
 		return NULL;
 	}
@@ -193,6 +206,8 @@ void lorcon_free(lorcon_t *context) {
     if (context == NULL)
         return;
 
+    lorcon_disable_events(context);
+
 	if (context->close_cb != NULL) 
 		(*(context->close_cb))(context);
 
@@ -201,6 +216,9 @@ void lorcon_free(lorcon_t *context) {
     if (context->vapname != NULL)
         free(context->vapname);
 
+	if (context->control_fd >= 0)
+		close(context->control_fd);
+
 	free(context);
 }
 
@@ -212,14 +230,170 @@ int lorcon_get_timeout(lorcon_t *context) {
 	return context->timeout_ms;
 }
 
+void lorcon_set_fcs_validate(lorcon_t *context, int validate) {
+	context->validate_fcs = validate;
+}
+
+int lorcon_get_fcs_validate(lorcon_t *context) {
+	return context->validate_fcs;
+}
+
+static int64_t lorcon_mono_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Wall clock, which is what capture timestamps use */
+static int64_t lorcon_real_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int64_t lorcon_tv_us(const struct timeval *tv) {
+	return ((int64_t) tv->tv_sec * 1000000) + tv->tv_usec;
+}
+
+/* Record a channel change which started at start_us and has completed.
+ * Only the thread changing channel writes epochs; capture threads read
+ * them under the sequence lock */
+static void lorcon_channel_epoch_push(lorcon_t *context, lorcon_channel_t *channel,
+		int64_t start_us) {
+	lorcon_channel_epoch_t *e;
+	int64_t end_us = lorcon_real_us();
+
+	__atomic_add_fetch(&context->epoch_lock, 1, __ATOMIC_ACQ_REL);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	e = &(context->epochs[context->epoch_count % LORCON_CHANNEL_EPOCHS]);
+
+	e->id = context->epoch_count + 1;
+	e->channel = *channel;
+	e->changed_ns = lorcon_mono_ns();
+	e->started.tv_sec = start_us / 1000000;
+	e->started.tv_usec = start_us % 1000000;
+	e->completed.tv_sec = end_us / 1000000;
+	e->completed.tv_usec = end_us % 1000000;
+
+	context->epoch_count++;
+
+	__atomic_add_fetch(&context->epoch_lock, 1, __ATOMIC_RELEASE);
+}
+
+static void lorcon_channel_epoch_basic(lorcon_t *context, int channel,
+		int64_t start_us) {
+	lorcon_channel_t c;
+
+	memset(&c, 0, sizeof(lorcon_channel_t));
+	c.channel = wifi_chan_to_freq(channel);
+	c.type = LORCON_CHANNEL_BASIC;
+
+	lorcon_channel_epoch_push(context, &c, start_us);
+}
+
+int lorcon_get_channel_epoch(lorcon_t *context, lorcon_channel_epoch_t *ret_epoch) {
+	unsigned int seq;
+	int found;
+
+	do {
+		while ((seq = __atomic_load_n(&context->epoch_lock, __ATOMIC_ACQUIRE)) & 1)
+			;
+
+		found = context->epoch_count > 0;
+
+		if (found)
+			*ret_epoch = context->epochs[(context->epoch_count - 1) %
+				LORCON_CHANNEL_EPOCHS];
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&context->epoch_lock, __ATOMIC_RELAXED) != seq);
+
+	if (!found) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				 "Channel has not been changed through lorcon");
+		return -1;
+	}
+
+	return 0;
+}
+
+void lorcon_channel_stamp(lorcon_t *context, lorcon_packet_t *packet) {
+	const lorcon_channel_epoch_t *e, *match;
+	int64_t ts = lorcon_tv_us(&packet->ts);
+	unsigned int seq, count, x;
+	int ambiguous;
+
+	do {
+		while ((seq = __atomic_load_n(&context->epoch_lock, __ATOMIC_ACQUIRE)) & 1)
+			;
+
+		count = context->epoch_count;
+		match = NULL;
+		ambiguous = 0;
+
+		/* Newest first; usually the frame arrived after the latest change */
+		for (x = 0; x < count && x < LORCON_CHANNEL_EPOCHS; x++) {
+			e = &(context->epochs[(count - 1 - x) % LORCON_CHANNEL_EPOCHS]);
+
+			if (ts >= lorcon_tv_us(&e->completed)) {
+				match = e;
+				break;
+			}
+
+			/* Arrived while changing; it could be from either channel */
+			if (ts >= lorcon_tv_us(&e->started)) {
+				match = e;
+				ambiguous = 1;
+				break;
+			}
+		}
+
+		if (match != NULL) {
+			packet->tuned_epoch = match->id;
+			packet->tuned_freq = match->channel.channel;
+			packet->tuned_type = match->channel.type;
+			packet->tuned_center_freq_1 = match->channel.center_freq_1;
+			packet->tuned_center_freq_2 = match->channel.center_freq_2;
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&context->epoch_lock, __ATOMIC_RELAXED) != seq);
+
+	/* Older than every epoch we remember, or than the first change */
+	if (match == NULL) {
+		packet->channel_ambiguous = count > 0;
+		return;
+	}
+
+	packet->channel_ambiguous = ambiguous;
+
+	if (packet->channel == 0)
+		packet->channel = wifi_freq_to_chan(packet->tuned_freq);
+}
+
 int lorcon_set_channel(lorcon_t *context, int channel) {
+	int64_t start;
+	int r;
+
 	if (context->setchan_cb == NULL) {
 		snprintf(context->errstr, LORCON_STATUS_MAX, 
 				 "Driver %s does not support setting channel", context->drivername);
 		return LORCON_ENOTSUPP;
 	}
 
-	return (*(context->setchan_cb))(context, channel);
+	start = lorcon_real_us();
+
+	if ((r = (*(context->setchan_cb))(context, channel)) < 0)
+		return r;
+
+	lorcon_channel_epoch_basic(context, channel, start);
+
+	return r;
 }
 
 int lorcon_get_channel(lorcon_t *context) {
@@ -233,131 +407,319 @@ int lorcon_get_channel(lorcon_t *context) {
 }
 
 int lorcon_set_complex_channel(lorcon_t *context, lorcon_channel_t *channel) {
+    int64_t start;
+    int r;
+
     if (context->setchan_ht_cb == NULL) {
         snprintf(context->errstr, LORCON_STATUS_MAX,
                 "Driver %s does not support HT channels", context->drivername);
         return LORCON_ENOTSUPP;
     }
 
-    return (*(context->setchan_ht_cb))(context, channel);
+    start = lorcon_real_us();
+
+    if ((r = (*(context->setchan_ht_cb))(context, channel)) < 0)
+        return r;
+
+    lorcon_channel_epoch_push(context, channel, start);
+
+    return r;
+}
+
+static unsigned int lorcon_channel_next_id(lorcon_t *context) {
+	/* Ids are returned as positive ints */
+	if (context->chan_seq >= INT_MAX)
+		context->chan_seq = 0;
+
+	return ++context->chan_seq;
+}
+
+void lorcon_set_channel_handler(lorcon_t *context, lorcon_channel_handler handler,
+		void *aux) {
+	context->chan_cb = handler;
+	context->chan_aux = aux;
 }
 
-unsigned int wifi_chan_to_freq(unsigned int in_chan) {
-    /* 802.11 channels to frequency; if it looks like a frequency, return as
-     * pure frequency; derived from iwconfig */
+/* Change the channel synchronously for drivers without async support, and
+ * report it straight away */
+static int lorcon_channel_sync(lorcon_t *context, int channel,
+		lorcon_channel_t *complex) {
+	unsigned int id;
+	int64_t start;
+	int r;
 
-    if (in_chan > 250)
-        return in_chan;
+	start = lorcon_mono_ns();
 
-    if (in_chan == 14)
-        return 2484;
-    else if (in_chan < 14)
-        return 2407 + in_chan * 5;
-    else if (in_chan >= 182 && in_chan <= 196)
-        return 4000 + in_chan * 5;
-    else
-        return 5000 + in_chan * 5;
+	if (complex != NULL)
+		r = lorcon_set_complex_channel(context, complex);
+	else
+		r = lorcon_set_channel(context, channel);
 
-    return in_chan;
+	if (r < 0)
+		return r;
+
+	id = lorcon_channel_next_id(context);
+
+	if (context->chan_cb != NULL)
+		(*(context->chan_cb))(context, id, 0,
+				(unsigned int) ((lorcon_mono_ns() - start) / 1000),
+				context->chan_aux);
+
+	return (int) id;
 }
 
-unsigned int wifi_freq_to_chan(unsigned int in_freq) {
-    if (in_freq < 250)
-        return in_freq;
+static int lorcon_channel_async(lorcon_t *context, int channel,
+		lorcon_channel_t *complex) {
+	struct lorcon_channel_request *req;
+	unsigned int drv_id;
+	int64_t sent, sent_us;
+	int r;
 
-    /* revamped from iw */
-    if (in_freq == 2484)
-        return 14;
+	if ((complex != NULL && context->setchan_ht_async_cb == NULL) ||
+			(complex == NULL && context->setchan_async_cb == NULL))
+		return lorcon_channel_sync(context, channel, complex);
 
-    if (in_freq < 2484)
-        return (in_freq - 2407) / 5;
+	if (context->chan_num_pending >= LORCON_CHANNEL_MAX_PENDING) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				"Too many channel changes in flight");
+		return LORCON_EGENERIC;
+	}
+
+	sent = lorcon_mono_ns();
+	sent_us = lorcon_real_us();
+
+	if (complex != NULL)
+		r = (*(context->setchan_ht_async_cb))(context, complex, &drv_id);
+	else
+		r = (*(context->setchan_async_cb))(context, channel, &drv_id);
+
+	if (r < 0)
+		return r;
+
+	req = &(context->chan_pending[context->chan_num_pending++]);
+	req->id = lorcon_channel_next_id(context);
+	req->drv_id = drv_id;
+	req->sent_ns = sent;
+	req->sent_us = sent_us;
+
+	if (complex != NULL) {
+		req->channel = *complex;
+	} else {
+		memset(&(req->channel), 0, sizeof(lorcon_channel_t));
+		req->channel.channel = wifi_chan_to_freq(channel);
+		req->channel.type = LORCON_CHANNEL_BASIC;
+	}
 
-    return in_freq / 5 - 1000;
+	return (int) req->id;
 }
 
-int lorcon_get_complex_channel(lorcon_t *context, lorcon_channel_t *ret_channel) {
-    if (context->getchan_ht_cb == NULL) {
-        snprintf(context->errstr, LORCON_STATUS_MAX,
-                "Driver %s does not support getting HT channel", context->drivername);
-        return LORCON_ENOTSUPP;
-    }
+int lorcon_set_channel_async(lorcon_t *context, int channel) {
+	return lorcon_channel_async(context, channel, NULL);
+}
 
-    return (*(context->getchan_ht_cb))(context, ret_channel);
+int lorcon_set_complex_channel_async(lorcon_t *context, lorcon_channel_t *channel) {
+	return lorcon_channel_async(context, 0, channel);
 }
 
-int lorcon_parse_ht_channel(const char *in_chanstr, lorcon_channel_t *ret_channel) {
-    char chtype[16];
-    unsigned int channel, ci;
-    int r;
+void lorcon_channel_done(lorcon_t *context, unsigned int drv_id, int error) {
+	unsigned int id, rtt;
+	int x;
 
-    memset(ret_channel, 0, sizeof(lorcon_channel_t));
+	/* Replies almost always arrive in order, so this is usually the first */
+	for (x = 0; x < context->chan_num_pending; x++) {
+		if (context->chan_pending[x].drv_id == drv_id)
+			break;
+	}
 
-    r = sscanf(in_chanstr, "%u%16s", &channel, chtype);
+	if (x == context->chan_num_pending)
+		return;
 
-    if (r == 0) {
-        /* Unable to parse */
-        return -1;
-    }
+	id = context->chan_pending[x].id;
+	rtt = (unsigned int) ((lorcon_mono_ns() - context->chan_pending[x].sent_ns) / 1000);
 
-    ret_channel->channel = wifi_chan_to_freq(channel);
+	if (error == 0)
+		lorcon_channel_epoch_push(context, &(context->chan_pending[x].channel),
+				context->chan_pending[x].sent_us);
 
-    if (r == 1) {
-        /* No channel flags */
-        ret_channel->type = LORCON_CHANNEL_BASIC;
-        return 0;
-    }
+	context->chan_num_pending--;
+	memmove(&(context->chan_pending[x]), &(context->chan_pending[x + 1]),
+			sizeof(struct lorcon_channel_request) * (context->chan_num_pending - x));
+
+	if (context->chan_cb != NULL)
+		(*(context->chan_cb))(context, id, error, rtt, context->chan_aux);
+}
+
+int lorcon_get_channel_fd(lorcon_t *context) {
+	if (context->chanfd_cb == NULL)
+		return -1;
+
+	return (*(context->chanfd_cb))(context);
+}
+
+int lorcon_complete_channel(lorcon_t *context) {
+	if (context->chancomplete_cb == NULL || context->chan_num_pending == 0)
+		return 0;
+
+	return (*(context->chancomplete_cb))(context);
+}
+
+int lorcon_get_channel_pending(lorcon_t *context) {
+	return context->chan_num_pending;
+}
+
+const lorcon_phy_caps_t *lorcon_get_phy_caps(lorcon_t *context) {
+	if (context->getphycaps_cb == NULL) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				 "Driver %s does not report phy capabilities", context->drivername);
+		return NULL;
+	}
+
+	return (*(context->getphycaps_cb))(context);
+}
+
+lorcon_survey_t *lorcon_get_survey(lorcon_t *context) {
+	lorcon_survey_t *survey;
+	lorcon_survey_entry_t *entries;
+	int n;
+
+	if (context->getsurvey_cb == NULL) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				 "Driver %s does not support channel surveys", context->drivername);
+		return NULL;
+	}
+
+	if ((n = (*(context->getsurvey_cb))(context, &entries)) < 0)
+		return NULL;
+
+	if ((survey = (lorcon_survey_t *) malloc(sizeof(lorcon_survey_t))) == NULL) {
+		snprintf(context->errstr, LORCON_STATUS_MAX, "Out of memory");
+		free(entries);
+		return NULL;
+	}
 
-    /* Parse flag types */
-    if (strcasecmp(chtype, "HT20") == 0) {
-        ret_channel->type = LORCON_CHANNEL_HT20;
-        return 0;
-    } else if (strcasecmp(chtype, "HT40+") == 0) {
-        ret_channel->type = LORCON_CHANNEL_HT40P;
-        ret_channel->center_freq_1 = ret_channel->channel + 10;
-        return 0;
-    } else if (strcasecmp(chtype, "HT40-") == 0) {
-        ret_channel->type = LORCON_CHANNEL_HT40M;
-        ret_channel->center_freq_1 = ret_channel->channel - 10;
-        return 0;
-    } else if (strcasecmp(chtype, "VHT80") == 0) {
-        ret_channel->type = LORCON_CHANNEL_VHT80;
-        for (ci = 0; ci < sizeof(wifi_ht_channels) / sizeof(wifi_channel); ci++) {
-            if (wifi_ht_channels[ci].chan == channel ||
-                    wifi_ht_channels[ci].freq == channel) {
-                if ((wifi_ht_channels[ci].flags & WIFI_HT_HT80) == 0) {
-                    return -1;
-                }
-
-                ret_channel->center_freq_1 = wifi_ht_channels[ci].freq80;
-                return 0;
-            }
-        }
-
-        return -1;
-    } else if (strcasecmp(chtype, "VHT160") == 0) {
-        ret_channel->type = LORCON_CHANNEL_VHT160;
-        for (ci = 0; ci < sizeof(wifi_ht_channels) / sizeof(wifi_channel); ci++) {
-            if (wifi_ht_channels[ci].chan == channel ||
-                    wifi_ht_channels[ci].freq == channel) {
-                if ((wifi_ht_channels[ci].flags & WIFI_HT_HT160) == 0) {
-                    return -1;
-                }
-
-                ret_channel->center_freq_1 = wifi_ht_channels[ci].freq160;
-                return 0;
-            }
-        }
-
-        return -1;
-    } else if (strcasecmp(chtype, "W10") == 0) {
-        ret_channel->type = LORCON_CHANNEL_10MHZ;
-        return 0;
-    } else if (strcasecmp(chtype, "W5") == 0) {
-        ret_channel->type = LORCON_CHANNEL_5MHZ;
-        return 0;
+	survey->sampled_ns = lorcon_mono_ns();
+	survey->num_entries = n;
+	survey->entries = entries;
+
+	return survey;
+}
+
+void lorcon_free_survey(lorcon_survey_t *survey) {
+	if (survey == NULL)
+		return;
+
+	free(survey->entries);
+	free(survey);
+}
+
+const lorcon_survey_entry_t *lorcon_survey_find(const lorcon_survey_t *survey,
+		unsigned int freq) {
+	int x;
+
+	for (x = 0; x < survey->num_entries; x++) {
+		if (survey->entries[x].freq == freq)
+			return &(survey->entries[x]);
+	}
+
+	return NULL;
+}
+
+/* A counter which went backwards was reset since the earlier sample */
+static uint64_t lorcon_survey_diff(uint64_t before, uint64_t after) {
+	return after >= before ? after - before : after;
+}
+
+lorcon_survey_t *lorcon_survey_delta(const lorcon_survey_t *before,
+		const lorcon_survey_t *after) {
+	lorcon_survey_t *delta;
+	const lorcon_survey_entry_t *b, *a;
+	lorcon_survey_entry_t *d;
+	int x;
+
+	if ((delta = (lorcon_survey_t *) malloc(sizeof(lorcon_survey_t))) == NULL)
+		return NULL;
+
+	delta->sampled_ns = after->sampled_ns - before->sampled_ns;
+	delta->num_entries = 0;
+	delta->entries = NULL;
+
+	if (after->num_entries > 0 &&
+			(delta->entries = (lorcon_survey_entry_t *)
+			 malloc(sizeof(lorcon_survey_entry_t) * after->num_entries)) == NULL) {
+		free(delta);
+		return NULL;
+	}
+
+	for (x = 0; x < after->num_entries; x++) {
+		a = &(after->entries[x]);
+
+		/* Surveys come back in the same order, so look in the same place
+		 * first */
+		if (x < before->num_entries && before->entries[x].freq == a->freq)
+			b = &(before->entries[x]);
+		else if ((b = lorcon_survey_find(before, a->freq)) == NULL)
+			continue;
+
+		d = &(delta->entries[delta->num_entries++]);
+
+		d->freq = a->freq;
+		d->in_use = a->in_use;
+		d->present = a->present & (b->present | LORCON_SURVEY_NOISE);
+		d->noise_dbm = a->noise_dbm;
+
+		d->active_ms = lorcon_survey_diff(b->active_ms, a->active_ms);
+		d->busy_ms = lorcon_survey_diff(b->busy_ms, a->busy_ms);
+		d->ext_busy_ms = lorcon_survey_diff(b->ext_busy_ms, a->ext_busy_ms);
+		d->rx_ms = lorcon_survey_diff(b->rx_ms, a->rx_ms);
+		d->tx_ms = lorcon_survey_diff(b->tx_ms, a->tx_ms);
+		d->scan_ms = lorcon_survey_diff(b->scan_ms, a->scan_ms);
+	}
+
+	return delta;
+}
+
+const lorcon_phy_freq_t *lorcon_phy_caps_find(const lorcon_phy_caps_t *caps,
+		unsigned int freq) {
+	unsigned int slot;
+	int x;
+
+	if (freq >= LORCON_PHY_FREQ_BASE && (freq - LORCON_PHY_FREQ_BASE) % 5 == 0 &&
+			(slot = (freq - LORCON_PHY_FREQ_BASE) / 5) < LORCON_PHY_FREQ_SLOTS) {
+		if (caps->freq_index[slot] == 0)
+			return NULL;
+
+		return &(caps->freqs[caps->freq_index[slot] - 1]);
+	}
+
+	/* Off the raster (60GHz and the like) */
+	for (x = 0; x < caps->num_freqs; x++) {
+		if (caps->freqs[x].freq == freq)
+			return &(caps->freqs[x]);
+	}
+
+	return NULL;
+}
+
+void lorcon_put_phy_caps(const lorcon_phy_caps_t *caps) {
+#ifdef SYS_LINUX
+	nl80211_phycap_put(caps);
+#endif
+}
+
+void lorcon_flush_phy_caps(void) {
+#ifdef SYS_LINUX
+	nl80211_phycap_invalidate(-1);
+#endif
+}
+
+int lorcon_get_complex_channel(lorcon_t *context, lorcon_channel_t *ret_channel) {
+    if (context->getchan_ht_cb == NULL) {
+        snprintf(context->errstr, LORCON_STATUS_MAX,
+                "Driver %s does not support getting HT channel", context->drivername);
+        return LORCON_ENOTSUPP;
     }
 
-    return -1;
+    return (*(context->getchan_ht_cb))(context, ret_channel);
 }
 
 int lorcon_open_inject(lorcon_t *context) {
@@ -470,6 +832,57 @@ void lorcon_pcap_handler(u_char *user, const struct pcap_pkthdr *h,
 	(*(context->handler_cb))(context, packet, context->handler_user);
 }
 
+/* Wait on the capture and control fds and dispatch as packets arrive, so a
+ * break or wakeup from another thread is seen at once */
+static int lorcon_control_loop(lorcon_t *context, int count) {
+	struct pollfd pfd[2];
+	int ret, processed = 0;
+
+	pfd[0].fd = context->capture_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = context->control_fd;
+	pfd[1].events = POLLIN;
+
+	while (count <= 0 || processed < count) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			snprintf(context->errstr, LORCON_STATUS_MAX,
+					"poll failed: %s", strerror(errno));
+			return -1;
+		}
+
+		if (pfd[1].revents && lorcon_service_control(context))
+			return -2;
+
+		if (pfd[0].revents == 0)
+			continue;
+
+		lorcon_pcap_enter(context);
+		ret = pcap_dispatch(context->pcap, count > 0 ? count - processed : -1,
+				lorcon_pcap_handler, (u_char *) context);
+		lorcon_pcap_leave(context, ret);
+
+		if (ret == -2)
+			return ret;
+
+		if (ret < 0) {
+			snprintf(context->errstr, LORCON_STATUS_MAX,
+					"pcap_dispatch failed: %s", pcap_geterr(context->pcap));
+			return ret;
+		}
+
+		/* End of a savefile */
+		if (ret == 0 && pcap_file(context->pcap) != NULL)
+			return 0;
+
+		processed += ret;
+	}
+
+	return 0;
+}
+
 int lorcon_loop(lorcon_t *context, int count, lorcon_handler callback,
 				u_char *user) {
     int ret;
@@ -484,7 +897,12 @@ int lorcon_loop(lorcon_t *context, int count, lorcon_handler callback,
 	context->handler_cb = callback;
 	context->handler_user = user;
 
+	if (context->control_fd >= 0 && context->capture_fd >= 0)
+		return lorcon_control_loop(context, count);
+
+	lorcon_pcap_enter(context);
 	ret = pcap_loop(context->pcap, count, lorcon_pcap_handler, (u_char *) context);
+	lorcon_pcap_leave(context, ret);
 
     if (ret == -1) {
         snprintf(context->errstr, LORCON_STATUS_MAX,
@@ -505,10 +923,16 @@ int lorcon_dispatch(lorcon_t *context, int count, lorcon_handler callback,
 		return LORCON_ENOTSUPP;
 	}
 
+	if (__atomic_load_n(&context->control_pending, __ATOMIC_RELAXED) &&
+			lorcon_service_control(context))
+		return -2;
+
 	context->handler_cb = callback;
 	context->handler_user = user;
 
+	lorcon_pcap_enter(context);
 	ret = pcap_dispatch(context->pcap, count, lorcon_pcap_handler, (u_char *) context);
+	lorcon_pcap_leave(context, ret);
 
     if (ret == -1) {
         snprintf(context->errstr, LORCON_STATUS_MAX,
@@ -518,11 +942,75 @@ int lorcon_dispatch(lorcon_t *context, int count, lorcon_handler callback,
     return ret;
 }
 
+int lorcon_set_nonblock(lorcon_t *context, int nonblock) {
+	char pcaperr[PCAP_ERRBUF_SIZE];
+
+	if (context->pcap == NULL) {
+		snprintf(context->errstr, LORCON_STATUS_MAX, 
+				 "capture driver %s did not create a pcap context",
+				 lorcon_get_driver_name(context));
+		return LORCON_ENOTSUPP;
+	}
+
+	if (pcap_setnonblock(context->pcap, nonblock, pcaperr) < 0) {
+		snprintf(context->errstr, LORCON_STATUS_MAX,
+				 "pcap_setnonblock failed: %s", pcaperr);
+		return -1;
+	}
+
+	context->nonblock = nonblock;
+
+	return 0;
+}
+
+int lorcon_get_nonblock(lorcon_t *context) {
+	char pcaperr[PCAP_ERRBUF_SIZE];
+
+	if (context->pcap == NULL)
+		return 0;
+
+	return pcap_getnonblock(context->pcap, pcaperr) > 0;
+}
+
+int lorcon_drain(lorcon_t *context, int budget, lorcon_handler callback,
+				 u_char *user) {
+	int ret, got = 0;
+
+	/* Savefiles never block, and pcap refuses to make them non-blocking */
+	if (!context->nonblock && context->pcap != NULL &&
+			pcap_file(context->pcap) == NULL &&
+			(ret = lorcon_set_nonblock(context, 1)) < 0)
+		return ret;
+
+	while (budget <= 0 || got < budget) {
+		/* A non-blocking dispatch handles what is buffered and returns 0
+		 * once a read would block */
+		ret = lorcon_dispatch(context, budget > 0 ? budget - got : -1,
+				callback, user);
+
+		if (ret < 0)
+			return ret;
+
+		if (ret == 0)
+			break;
+
+		got += ret;
+	}
+
+	return got;
+}
+
 int lorcon_next_ex(lorcon_t *context, lorcon_packet_t **packet) {
 	struct pcap_pkthdr *pkt_hdr;
 	const u_char *pkt_data;
 	int ret;
 
+	if (__atomic_load_n(&context->control_pending, __ATOMIC_RELAXED) &&
+			lorcon_service_control(context)) {
+		*packet = NULL;
+		return -2;
+	}
+
 	/* If it's not a pcap source, try the direct fetch */
 	if (context->pcap == NULL) {
 		if (context->getpacket_cb == NULL) {
@@ -535,7 +1023,11 @@ int lorcon_next_ex(lorcon_t *context, lorcon_packet_t **packet) {
 		return (*(context->getpacket_cb))(context, packet);
 	}
 
-	if ((ret = pcap_next_ex(context->pcap, &pkt_hdr, &pkt_data)) < 0) {
+	lorcon_pcap_enter(context);
+	ret = pcap_next_ex(context->pcap, &pkt_hdr, &pkt_data);
+	lorcon_pcap_leave(context, ret);
+
+	if (ret < 0) {
 		*packet = NULL;
 		return ret;
 	}
@@ -554,14 +1046,77 @@ int lorcon_next_ex(lorcon_t *context, lorcon_packet_t **packet) {
 }
 
 void lorcon_breakloop(lorcon_t *context) {
+	if (context->control_fd >= 0)
+		lorcon_control_post(context, LORCON_CONTROL_BREAK);
+
 	if (context->pcap == NULL) {
-		snprintf(context->errstr, LORCON_STATUS_MAX, 
-				 "capture driver %s did not create a pcap context",
-				 lorcon_get_driver_name(context));
+		if (context->control_fd < 0)
+			snprintf(context->errstr, LORCON_STATUS_MAX, 
+					 "capture driver %s did not create a pcap context",
+					 lorcon_get_driver_name(context));
 		return;
 	}
 
-	pcap_breakloop(context->pcap);
+	/* Stop a read already under way, which won't look at the control
+	 * channel until it returns.  Without a control channel pcap's flag is
+	 * the only way to break */
+	if (context->control_fd < 0 ||
+			__atomic_load_n(&context->pcap_active, __ATOMIC_SEQ_CST) > 0)
+		pcap_breakloop(context->pcap);
+}
+
+void lorcon_pcap_enter(lorcon_t *context) {
+	__atomic_add_fetch(&context->pcap_active, 1, __ATOMIC_SEQ_CST);
+}
+
+void lorcon_pcap_leave(lorcon_t *context, int ret) {
+	__atomic_sub_fetch(&context->pcap_active, 1, __ATOMIC_SEQ_CST);
+
+	if (ret == -2 && context->control_fd >= 0 &&
+			__atomic_load_n(&context->control_pending, __ATOMIC_SEQ_CST))
+		lorcon_service_control(context);
+}
+
+int lorcon_get_control_fd(lorcon_t *context) {
+	return context->control_fd;
+}
+
+void lorcon_control_post(lorcon_t *context, unsigned int events) {
+	uint64_t one = 1;
+
+	__atomic_or_fetch(&context->control_pending, events, __ATOMIC_SEQ_CST);
+
+	/* Only fails if the counter would overflow, in which case the fd is
+	 * already readable */
+	if (write(context->control_fd, &one, sizeof(uint64_t)) < 0)
+		return;
+}
+
+int lorcon_service_control(lorcon_t *context) {
+	uint64_t v;
+	unsigned int events;
+
+	/* Clear the fd before taking the events, so an event posted in
+	 * between leaves it readable */
+	if (read(context->control_fd, &v, sizeof(uint64_t)) < 0)
+		v = 0;
+
+	events = __atomic_exchange_n(&context->control_pending, 0, __ATOMIC_SEQ_CST);
+
+	if ((events & LORCON_CONTROL_WAKEUP) && context->wakeup_cb != NULL)
+		(*(context->wakeup_cb))(context, context->wakeup_aux);
+
+	return (events & LORCON_CONTROL_BREAK) != 0;
+}
+
+void lorcon_wakeup(lorcon_t *context) {
+	lorcon_control_post(context, LORCON_CONTROL_WAKEUP);
+}
+
+void lorcon_set_wakeup_handler(lorcon_t *context, lorcon_wakeup_handler handler,
+		void *aux) {
+	context->wakeup_cb = handler;
+	context->wakeup_aux = aux;
 }
 
 int lorcon_inject(lorcon_t *context, lorcon_packet_t *packet) {
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "lorcon_packet.h"
 
@@ -82,6 +83,12 @@ void lorcon_free(lorcon_t *context);
 void lorcon_set_timeout(lorcon_t *context, int in_timeout);
 int lorcon_get_timeout(lorcon_t *context);
 
+/* Validate the FCS of captured frames which carry one.  Frames which fail
+ * are flagged in packet->fcs_bad and in the dot11 extra corrupt field before
+ * they are handed to any callback */
+void lorcon_set_fcs_validate(lorcon_t *context, int validate);
+int lorcon_get_fcs_validate(lorcon_t *context);
+
 /* Open an interface for inject */
 int lorcon_open_inject(lorcon_t *context);
 
@@ -134,6 +141,7 @@ struct lorcon_channel {
 #define LORCON_CHANNEL_VHT80    6
 #define LORCON_CHANNEL_VHT160   7
 #define LORCON_CHANNEL_VHT8080  8
+#define LORCON_CHANNEL_EHT320   9
 
 /* Set an advanced channel */
 int lorcon_set_complex_channel(lorcon_t *context, lorcon_channel_t *channel);
@@ -149,6 +157,13 @@ int lorcon_get_complex_channel(lorcon_t *context, lorcon_channel_t *ret_channel)
 
 /* Parse a channel string into HT flags, populating ret_channel; caller
    is responsible for providing an allocated lorcon_channel_t
+
+   The string is a channel number or frequency, followed by an optional
+   type: HT20, HT40+, HT40-, VHT80, VHT160, VHT80+80:<second segment
+   center channel>, EHT320 (or EHT320-1, EHT320-2 for the second
+   channelization), W5 or W10.  Bare channel numbers are 2.4 or 5 GHz;
+   prefix 6 GHz channels with "6g", eg "6g37VHT80".  Center frequencies
+   are filled in, and widths the channel can't be used at are rejected.
   
    Returns:
    0 - Success
@@ -156,6 +171,283 @@ int lorcon_get_complex_channel(lorcon_t *context, lorcon_channel_t *ret_channel)
  */
 int lorcon_parse_ht_channel(const char *in_chanstr, lorcon_channel_t *ret_channel);
 
+/* Write a channel in the form lorcon_parse_ht_channel reads; returns the
+ * length as snprintf does, or -1 for an unknown type */
+int lorcon_format_channel(const lorcon_channel_t *channel, char *str, size_t len);
+
+/* Channel numbering
+ *
+ * Channel numbers repeat between bands, so conversions take the band.
+ * Lookups are constant time.  lorcon_chan_to_freq returns 0 for numbers
+ * outside the band; lorcon_freq_to_chan returns 0 for frequencies off
+ * every band's raster, and sets ret_band if it isn't NULL.
+ */
+#define LORCON_BAND_2GHZ        1
+#define LORCON_BAND_5GHZ        2
+#define LORCON_BAND_6GHZ        3
+#define LORCON_BAND_60GHZ       4
+
+unsigned int lorcon_chan_to_freq(int band, unsigned int channel);
+unsigned int lorcon_freq_to_chan(unsigned int freq, int *ret_band);
+
+/* Fill in the center frequencies of a channel from its control frequency
+ * (or 2.4/5 GHz channel number) and type.  For VHT80+80 center_freq_2
+ * must already hold the second segment; for EHT320 center_freq_1 may
+ * pick the channelization.  Returns -1 if the channel can't be used at
+ * that width */
+int lorcon_resolve_channel(lorcon_channel_t *channel);
+
+/* Asynchronous channel changes
+ *
+ * lorcon_set_channel and lorcon_set_complex_channel wait for the kernel to
+ * acknowledge each change.  The async versions send the change and return
+ * at once with a positive id, so a hopper can keep several changes in
+ * flight and go on capturing.  When lorcon_get_channel_fd is readable, call
+ * lorcon_complete_channel; it never blocks, and calls the channel handler
+ * once for each change which finished with its id, 0 or a negative error,
+ * and the time in microseconds from sending the change to reading its
+ * completion.  It returns how many completed.
+ *
+ * Drivers which can't change channel asynchronously make the change before
+ * returning and call the handler from inside the call; the fd is then -1.
+ * At most LORCON_CHANNEL_MAX_PENDING (16) changes may be in flight.
+ */
+typedef void (*lorcon_channel_handler)(lorcon_t *context, unsigned int id,
+		int error, unsigned int rtt_us, void *aux);
+
+void lorcon_set_channel_handler(lorcon_t *context, lorcon_channel_handler handler,
+		void *aux);
+int lorcon_set_channel_async(lorcon_t *context, int channel);
+int lorcon_set_complex_channel_async(lorcon_t *context, lorcon_channel_t *channel);
+int lorcon_get_channel_fd(lorcon_t *context);
+int lorcon_complete_channel(lorcon_t *context);
+int lorcon_get_channel_pending(lorcon_t *context);
+
+/* Channel epochs
+ *
+ * Each channel change made through lorcon (set, complex set, or a
+ * completed async set) starts a new epoch: the channel, the monotonic
+ * time it completed, and the wall clock times it started and completed,
+ * which compare with packet timestamps.  Captured packets are stamped
+ * with the epoch in force when they arrived (tuned_* in lorcon_packet_t),
+ * and get packet->channel if the capture headers didn't supply one.
+ * Packets which arrived while a change was in progress, or before the
+ * oldest of the last few epochs, are flagged channel_ambiguous.
+ *
+ * Only changes made through lorcon are seen; changes by other processes
+ * aren't.  Packets may be stamped from any thread, but the channel should
+ * only be changed from one at a time.
+ */
+typedef struct lorcon_channel_epoch {
+    /* Counts up from 1 with each change */
+    unsigned int id;
+
+    lorcon_channel_t channel;
+
+    int64_t changed_ns;
+    struct timeval started;
+    struct timeval completed;
+} lorcon_channel_epoch_t;
+
+int lorcon_get_channel_epoch(lorcon_t *context, lorcon_channel_epoch_t *ret_epoch);
+
+/* nl80211 events
+ *
+ * A process-wide listener on the nl80211 config, mlme and regulatory
+ * groups tells contexts when their interface is removed, its channel is
+ * switched, or the capabilities or regulatory domain of the radio change,
+ * as soon as the kernel announces it rather than when capture dries up.
+ * Cached channel and capability state is updated as events arrive.
+ *
+ * lorcon_enable_events registers an open context with the listener,
+ * starting it if needed.  The listener has one fd for the process: watch
+ * lorcon_events_get_fd alongside capture and call lorcon_events_service
+ * when it is readable, from one thread at a time (a second caller returns
+ * 0 at once).  lorcon_multi does this itself, see
+ * lorcon_multi_enable_events.  Handlers run in lorcon_events_service and
+ * may free their context, or another; a context closed before its
+ * handler's turn is skipped.  Other lorcon calls may read the listener too
+ * (lorcon_get_channel does, to see channel switches); the state they
+ * update is current at once, but the handlers for what they read wait for
+ * the next lorcon_events_service, even if the fd is no longer readable.
+ *
+ * Needs libnl 2 or later; lorcon_enable_events returns LORCON_ENOTSUPP
+ * otherwise.
+ */
+#define LORCON_EVENT_CHANNEL        1   /* channel switched */
+#define LORCON_EVENT_IF_REMOVED     2   /* interface deleted */
+#define LORCON_EVENT_PHY_REMOVED    3   /* radio removed */
+#define LORCON_EVENT_PHY_CHANGED    4   /* radio capabilities or regulatory */
+#define LORCON_EVENT_REGULATORY     5   /* global regulatory domain */
+#define LORCON_EVENT_LOST           6   /* events were dropped; resync */
+
+typedef struct lorcon_event {
+    int type;
+    int ifindex;
+    int wiphy;
+
+    /* LORCON_EVENT_CHANNEL; frequency 0 if the kernel didn't say */
+    lorcon_channel_t channel;
+} lorcon_event_t;
+
+typedef void (*lorcon_event_handler)(lorcon_t *context,
+        const lorcon_event_t *event, void *aux);
+
+int lorcon_enable_events(lorcon_t *context);
+void lorcon_disable_events(lorcon_t *context);
+void lorcon_set_event_handler(lorcon_t *context, lorcon_event_handler handler,
+        void *aux);
+
+int lorcon_events_get_fd(void);
+
+/* Returns the number of events handled, or -1 if some were lost */
+int lorcon_events_service(void);
+
+/* The listener has seen the interface or its radio removed */
+int lorcon_get_removed(lorcon_t *context);
+
+/* Radio capabilities
+ *
+ * Read from nl80211 the first time a phy is asked about and cached for the
+ * process, so later calls from any context on the same phy are a table
+ * lookup.  A phy's record is dropped from the cache when nl80211 reports
+ * the phy changed or the regulatory domain changed; lorcon_get_phy_caps
+ * returns a reference which keeps the record it got valid, stale or not,
+ * until it is released with lorcon_put_phy_caps.
+ * lorcon_flush_phy_caps drops every record.
+ */
+
+/* Channel widths the phy supports */
+#define LORCON_PHY_WIDTH_20         (1 << 0)
+#define LORCON_PHY_WIDTH_HT20       (1 << 1)
+#define LORCON_PHY_WIDTH_40         (1 << 2)
+#define LORCON_PHY_WIDTH_80         (1 << 3)
+#define LORCON_PHY_WIDTH_160        (1 << 4)
+#define LORCON_PHY_WIDTH_8080       (1 << 5)
+#define LORCON_PHY_WIDTH_320        (1 << 6)
+
+/* Per-frequency restrictions */
+#define LORCON_FREQ_DISABLED        (1 << 0)
+#define LORCON_FREQ_NO_IR           (1 << 1)
+#define LORCON_FREQ_RADAR           (1 << 2)
+#define LORCON_FREQ_NO_HT40MINUS    (1 << 3)
+#define LORCON_FREQ_NO_HT40PLUS     (1 << 4)
+#define LORCON_FREQ_NO_80MHZ        (1 << 5)
+#define LORCON_FREQ_NO_160MHZ       (1 << 6)
+#define LORCON_FREQ_INDOOR_ONLY     (1 << 7)
+#define LORCON_FREQ_NO_20MHZ        (1 << 8)
+#define LORCON_FREQ_NO_10MHZ        (1 << 9)
+
+/* DFS state of radar channels */
+#define LORCON_DFS_USABLE           0
+#define LORCON_DFS_UNAVAILABLE      1
+#define LORCON_DFS_AVAILABLE        2
+
+/* Frequencies from 2400 to 7200 MHz on a 5 MHz raster are indexed directly */
+#define LORCON_PHY_FREQ_BASE        2400
+#define LORCON_PHY_FREQ_SLOTS       960
+
+typedef struct lorcon_phy_freq {
+    unsigned int freq;
+    unsigned int flags;
+    unsigned int dfs_state;
+
+    /* Regulatory transmit power limit, in mBm (100 * dBm) */
+    int max_power_mbm;
+} lorcon_phy_freq_t;
+
+typedef struct lorcon_phy_caps {
+    int wiphy;
+    char name[32];
+
+    /* LORCON_PHY_WIDTH_ flags */
+    unsigned int widths;
+
+    /* Supported interface modes, 1 << NL80211_IFTYPE_* */
+    unsigned int iftypes;
+
+    /* nl80211 feature flags, and what they say about monitor mode */
+    unsigned int features;
+    int active_monitor;
+    int mu_mimo_sniffer;
+
+    /* All frequencies, disabled ones included */
+    int num_freqs;
+    lorcon_phy_freq_t *freqs;
+
+    /* Index into freqs + 1 by (freq - LORCON_PHY_FREQ_BASE) / 5; use
+     * lorcon_phy_caps_find */
+    unsigned short *freq_index;
+
+    /* Held by the cache and each lorcon_get_phy_caps caller */
+    int refcount;
+} lorcon_phy_caps_t;
+
+const lorcon_phy_caps_t *lorcon_get_phy_caps(lorcon_t *context);
+void lorcon_put_phy_caps(const lorcon_phy_caps_t *caps);
+const lorcon_phy_freq_t *lorcon_phy_caps_find(const lorcon_phy_caps_t *caps,
+        unsigned int freq);
+void lorcon_flush_phy_caps(void);
+
+/* Channel survey
+ *
+ * Per-frequency airtime counters kept by the radio: how long it was on
+ * the channel (active), how long the medium was busy, and how long it
+ * spent receiving and transmitting, in milliseconds, plus the noise
+ * floor.  Drivers report what they can; present says which fields are
+ * valid, and many only report the channel they're on (in_use).
+ *
+ * The counters run for as long as the driver keeps them, so take two
+ * samples and use lorcon_survey_delta to see what happened in between;
+ * busy_ms / active_ms of the delta is the channel utilization.
+ */
+#define LORCON_SURVEY_NOISE     (1 << 0)
+#define LORCON_SURVEY_ACTIVE    (1 << 1)
+#define LORCON_SURVEY_BUSY      (1 << 2)
+#define LORCON_SURVEY_EXT_BUSY  (1 << 3)
+#define LORCON_SURVEY_RX        (1 << 4)
+#define LORCON_SURVEY_TX        (1 << 5)
+#define LORCON_SURVEY_SCAN      (1 << 6)
+
+typedef struct lorcon_survey_entry {
+    unsigned int freq;
+    int in_use;
+
+    /* LORCON_SURVEY_ flags */
+    unsigned int present;
+
+    int noise_dbm;
+
+    uint64_t active_ms;
+    uint64_t busy_ms;
+    uint64_t ext_busy_ms;
+    uint64_t rx_ms;
+    uint64_t tx_ms;
+    uint64_t scan_ms;
+} lorcon_survey_entry_t;
+
+typedef struct lorcon_survey {
+    /* CLOCK_MONOTONIC time of the sample, or the span of a delta */
+    int64_t sampled_ns;
+
+    int num_entries;
+    lorcon_survey_entry_t *entries;
+} lorcon_survey_t;
+
+/* Sample the survey of an interface; NULL on failure */
+lorcon_survey_t *lorcon_get_survey(lorcon_t *context);
+void lorcon_free_survey(lorcon_survey_t *survey);
+
+/* Entry for a frequency, or NULL */
+const lorcon_survey_entry_t *lorcon_survey_find(const lorcon_survey_t *survey,
+        unsigned int freq);
+
+/* Counters accumulated between two samples, for the frequencies in both.
+ * A counter which went backwards was reset and counts from 0; noise and
+ * in_use come from the later sample.  NULL if out of memory */
+lorcon_survey_t *lorcon_survey_delta(const lorcon_survey_t *before,
+        const lorcon_survey_t *after);
+
 /* Get/set MAC address, returns length of MAC and allocates in **mac,
  * caller is responsible for freeing this memory.  Different PHY types
  * may have different MAC lengths. 
@@ -175,6 +467,27 @@ pcap_t *lorcon_get_pcap(lorcon_t *context);
 /* Return pcap selectable FD */
 int lorcon_get_selectable_fd(lorcon_t *context);
 
+/* Non-blocking capture
+ *
+ * For embedding in an existing event loop: put the context in non-blocking
+ * mode, watch the selectable fd, and call lorcon_drain when it is readable.
+ * lorcon_drain never blocks; it reads and calls the callback until the
+ * capture has nothing more to give or budget packets have been handled
+ * (0 for no limit), and switches the context to non-blocking mode if it
+ * isn't already.
+ *
+ * This is safe with edge-triggered readiness: a return of less than budget
+ * means the capture was read until it would block, so waiting for the next
+ * edge won't miss anything.  A return equal to budget means more may be
+ * waiting and lorcon_drain must be called again before waiting.  Spurious
+ * readiness simply returns 0.  Returns -2 after lorcon_breakloop, and
+ * negative on error.  With a savefile, 0 means the end of the file.
+ */
+int lorcon_set_nonblock(lorcon_t *context, int nonblock);
+int lorcon_get_nonblock(lorcon_t *context);
+int lorcon_drain(lorcon_t *context, int budget, lorcon_handler callback,
+		u_char *user);
+
 /* Fetch the next packet.  This is available on all sources, including 
  * those which do not present a pcap interface */
 int lorcon_next_ex(lorcon_t *context, lorcon_packet_t **packet);
@@ -190,6 +503,24 @@ int lorcon_loop(lorcon_t *context, int count, lorcon_handler callback, u_char *u
 int lorcon_dispatch(lorcon_t *context, int count, lorcon_handler callback, u_char *user);
 void lorcon_breakloop(lorcon_t *context);
 
+/* Control channel
+ *
+ * Each context has an eventfd which lorcon_loop waits on alongside the
+ * capture fd, so another thread can stop it with lorcon_breakloop, or run
+ * the wakeup handler on the loop thread with lorcon_wakeup, without
+ * waiting for the next frame.  lorcon_dispatch and lorcon_next_ex act on
+ * pending events before reading.  Applications with their own poll loop
+ * can watch lorcon_get_control_fd and call lorcon_service_control when it
+ * is readable; it returns 1 if a break was requested.
+ */
+typedef void (*lorcon_wakeup_handler)(lorcon_t *context, void *aux);
+
+int lorcon_get_control_fd(lorcon_t *context);
+void lorcon_wakeup(lorcon_t *context);
+void lorcon_set_wakeup_handler(lorcon_t *context, lorcon_wakeup_handler handler,
+		void *aux);
+int lorcon_service_control(lorcon_t *context);
+
 /* Inject a packet */
 int lorcon_inject(lorcon_t *context, lorcon_packet_t *packet);
 
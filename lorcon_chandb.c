@@ -0,0 +1,520 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "lorcon.h"
+#include "lorcon_chandb.h"
+
+/* Highest channel number in any band */
+#define LORCON_CHANDB_MAX_CHAN      255
+
+/* 60 GHz (DMG) channels are spaced too widely for the tables */
+#define LORCON_CHANDB_60G_BASE      56160
+#define LORCON_CHANDB_60G_SPACING   2160
+#define LORCON_CHANDB_60G_MAX_CHAN  6
+
+static struct lorcon_chandb_entry chandb_freq[LORCON_CHANDB_SLOTS];
+static unsigned short chandb_chan[LORCON_BAND_6GHZ + 1][LORCON_CHANDB_MAX_CHAN + 1];
+static pthread_once_t chandb_once = PTHREAD_ONCE_INIT;
+
+/* Bonded blocks in 5 GHz, as center channel numbers */
+static const unsigned char chandb_5g_40[] = {
+    38, 46, 54, 62, 102, 110, 118, 126, 134, 142, 151, 159, 167, 175
+};
+static const unsigned char chandb_5g_80[] = { 42, 58, 106, 122, 138, 155, 171 };
+static const unsigned char chandb_5g_160[] = { 50, 114, 163 };
+
+#define LORCON_CHANDB_BASIC_TYPES \
+    (LORCON_CHANDB_TYPE(LORCON_CHANNEL_BASIC) | \
+     LORCON_CHANDB_TYPE(LORCON_CHANNEL_HT20) | \
+     LORCON_CHANDB_TYPE(LORCON_CHANNEL_5MHZ) | \
+     LORCON_CHANDB_TYPE(LORCON_CHANNEL_10MHZ))
+
+#define LORCON_CHANDB_NARROW_TYPES \
+    (LORCON_CHANDB_TYPE(LORCON_CHANNEL_BASIC) | \
+     LORCON_CHANDB_TYPE(LORCON_CHANNEL_5MHZ) | \
+     LORCON_CHANDB_TYPE(LORCON_CHANNEL_10MHZ))
+
+/* Frequency of a channel number by the band plan, usable or not */
+static unsigned int lorcon_chandb_plan_freq(int band, unsigned int chan) {
+    switch (band) {
+        case LORCON_BAND_2GHZ:
+            if (chan == 14)
+                return 2484;
+            if (chan >= 1 && chan < 14)
+                return 2407 + chan * 5;
+            return 0;
+        case LORCON_BAND_5GHZ:
+            if (chan >= 182 && chan <= 196)
+                return 4000 + chan * 5;
+            if (chan >= 1 && chan < 182)
+                return 5000 + chan * 5;
+            return 0;
+        case LORCON_BAND_6GHZ:
+            if (chan == 2)
+                return 5935;
+            if (chan >= 1 && chan <= 233)
+                return 5950 + chan * 5;
+            return 0;
+    }
+
+    return 0;
+}
+
+static struct lorcon_chandb_entry *lorcon_chandb_slot(unsigned int freq) {
+    if (freq < LORCON_CHANDB_FREQ_MIN || freq > LORCON_CHANDB_FREQ_MAX)
+        return NULL;
+
+    return &(chandb_freq[(freq - LORCON_CHANDB_FREQ_MIN) / 5]);
+}
+
+/* Center of the block in a list containing chan, 0 if none */
+static unsigned int lorcon_chandb_5g_center(const unsigned char *centers,
+        unsigned int num, unsigned int width, unsigned int chan) {
+    unsigned int x, half = width / 10;
+
+    for (x = 0; x < num; x++) {
+        if (chan + half > centers[x] && chan < centers[x] + half)
+            return centers[x];
+    }
+
+    return 0;
+}
+
+/* 6 GHz blocks are regular: width / 5 channel numbers wide starting at
+ * first, and must end by channel 233 */
+static unsigned int lorcon_chandb_6g_center(unsigned int first, unsigned int width,
+        unsigned int chan) {
+    unsigned int span = width / 5, center;
+
+    if (chan < first)
+        return 0;
+
+    center = first + ((chan - first) / span) * span + span / 2 - 2;
+
+    if (center + span / 2 - 2 > 233)
+        return 0;
+
+    return center;
+}
+
+static void lorcon_chandb_add(int band, unsigned int chan, unsigned int types,
+        unsigned int c40, unsigned int c80, unsigned int c160,
+        unsigned int c320a, unsigned int c320b) {
+    struct lorcon_chandb_entry *e;
+
+    if ((e = lorcon_chandb_slot(lorcon_chandb_plan_freq(band, chan))) == NULL)
+        return;
+
+    e->types = types;
+
+    /* Centers come in as channel numbers */
+    e->center_40 = c40 ? lorcon_chandb_plan_freq(band, c40) : 0;
+    e->center_80 = c80 ? lorcon_chandb_plan_freq(band, c80) : 0;
+    e->center_160 = c160 ? lorcon_chandb_plan_freq(band, c160) : 0;
+    e->center_320[0] = c320a ? lorcon_chandb_plan_freq(band, c320a) : 0;
+    e->center_320[1] = c320b ? lorcon_chandb_plan_freq(band, c320b) : 0;
+
+    if (c40)
+        e->types |= LORCON_CHANDB_TYPE(c40 > chan ?
+                LORCON_CHANNEL_HT40P : LORCON_CHANNEL_HT40M);
+    if (c80)
+        e->types |= LORCON_CHANDB_TYPE(LORCON_CHANNEL_VHT80) |
+            LORCON_CHANDB_TYPE(LORCON_CHANNEL_VHT8080);
+    if (c160)
+        e->types |= LORCON_CHANDB_TYPE(LORCON_CHANNEL_VHT160);
+    if (c320a || c320b)
+        e->types |= LORCON_CHANDB_TYPE(LORCON_CHANNEL_EHT320);
+}
+
+static void lorcon_chandb_build(void) {
+    struct lorcon_chandb_entry *e;
+    unsigned int band, chan, freq, types;
+
+    /* Number every frequency on a band's raster first, so conversions work
+     * for channels we don't know the rules for */
+    for (band = LORCON_BAND_2GHZ; band <= LORCON_BAND_6GHZ; band++) {
+        for (chan = 1; chan <= LORCON_CHANDB_MAX_CHAN; chan++) {
+            if ((freq = lorcon_chandb_plan_freq(band, chan)) == 0)
+                continue;
+
+            chandb_chan[band][chan] = freq;
+
+            /* Slots are looked up by frequency, which tells the bands
+             * apart; skip frequencies outside the table, and keep the
+             * first band and number to claim a slot */
+            if ((e = lorcon_chandb_slot(freq)) == NULL || e->band != 0)
+                continue;
+
+            e->freq = freq;
+            e->band = band;
+            e->channel = chan;
+        }
+    }
+
+    for (chan = 1; chan <= 13; chan++) {
+        types = LORCON_CHANDB_BASIC_TYPES;
+
+        if (chan + 4 <= 13)
+            types |= LORCON_CHANDB_TYPE(LORCON_CHANNEL_HT40P);
+        if (chan >= 5)
+            types |= LORCON_CHANDB_TYPE(LORCON_CHANNEL_HT40M);
+
+        lorcon_chandb_add(LORCON_BAND_2GHZ, chan, types, 0, 0, 0, 0, 0);
+    }
+
+    /* 802.11b only */
+    lorcon_chandb_add(LORCON_BAND_2GHZ, 14,
+            LORCON_CHANDB_TYPE(LORCON_CHANNEL_BASIC), 0, 0, 0, 0, 0);
+
+    /* UNII-1 to UNII-4 */
+    for (chan = 36; chan <= 177; chan += 4) {
+        if (chan > 64 && chan < 100)
+            continue;
+        if (chan == 148)
+            chan = 149;
+
+        lorcon_chandb_add(LORCON_BAND_5GHZ, chan, LORCON_CHANDB_BASIC_TYPES,
+                lorcon_chandb_5g_center(chandb_5g_40, sizeof(chandb_5g_40), 40, chan),
+                lorcon_chandb_5g_center(chandb_5g_80, sizeof(chandb_5g_80), 80, chan),
+                lorcon_chandb_5g_center(chandb_5g_160, sizeof(chandb_5g_160), 160, chan),
+                0, 0);
+    }
+
+    /* 4.9 GHz public safety / Japan */
+    for (chan = 184; chan <= 196; chan += 4)
+        lorcon_chandb_add(LORCON_BAND_5GHZ, chan, LORCON_CHANDB_BASIC_TYPES,
+                0, 0, 0, 0, 0);
+    for (chan = 183; chan <= 189; chan++)
+        if (chan != 184 && chan != 186 && chan != 188)
+            lorcon_chandb_add(LORCON_BAND_5GHZ, chan, LORCON_CHANDB_NARROW_TYPES,
+                    0, 0, 0, 0, 0);
+
+    /* UNII-5 to UNII-8 */
+    for (chan = 1; chan <= 233; chan += 4)
+        lorcon_chandb_add(LORCON_BAND_6GHZ, chan, LORCON_CHANDB_BASIC_TYPES,
+                lorcon_chandb_6g_center(1, 40, chan),
+                lorcon_chandb_6g_center(1, 80, chan),
+                lorcon_chandb_6g_center(1, 160, chan),
+                lorcon_chandb_6g_center(1, 320, chan),
+                lorcon_chandb_6g_center(33, 320, chan));
+
+    lorcon_chandb_add(LORCON_BAND_6GHZ, 2, LORCON_CHANDB_BASIC_TYPES,
+            0, 0, 0, 0, 0);
+}
+
+const struct lorcon_chandb_entry *lorcon_chandb_find(unsigned int freq) {
+    const struct lorcon_chandb_entry *e;
+
+    pthread_once(&chandb_once, lorcon_chandb_build);
+
+    if ((e = lorcon_chandb_slot(freq)) == NULL || e->freq != freq)
+        return NULL;
+
+    return e;
+}
+
+unsigned int lorcon_chan_to_freq(int band, unsigned int channel) {
+    if (band == LORCON_BAND_60GHZ) {
+        if (channel < 1 || channel > LORCON_CHANDB_60G_MAX_CHAN)
+            return 0;
+        return LORCON_CHANDB_60G_BASE + channel * LORCON_CHANDB_60G_SPACING;
+    }
+
+    if (band < LORCON_BAND_2GHZ || band > LORCON_BAND_6GHZ ||
+            channel > LORCON_CHANDB_MAX_CHAN)
+        return 0;
+
+    pthread_once(&chandb_once, lorcon_chandb_build);
+
+    return chandb_chan[band][channel];
+}
+
+unsigned int lorcon_freq_to_chan(unsigned int freq, int *ret_band) {
+    const struct lorcon_chandb_entry *e;
+
+    if (freq > LORCON_CHANDB_60G_BASE &&
+            freq <= LORCON_CHANDB_60G_BASE +
+                LORCON_CHANDB_60G_MAX_CHAN * LORCON_CHANDB_60G_SPACING &&
+            (freq - LORCON_CHANDB_60G_BASE) % LORCON_CHANDB_60G_SPACING == 0) {
+        if (ret_band != NULL)
+            *ret_band = LORCON_BAND_60GHZ;
+        return (freq - LORCON_CHANDB_60G_BASE) / LORCON_CHANDB_60G_SPACING;
+    }
+
+    if ((e = lorcon_chandb_find(freq)) == NULL) {
+        if (ret_band != NULL)
+            *ret_band = 0;
+        return 0;
+    }
+
+    if (ret_band != NULL)
+        *ret_band = e->band;
+
+    return e->channel;
+}
+
+unsigned int wifi_chan_to_freq(unsigned int in_chan) {
+    if (in_chan > 250)
+        return in_chan;
+
+    if (in_chan <= 14)
+        return lorcon_chan_to_freq(LORCON_BAND_2GHZ, in_chan);
+
+    return lorcon_chan_to_freq(LORCON_BAND_5GHZ, in_chan);
+}
+
+unsigned int wifi_freq_to_chan(unsigned int in_freq) {
+    if (in_freq < 250)
+        return in_freq;
+
+    return lorcon_freq_to_chan(in_freq, NULL);
+}
+
+int lorcon_resolve_channel(lorcon_channel_t *channel) {
+    const struct lorcon_chandb_entry *e, *e2;
+    unsigned int freq = wifi_chan_to_freq(channel->channel);
+
+    if (channel->type > LORCON_CHANNEL_EHT320)
+        return -1;
+
+    channel->channel = freq;
+
+    if ((e = lorcon_chandb_find(freq)) == NULL || e->types == 0) {
+        /* Nothing to work out for these; let the driver decide */
+        if (channel->type == LORCON_CHANNEL_BASIC ||
+                channel->type == LORCON_CHANNEL_HT20 ||
+                channel->type == LORCON_CHANNEL_5MHZ ||
+                channel->type == LORCON_CHANNEL_10MHZ) {
+            channel->center_freq_1 = 0;
+            channel->center_freq_2 = 0;
+            return 0;
+        }
+
+        return -1;
+    }
+
+    if ((e->types & LORCON_CHANDB_TYPE(channel->type)) == 0)
+        return -1;
+
+    switch (channel->type) {
+        case LORCON_CHANNEL_HT40P:
+            channel->center_freq_1 = e->center_40 ? e->center_40 : freq + 10;
+            channel->center_freq_2 = 0;
+            break;
+        case LORCON_CHANNEL_HT40M:
+            channel->center_freq_1 = e->center_40 ? e->center_40 : freq - 10;
+            channel->center_freq_2 = 0;
+            break;
+        case LORCON_CHANNEL_VHT80:
+            channel->center_freq_1 = e->center_80;
+            channel->center_freq_2 = 0;
+            break;
+        case LORCON_CHANNEL_VHT160:
+            channel->center_freq_1 = e->center_160;
+            channel->center_freq_2 = 0;
+            break;
+        case LORCON_CHANNEL_VHT8080:
+            /* The second segment is the caller's choice; it must be some
+             * other 80 MHz channel in the band */
+            e2 = lorcon_chandb_find(channel->center_freq_2 - 30);
+
+            if (e2 == NULL || e2->band != e->band ||
+                    e2->center_80 != channel->center_freq_2 ||
+                    e2->center_80 == e->center_80)
+                return -1;
+
+            channel->center_freq_1 = e->center_80;
+            break;
+        case LORCON_CHANNEL_EHT320:
+            /* Keep the channelization asked for if it's valid here */
+            if (channel->center_freq_1 == 0 ||
+                    (channel->center_freq_1 != e->center_320[0] &&
+                     channel->center_freq_1 != e->center_320[1]))
+                channel->center_freq_1 = e->center_320[0] ?
+                    e->center_320[0] : e->center_320[1];
+            channel->center_freq_2 = 0;
+            break;
+        default:
+            channel->center_freq_1 = 0;
+            channel->center_freq_2 = 0;
+            break;
+    }
+
+    return 0;
+}
+
+/* Channel type names, indexed by LORCON_CHANNEL_* */
+static const char *chandb_type_names[] = {
+    "", "HT20", "HT40+", "HT40-", "W5", "W10", "VHT80", "VHT160", "VHT80+80",
+    "EHT320"
+};
+
+static const char *chandb_band_prefix[] = {
+    "", "2g", "5g", "6g", "60g"
+};
+
+int lorcon_parse_ht_channel(const char *in_chanstr, lorcon_channel_t *ret_channel) {
+    const char *s = in_chanstr, *type;
+    char *end;
+    unsigned long num, num2 = 0;
+    size_t typelen;
+    int band = 0, b, t = -1, eht_second = 0;
+    unsigned int freq;
+
+    memset(ret_channel, 0, sizeof(lorcon_channel_t));
+
+    while (isspace((unsigned char) *s))
+        s++;
+
+    /* Optional band, for channel numbers which aren't unique */
+    for (b = LORCON_BAND_60GHZ; b >= LORCON_BAND_2GHZ; b--) {
+        size_t pl = strlen(chandb_band_prefix[b]);
+
+        if (strncasecmp(s, chandb_band_prefix[b], pl) == 0 &&
+                isdigit((unsigned char) s[pl])) {
+            band = b;
+            s += pl;
+            break;
+        }
+    }
+
+    if (!isdigit((unsigned char) *s))
+        return -1;
+
+    num = strtoul(s, &end, 10);
+    s = end;
+
+    while (isspace((unsigned char) *s))
+        s++;
+
+    /* Type runs to the end, or to the second 80+80 segment */
+    type = s;
+    typelen = strcspn(s, ":");
+
+    while (typelen > 0 && isspace((unsigned char) type[typelen - 1]))
+        typelen--;
+
+    if (s[strcspn(s, ":")] == ':') {
+        s += strcspn(s, ":") + 1;
+        num2 = strtoul(s, &end, 10);
+
+        if (end == s || *end != '\0')
+            return -1;
+    }
+
+    if (typelen == 0) {
+        t = LORCON_CHANNEL_BASIC;
+    } else if (typelen == 8 && strncasecmp(type, "EHT320-1", 8) == 0) {
+        t = LORCON_CHANNEL_EHT320;
+    } else if (typelen == 8 && strncasecmp(type, "EHT320-2", 8) == 0) {
+        t = LORCON_CHANNEL_EHT320;
+        eht_second = 1;
+    } else {
+        for (b = 1; b <= LORCON_CHANNEL_EHT320; b++) {
+            if (strlen(chandb_type_names[b]) == typelen &&
+                    strncasecmp(type, chandb_type_names[b], typelen) == 0) {
+                t = b;
+                break;
+            }
+        }
+    }
+
+    if (t < 0)
+        return -1;
+
+    if ((t == LORCON_CHANNEL_VHT8080) != (num2 != 0))
+        return -1;
+
+    if (band != 0)
+        freq = lorcon_chan_to_freq(band, num);
+    else
+        freq = wifi_chan_to_freq(num);
+
+    if (freq == 0)
+        return -1;
+
+    ret_channel->channel = freq;
+    ret_channel->type = t;
+
+    if (num2 != 0) {
+        /* Second segment center, numbered in the same band */
+        if (band == 0)
+            lorcon_freq_to_chan(freq, &band);
+        if ((ret_channel->center_freq_2 = lorcon_chan_to_freq(band, num2)) == 0)
+            return -1;
+    }
+
+    /* Second 320 MHz channelization asked for */
+    if (eht_second) {
+        const struct lorcon_chandb_entry *e = lorcon_chandb_find(freq);
+
+        if (e == NULL || e->center_320[1] == 0)
+            return -1;
+
+        ret_channel->center_freq_1 = e->center_320[1];
+    }
+
+    return lorcon_resolve_channel(ret_channel);
+}
+
+int lorcon_format_channel(const lorcon_channel_t *channel, char *str, size_t len) {
+    const struct lorcon_chandb_entry *e;
+    const char *type, *suffix = "";
+    char seg[16];
+    unsigned int chan;
+    int band;
+
+    if (channel->type > LORCON_CHANNEL_EHT320)
+        return -1;
+
+    type = chandb_type_names[channel->type];
+    seg[0] = '\0';
+
+    if ((chan = lorcon_freq_to_chan(channel->channel, &band)) == 0)
+        return snprintf(str, len, "%u%s", channel->channel, type);
+
+    if (channel->type == LORCON_CHANNEL_VHT8080)
+        snprintf(seg, sizeof(seg), ":%u",
+                lorcon_freq_to_chan(channel->center_freq_2, NULL));
+
+    if (channel->type == LORCON_CHANNEL_EHT320 &&
+            (e = lorcon_chandb_find(channel->channel)) != NULL &&
+            e->center_320[0] != 0 && channel->center_freq_1 == e->center_320[1])
+        suffix = "-2";
+
+    /* Bare numbers parse as 2.4 and 5 GHz */
+    if (band == LORCON_BAND_2GHZ || band == LORCON_BAND_5GHZ)
+        band = 0;
+
+    return snprintf(str, len, "%s%u%s%s%s", chandb_band_prefix[band], chan,
+            type, suffix, seg);
+}
+
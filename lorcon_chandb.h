@@ -0,0 +1,71 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+
+/* Channel database
+ *
+ * Every 20 MHz channel lorcon knows in the 2.4, 5 (including 4.9) and
+ * 6 GHz bands, with the widths it may be used at and the center
+ * frequencies of the wider channels containing it.  The tables are
+ * generated from the band plans on first use and are indexed directly:
+ * by (frequency - 2400) / 5, and by band and channel number, so lookups
+ * in the hop and capture paths don't scan.
+ *
+ * Used through lorcon_chan_to_freq, lorcon_freq_to_chan,
+ * lorcon_resolve_channel and the channel string functions in lorcon.h.
+ */
+
+#ifndef __LORCON_CHANDB_H__
+#define __LORCON_CHANDB_H__
+
+#define LORCON_CHANDB_FREQ_MIN      2400
+#define LORCON_CHANDB_FREQ_MAX      7125
+#define LORCON_CHANDB_SLOTS         (((LORCON_CHANDB_FREQ_MAX - LORCON_CHANDB_FREQ_MIN) / 5) + 1)
+
+/* Widths a channel may be used at, as 1 << LORCON_CHANNEL_* */
+#define LORCON_CHANDB_TYPE(t)       (1 << (t))
+
+struct lorcon_chandb_entry {
+    unsigned short freq;
+    unsigned char band;
+    unsigned char channel;
+
+    /* 0 for frequencies on the channel raster which aren't usable */
+    unsigned short types;
+
+    /* Centers of the 40, 80, 160 and 320 MHz channels this is part of, 0
+     * when there is none.  The 40 MHz center is left 0 in 2.4 GHz, where
+     * either side may be bonded.  320 MHz channels overlap; there are two
+     * channelizations */
+    unsigned short center_40;
+    unsigned short center_80;
+    unsigned short center_160;
+    unsigned short center_320[2];
+};
+
+/* Entry for a frequency on the raster, or NULL */
+const struct lorcon_chandb_entry *lorcon_chandb_find(unsigned int freq);
+
+/* Legacy conversions: bare numbers are 2.4 or 5 GHz channels, and
+ * anything over 250 is already a frequency */
+unsigned int wifi_chan_to_freq(unsigned int in_chan);
+unsigned int wifi_freq_to_chan(unsigned int in_freq);
+
+#endif
+
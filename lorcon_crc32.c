@@ -0,0 +1,300 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "lorcon_crc32.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define LORCON_CRC32_CLMUL
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LORCON_CRC32_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32     (1 << 7)
+#endif
+#endif
+
+/* All internal functions work on the raw (pre-inverted) CRC register */
+typedef uint32_t (*crc32_raw_func)(uint32_t raw, const uint8_t *buf, size_t len);
+
+static uint32_t crc32_tables[8][256];
+
+static uint32_t crc32_raw_slice8(uint32_t raw, const uint8_t *buf, size_t len) {
+    uint32_t lo, hi;
+
+    /* Assemble the words bytewise; it costs nothing measurable and keeps
+     * this path independent of alignment and host endian */
+    while (len >= 8) {
+        lo = raw ^ ((uint32_t) buf[0] | ((uint32_t) buf[1] << 8) |
+                ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24));
+        hi = (uint32_t) buf[4] | ((uint32_t) buf[5] << 8) |
+            ((uint32_t) buf[6] << 16) | ((uint32_t) buf[7] << 24);
+
+        raw = crc32_tables[7][lo & 0xFF] ^
+            crc32_tables[6][(lo >> 8) & 0xFF] ^
+            crc32_tables[5][(lo >> 16) & 0xFF] ^
+            crc32_tables[4][lo >> 24] ^
+            crc32_tables[3][hi & 0xFF] ^
+            crc32_tables[2][(hi >> 8) & 0xFF] ^
+            crc32_tables[1][(hi >> 16) & 0xFF] ^
+            crc32_tables[0][hi >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        raw = crc32_tables[0][(raw ^ *buf++) & 0xFF] ^ (raw >> 8);
+
+    return raw;
+}
+
+#ifdef LORCON_CRC32_CLMUL
+/* Fold-by-4 carryless multiply CRC, from Gopal et al, "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009), using
+ * the bit-reflected constants for the IEEE polynomial.
+ *
+ * len must be >= 64 and a multiple of 16 */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_raw_clmul_block(uint32_t raw, const uint8_t *buf, size_t len) {
+    static const uint64_t __attribute__((aligned(16))) k1k2[] =
+        { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const uint64_t __attribute__((aligned(16))) k3k4[] =
+        { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const uint64_t __attribute__((aligned(16))) k5k0[] =
+        { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const uint64_t __attribute__((aligned(16))) poly[] =
+        { 0x01db710641ULL, 0x01f7011641ULL };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) raw));
+
+    x0 = _mm_load_si128((const __m128i *) k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /* Fold 4 lanes in parallel */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the 4 lanes into one */
+    x0 = _mm_load_si128((const __m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Remaining 16 byte blocks */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *) buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 -> 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_raw_clmul(uint32_t raw, const uint8_t *buf, size_t len) {
+    size_t blen;
+
+    /* Short frames (ACKs, RTS, most management) are cheaper on the tables
+     * than setting up the fold */
+    if (len >= 64) {
+        blen = len & ~((size_t) 15);
+        raw = crc32_raw_clmul_block(raw, buf, blen);
+        buf += blen;
+        len -= blen;
+    }
+
+    return crc32_raw_slice8(raw, buf, len);
+}
+#endif
+
+#ifdef LORCON_CRC32_ARMV8
+__attribute__((target("+crc")))
+static uint32_t crc32_raw_armv8(uint32_t raw, const uint8_t *buf, size_t len) {
+    uint64_t v;
+
+    while (len >= 8) {
+        memcpy(&v, buf, 8);
+        raw = __crc32d(raw, v);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        raw = __crc32b(raw, *buf++);
+
+    return raw;
+}
+#endif
+
+static crc32_raw_func crc32_raw = crc32_raw_slice8;
+static const char *crc32_impl_name = "slice8";
+
+/* Build the tables and pick an implementation before anything can call us */
+__attribute__((constructor))
+static void lorcon_crc32_init(void) {
+    uint32_t c;
+    unsigned int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : (c >> 1);
+
+        crc32_tables[0][i] = c;
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) {
+            c = crc32_tables[k - 1][i];
+            crc32_tables[k][i] = (c >> 8) ^ crc32_tables[0][c & 0xFF];
+        }
+    }
+
+#ifdef LORCON_CRC32_CLMUL
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc32_raw = crc32_raw_clmul;
+        crc32_impl_name = "pclmul";
+    }
+#endif
+
+#ifdef LORCON_CRC32_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc32_raw = crc32_raw_armv8;
+        crc32_impl_name = "armv8-crc";
+    }
+#endif
+}
+
+uint32_t lorcon_crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    return ~(*crc32_raw)(~crc, data, len);
+}
+
+uint32_t lorcon_crc32(const uint8_t *data, size_t len) {
+    return ~(*crc32_raw)(0xFFFFFFFFUL, data, len);
+}
+
+void lorcon_crc32_put(uint32_t crc, uint8_t *out) {
+    out[0] = (uint8_t) crc;
+    out[1] = (uint8_t) (crc >> 8);
+    out[2] = (uint8_t) (crc >> 16);
+    out[3] = (uint8_t) (crc >> 24);
+}
+
+int lorcon_crc32_check(const uint8_t *data, size_t len) {
+    uint32_t crc, fcs;
+
+    if (len < 4)
+        return 0;
+
+    crc = lorcon_crc32(data, len - 4);
+
+    fcs = (uint32_t) data[len - 4] | ((uint32_t) data[len - 3] << 8) |
+        ((uint32_t) data[len - 2] << 16) | ((uint32_t) data[len - 1] << 24);
+
+    return crc == fcs;
+}
+
+const char *lorcon_crc32_impl() {
+    return crc32_impl_name;
+}
+
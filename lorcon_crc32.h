@@ -0,0 +1,57 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/* LORCON CRC32
+ *
+ * IEEE 802.3 CRC32 (reflected, poly 0xEDB88320), as used for the 802.11 FCS
+ * and the WEP ICV.
+ *
+ * The implementation is picked once at library load: PCLMULQDQ folding on
+ * x86 CPUs which support it, the ARMv8 CRC32 instructions on aarch64, and
+ * portable slicing-by-8 tables everywhere else.  All paths produce identical
+ * results.
+ */
+
+#ifndef __LORCON_CRC32_H__
+#define __LORCON_CRC32_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* CRC of a complete buffer */
+uint32_t lorcon_crc32(const uint8_t *data, size_t len);
+
+/* Continue a CRC; pass 0 as crc for the first block, and the previous
+ * return value for following blocks.  Equivalent to zlib crc32() */
+uint32_t lorcon_crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+/* Write a CRC in over-the-air (little endian) order, as it appears in the
+ * FCS and ICV fields */
+void lorcon_crc32_put(uint32_t crc, uint8_t *out);
+
+/* Check a buffer whose final 4 bytes are a little-endian CRC of the
+ * preceding bytes (an 802.11 frame with FCS, or a decrypted WEP body with
+ * ICV).  Returns 1 if the CRC matches, 0 if not or if len < 4 */
+int lorcon_crc32_check(const uint8_t *data, size_t len);
+
+/* Name of the implementation in use, for diagnostics */
+const char *lorcon_crc32_impl();
+
+#endif
+
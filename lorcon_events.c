@@ -0,0 +1,409 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "nl80211_control.h"
+
+/* Registered contexts and the socket, which stays open once created so its
+ * fd can be left in wait sets */
+static pthread_mutex_t lorcon_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static lorcon_t *lorcon_events_contexts = NULL;
+static int lorcon_events_num = 0;
+static void *lorcon_events_sock = NULL;
+
+/* Stamped on each registration, so a handler list can tell a context
+ * which is still registered from one closed and reused meanwhile */
+static unsigned int lorcon_events_serial = 0;
+
+/* Held while reading the socket */
+static pthread_mutex_t lorcon_events_service_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int lorcon_enable_events(lorcon_t *context) {
+#if !defined(SYS_LINUX) || !defined(HAVE_LINUX_NETLINK)
+    snprintf(context->errstr, LORCON_STATUS_MAX,
+            "Lorcon was not compiled with netlink support");
+    return LORCON_ENOTSUPP;
+#else
+    const char *ifname = context->vapname != NULL ? context->vapname : context->ifname;
+    unsigned int ifindex;
+
+    if ((ifindex = if_nametoindex(ifname)) == 0) {
+        snprintf(context->errstr, LORCON_STATUS_MAX,
+                "Could not find interface %s, is it open?", ifname);
+        return -1;
+    }
+
+    pthread_mutex_lock(&lorcon_events_lock);
+
+    if (context->ev_registered) {
+        pthread_mutex_unlock(&lorcon_events_lock);
+        return 0;
+    }
+
+    if (lorcon_events_sock == NULL &&
+            nl80211_event_connect(&lorcon_events_sock,
+                NL80211_EVENT_GROUP_CONFIG | NL80211_EVENT_GROUP_MLME |
+                NL80211_EVENT_GROUP_REG, context->errstr) < 0) {
+        lorcon_events_sock = NULL;
+        pthread_mutex_unlock(&lorcon_events_lock);
+        return LORCON_ENOTSUPP;
+    }
+
+    context->ev_ifindex = ifindex;
+    context->ev_wiphy = nl80211_get_wiphy_index(ifname);
+    context->ev_removed = 0;
+    context->ev_registered = 1;
+    context->ev_serial = ++lorcon_events_serial;
+
+    context->ev_next = lorcon_events_contexts;
+    lorcon_events_contexts = context;
+    lorcon_events_num++;
+
+    pthread_mutex_unlock(&lorcon_events_lock);
+
+    return 0;
+#endif
+}
+
+void lorcon_disable_events(lorcon_t *context) {
+    lorcon_t **pc;
+
+    pthread_mutex_lock(&lorcon_events_lock);
+
+    if (context->ev_registered) {
+        for (pc = &lorcon_events_contexts; *pc != NULL; pc = &((*pc)->ev_next)) {
+            if (*pc == context) {
+                *pc = context->ev_next;
+                lorcon_events_num--;
+                break;
+            }
+        }
+
+        context->ev_registered = 0;
+        context->ev_next = NULL;
+    }
+
+    pthread_mutex_unlock(&lorcon_events_lock);
+}
+
+void lorcon_set_event_handler(lorcon_t *context, lorcon_event_handler handler,
+        void *aux) {
+    pthread_mutex_lock(&lorcon_events_lock);
+    context->ev_cb = handler;
+    context->ev_aux = aux;
+    pthread_mutex_unlock(&lorcon_events_lock);
+}
+
+int lorcon_events_get_fd(void) {
+    int fd = -1;
+
+#ifdef SYS_LINUX
+    pthread_mutex_lock(&lorcon_events_lock);
+
+    if (lorcon_events_sock != NULL)
+        fd = nl80211_event_fd(lorcon_events_sock);
+
+    pthread_mutex_unlock(&lorcon_events_lock);
+#endif
+
+    return fd;
+}
+
+int lorcon_get_removed(lorcon_t *context) {
+    return __atomic_load_n(&context->ev_removed, __ATOMIC_RELAXED);
+}
+
+static int lorcon_events_match(lorcon_t *context, const lorcon_event_t *event) {
+    switch (event->type) {
+        case LORCON_EVENT_CHANNEL:
+        case LORCON_EVENT_IF_REMOVED:
+            return event->ifindex == context->ev_ifindex;
+        case LORCON_EVENT_PHY_REMOVED:
+        case LORCON_EVENT_PHY_CHANGED:
+            return event->wiphy >= 0 && event->wiphy == context->ev_wiphy;
+        case LORCON_EVENT_REGULATORY:
+        case LORCON_EVENT_LOST:
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Events read by lorcon_events_update() whose handlers haven't run yet;
+ * guarded by the listener lock.  If nobody services them in time they
+ * collapse into a single LORCON_EVENT_LOST. */
+#define LORCON_EVENTS_MAX_DEFERRED  64
+
+static lorcon_event_t lorcon_events_deferred[LORCON_EVENTS_MAX_DEFERRED];
+static int lorcon_events_num_deferred = 0;
+
+/* Handler to run once the lock is dropped */
+struct lorcon_events_run {
+    lorcon_t *context;
+    unsigned int serial;
+    lorcon_event_handler cb;
+    void *aux;
+};
+
+/* Run handlers collected under the lock.  An earlier handler may have
+ * closed a later context, so each is only run if its context is still
+ * registered; the pointer is compared, never followed, until then */
+static void lorcon_events_run(struct lorcon_events_run *run, int n,
+        const lorcon_event_t *event) {
+    lorcon_t *c;
+    int x;
+
+    for (x = 0; x < n; x++) {
+        pthread_mutex_lock(&lorcon_events_lock);
+
+        for (c = lorcon_events_contexts; c != NULL; c = c->ev_next) {
+            if (c == run[x].context && c->ev_serial == run[x].serial)
+                break;
+        }
+
+        pthread_mutex_unlock(&lorcon_events_lock);
+
+        if (c != NULL)
+            (*(run[x].cb))(run[x].context, event, run[x].aux);
+    }
+}
+
+/* Update every context the event concerns.  The handlers are run here
+ * without the lock, so they may free the context, or held for the next
+ * lorcon_events_service() if defer is set. */
+static void lorcon_events_dispatch(const lorcon_event_t *event, int defer) {
+    struct lorcon_events_run *run = NULL;
+    lorcon_t *c;
+    int n = 0;
+
+#ifdef SYS_LINUX
+    switch (event->type) {
+        case LORCON_EVENT_PHY_REMOVED:
+        case LORCON_EVENT_PHY_CHANGED:
+            nl80211_phycap_invalidate(event->wiphy);
+            break;
+        case LORCON_EVENT_REGULATORY:
+        case LORCON_EVENT_LOST:
+            nl80211_phycap_invalidate(-1);
+            break;
+    }
+#endif
+
+    pthread_mutex_lock(&lorcon_events_lock);
+
+    if (!defer)
+        run = malloc(sizeof(*run) * (lorcon_events_num + 1));
+
+    for (c = lorcon_events_contexts; c != NULL; c = c->ev_next) {
+        if (!lorcon_events_match(c, event))
+            continue;
+
+        if (event->type == LORCON_EVENT_IF_REMOVED ||
+                event->type == LORCON_EVENT_PHY_REMOVED)
+            __atomic_store_n(&c->ev_removed, 1, __ATOMIC_RELAXED);
+
+        if (c->event_cb != NULL)
+            (*(c->event_cb))(c, event);
+
+        if (c->ev_cb != NULL && run != NULL) {
+            run[n].context = c;
+            run[n].serial = c->ev_serial;
+            run[n].cb = c->ev_cb;
+            run[n].aux = c->ev_aux;
+            n++;
+        }
+    }
+
+    if (defer) {
+        if (lorcon_events_num_deferred < LORCON_EVENTS_MAX_DEFERRED) {
+            lorcon_events_deferred[lorcon_events_num_deferred] = *event;
+            __atomic_store_n(&lorcon_events_num_deferred,
+                    lorcon_events_num_deferred + 1, __ATOMIC_RELEASE);
+        } else {
+            memset(&lorcon_events_deferred[0], 0, sizeof(lorcon_event_t));
+            lorcon_events_deferred[0].type = LORCON_EVENT_LOST;
+            lorcon_events_deferred[0].wiphy = -1;
+            __atomic_store_n(&lorcon_events_num_deferred, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&lorcon_events_lock);
+
+    lorcon_events_run(run, n, event);
+
+    free(run);
+}
+
+/* Run the handlers held by lorcon_events_update(); the contexts were
+ * already updated, so only the handlers are matched again */
+static int lorcon_events_flush(void) {
+    lorcon_event_t events[LORCON_EVENTS_MAX_DEFERRED];
+    struct lorcon_events_run *run;
+    lorcon_t *c;
+    int num, e, n;
+
+    if (__atomic_load_n(&lorcon_events_num_deferred, __ATOMIC_ACQUIRE) == 0)
+        return 0;
+
+    pthread_mutex_lock(&lorcon_events_lock);
+    num = lorcon_events_num_deferred;
+    memcpy(events, lorcon_events_deferred, sizeof(lorcon_event_t) * num);
+    __atomic_store_n(&lorcon_events_num_deferred, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lorcon_events_lock);
+
+    for (e = 0; e < num; e++) {
+        pthread_mutex_lock(&lorcon_events_lock);
+
+        n = 0;
+
+        if ((run = malloc(sizeof(*run) * (lorcon_events_num + 1))) != NULL) {
+            for (c = lorcon_events_contexts; c != NULL; c = c->ev_next) {
+                if (c->ev_cb == NULL || !lorcon_events_match(c, &events[e]))
+                    continue;
+
+                run[n].context = c;
+                run[n].serial = c->ev_serial;
+                run[n].cb = c->ev_cb;
+                run[n].aux = c->ev_aux;
+                n++;
+            }
+        }
+
+        pthread_mutex_unlock(&lorcon_events_lock);
+
+        lorcon_events_run(run, n, &events[e]);
+
+        free(run);
+    }
+
+    return num;
+}
+
+int lorcon_events_deferred_pending(void) {
+    return __atomic_load_n(&lorcon_events_num_deferred, __ATOMIC_ACQUIRE) != 0;
+}
+
+#ifdef SYS_LINUX
+struct lorcon_events_read {
+    int count;
+    int defer;
+};
+
+static void lorcon_events_nl(struct nl80211_event *nlev, void *aux) {
+    struct lorcon_events_read *rd = (struct lorcon_events_read *) aux;
+    lorcon_event_t event;
+
+    memset(&event, 0, sizeof(lorcon_event_t));
+
+    event.ifindex = nlev->chan.ifindex;
+    event.wiphy = nlev->wiphy;
+
+    switch (nlev->type) {
+        case NL80211_EVENT_CH_SWITCH:
+            event.type = LORCON_EVENT_CHANNEL;
+            nl80211_chaninfo_channel(&(nlev->chan), &(event.channel));
+            break;
+        case NL80211_EVENT_DEL_INTERFACE:
+            event.type = LORCON_EVENT_IF_REMOVED;
+            break;
+        case NL80211_EVENT_DEL_WIPHY:
+            event.type = LORCON_EVENT_PHY_REMOVED;
+            break;
+        case NL80211_EVENT_NEW_WIPHY:
+            event.type = LORCON_EVENT_PHY_CHANGED;
+            break;
+        case NL80211_EVENT_REG_CHANGE:
+            event.type = nlev->wiphy >= 0 ?
+                LORCON_EVENT_PHY_CHANGED : LORCON_EVENT_REGULATORY;
+            break;
+        default:
+            return;
+    }
+
+    lorcon_events_dispatch(&event, rd->defer);
+    rd->count++;
+}
+#endif
+
+/* Read the socket if nobody else is, dispatching what arrived */
+static int lorcon_events_read(int defer) {
+#ifndef SYS_LINUX
+    return 0;
+#else
+    char errstr[LORCON_STATUS_MAX];
+    struct lorcon_events_read rd;
+    lorcon_event_t lost;
+    void *sock;
+    int flushed = 0;
+
+    pthread_mutex_lock(&lorcon_events_lock);
+    sock = lorcon_events_sock;
+    pthread_mutex_unlock(&lorcon_events_lock);
+
+    if (sock == NULL)
+        return 0;
+
+    /* Someone else is reading, or a handler called us */
+    if (pthread_mutex_trylock(&lorcon_events_service_lock) != 0)
+        return 0;
+
+    if (!defer)
+        flushed = lorcon_events_flush();
+
+    rd.count = 0;
+    rd.defer = defer;
+
+    if (nl80211_event_process(sock, lorcon_events_nl, &rd, errstr) < 0) {
+        memset(&lost, 0, sizeof(lorcon_event_t));
+        lost.type = LORCON_EVENT_LOST;
+        lost.wiphy = -1;
+
+        lorcon_events_dispatch(&lost, defer);
+
+        rd.count = -1;
+    }
+
+    pthread_mutex_unlock(&lorcon_events_service_lock);
+
+    if (rd.count < 0)
+        return -1;
+
+    return rd.count + flushed;
+#endif
+}
+
+int lorcon_events_service(void) {
+    return lorcon_events_read(0);
+}
+
+int lorcon_events_update(void) {
+    return lorcon_events_read(1);
+}
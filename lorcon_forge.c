@@ -37,6 +37,8 @@
 #include "lorcon.h"
 #include "lorcon_packasm.h"
 #include "lorcon_endian.h"
+#include "lorcon_rand.h"
+#include "lorcon_crc32.h"
 #include "lorcon_forge.h"
 #include "ieee80211.h"
 
@@ -67,26 +69,67 @@ uint8_t *ouilist[] = {
     (uint8_t *) "\x08\x00\x46", NULL
 };
 
+#define OUILIST_LEN ((sizeof(ouilist) / sizeof(uint8_t *)) - 1)
+
 void lcpf_randmac(uint8_t *addr, int valid) {
-	static int listlen = 0;
+	lcpf_randmac_r(NULL, addr, valid);
+}
 
-	if (listlen == 0) {
-		while (ouilist[listlen] != NULL) {
-			listlen++;
-		};
-	}
+void lcpf_randmac_r(lorcon_rand_t *r, uint8_t *addr, int valid) {
+	uint64_t v;
+
+	if (r == NULL)
+		r = lorcon_rand_thread();
+
+	/* One 64 bit draw covers the whole address */
+	v = lorcon_rand_next64(r);
 
 	if (valid) {
-		memcpy(addr, ouilist[rand() % listlen], 3);
+		memcpy(addr, ouilist[lorcon_rand_bounded(r, OUILIST_LEN)], 3);
 	} else {
-		addr[0] = rand() % 255;
-		addr[1] = rand() % 255;
-		addr[2] = rand() % 255;
+		addr[0] = (uint8_t) (v >> 24);
+		addr[1] = (uint8_t) (v >> 32);
+		addr[2] = (uint8_t) (v >> 40);
 	}
 
-	addr[3] = rand() % 255;
-	addr[4] = rand() % 255;
-	addr[5] = rand() % 255;
+	addr[3] = (uint8_t) v;
+	addr[4] = (uint8_t) (v >> 8);
+	addr[5] = (uint8_t) (v >> 16);
+}
+
+void lcpf_randmac_bulk(lorcon_rand_t *r, uint8_t *addrs, unsigned int count,
+		int valid) {
+	unsigned int x;
+
+	if (r == NULL)
+		r = lorcon_rand_thread();
+
+	for (x = 0; x < count; x++)
+		lcpf_randmac_r(r, addrs + (x * 6), valid);
+}
+
+void lcpf_randseq_bulk(lorcon_rand_t *r, uint16_t *seqs, unsigned int count) {
+	uint64_t v = 0;
+	unsigned int x;
+
+	if (r == NULL)
+		r = lorcon_rand_thread();
+
+	/* Sequence numbers are 12 bits, so each draw yields 5 of them */
+	for (x = 0; x < count; x++) {
+		if (x % 5 == 0)
+			v = lorcon_rand_next64(r);
+
+		seqs[x] = (uint16_t) (v & 0x0FFF);
+		v >>= 12;
+	}
+}
+
+void lcpf_randpayload(lorcon_rand_t *r, uint8_t *buf, unsigned int len) {
+	if (r == NULL)
+		r = lorcon_rand_thread();
+
+	lorcon_rand_fill(r, buf, len);
 }
 
 void lcpf_qosheaders(struct lcpa_metapack *pack, unsigned int priority,
@@ -211,6 +254,135 @@ void lcpf_add_ie(struct lcpa_metapack *pack, uint8_t num, uint8_t len, uint8_t *
 	lcpa_append_copy(pack, "IETAG", len + 2, chunk);
 }
 
+lcpf_ieblock_t *lcpf_ieblock_create() {
+	lcpf_ieblock_t *block = (lcpf_ieblock_t *) malloc(sizeof(lcpf_ieblock_t));
+
+	if (block == NULL)
+		return NULL;
+
+	block->data = NULL;
+	block->len = 0;
+	block->max_len = 0;
+	block->refcount = 1;
+	block->frozen = 0;
+
+	return block;
+}
+
+void lcpf_ieblock_ref(lcpf_ieblock_t *block) {
+	__sync_add_and_fetch(&(block->refcount), 1);
+}
+
+void lcpf_ieblock_unref(lcpf_ieblock_t *block) {
+	if (__sync_sub_and_fetch(&(block->refcount), 1) != 0)
+		return;
+
+	free(block->data);
+	free(block);
+}
+
+/* lcpa release hook */
+static void lcpf_ieblock_release(void *aux) {
+	lcpf_ieblock_unref((lcpf_ieblock_t *) aux);
+}
+
+int lcpf_ieblock_add_ie(lcpf_ieblock_t *block, uint8_t num, uint8_t len, 
+		uint8_t *data) {
+	uint8_t *ndata;
+	int nmax;
+
+	/* Attached frames point directly at the block data; the caller may
+	 * have dropped its own reference, so the refcount can't tell us */
+	if (__atomic_load_n(&(block->frozen), __ATOMIC_ACQUIRE))
+		return -1;
+
+	if (block->len + len + 2 > block->max_len) {
+		nmax = block->max_len ? block->max_len * 2 : 256;
+
+		while (nmax < block->len + len + 2)
+			nmax *= 2;
+
+		if ((ndata = (uint8_t *) realloc(block->data, nmax)) == NULL)
+			return -1;
+
+		block->data = ndata;
+		block->max_len = nmax;
+	}
+
+	block->data[block->len] = num;
+	block->data[block->len + 1] = len;
+	memcpy(block->data + block->len + 2, data, len);
+	block->len += len + 2;
+
+	return 0;
+}
+
+uint8_t *lcpf_ieblock_find_ie(lcpf_ieblock_t *block, uint8_t num, 
+		uint8_t *ret_len) {
+	int offt = 0;
+
+	while (offt + 2 <= block->len) {
+		if (offt + 2 + block->data[offt + 1] > block->len)
+			break;
+
+		if (block->data[offt] == num) {
+			if (ret_len != NULL)
+				*ret_len = block->data[offt + 1];
+			return block->data + offt + 2;
+		}
+
+		offt += block->data[offt + 1] + 2;
+	}
+
+	return NULL;
+}
+
+int lcpf_ieblock_patch_ie(lcpf_ieblock_t *block, uint8_t num, 
+		unsigned int offset, unsigned int len, uint8_t *data) {
+	uint8_t *ie, ielen;
+
+	if ((ie = lcpf_ieblock_find_ie(block, num, &ielen)) == NULL)
+		return -1;
+
+	if (offset + len > ielen)
+		return -1;
+
+	memcpy(ie + offset, data, len);
+
+	return 0;
+}
+
+int lcpf_ieblock_set_dtim_count(lcpf_ieblock_t *block, uint8_t dtim_count) {
+	/* TIM body: DTIM count, DTIM period, bitmap control, partial bitmap */
+	return lcpf_ieblock_patch_ie(block, WLAN_TAGPARM_TIM, 0, 1, &dtim_count);
+}
+
+void lcpf_add_ieblock(struct lcpa_metapack *pack, lcpf_ieblock_t *block) {
+	__atomic_store_n(&(block->frozen), 1, __ATOMIC_RELEASE);
+
+	lcpf_ieblock_ref(block);
+
+	lcpa_append_shared(pack, "IEBLOCK", block->len, block->data,
+			lcpf_ieblock_release, block);
+}
+
+void lcpf_add_fcs(struct lcpa_metapack *pack) {
+	struct lcpa_metapack *i;
+	uint32_t crc = 0;
+	uint8_t chunk[4];
+
+	/* Find the head, and CRC everything after it */
+	for (i = pack; i->prev != NULL; i = i->prev)
+		;
+
+	for (i = i->next; i != NULL; i = i->next) 
+		crc = lorcon_crc32_update(crc, i->data, i->len);
+
+	lorcon_crc32_put(crc, chunk);
+
+	lcpa_append_copy(pack, "80211FCS", 4, chunk);
+}
+
 void lcpf_deauth(struct lcpa_metapack *pack, uint8_t *src, uint8_t *dst,
 				   uint8_t *bssid, int framecontrol, 
 				   int duration, int fragment,
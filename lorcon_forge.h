@@ -38,12 +38,34 @@
 #include <lorcon_packasm.h>
 #endif
 
+#ifndef __LORCON_RAND_H__
+#include <lorcon_rand.h>
+#endif
+
 /* Create a random MAC address, optionally seeded with a valid wireless OUI
  *
  * addr must be allocated by the caller
+ *
+ * Uses the calling thread's generator (see lorcon_rand_thread())
  */
 void lcpf_randmac(uint8_t *addr, int valid);
 
+/* Random helpers drawing from an explicit generator, for reproducible runs.
+ *
+ * r may be NULL to use the calling thread's generator.
+ */
+void lcpf_randmac_r(lorcon_rand_t *r, uint8_t *addr, int valid);
+
+/* Fill count MAC addresses; addrs must hold count * 6 bytes */
+void lcpf_randmac_bulk(lorcon_rand_t *r, uint8_t *addrs, unsigned int count,
+		int valid);
+
+/* Fill count 12-bit 802.11 sequence numbers */
+void lcpf_randseq_bulk(lorcon_rand_t *r, uint16_t *seqs, unsigned int count);
+
+/* Fill len bytes of random payload */
+void lcpf_randpayload(lorcon_rand_t *r, uint8_t *buf, unsigned int len);
+
 /* Generate the common 802.11 headers.  Lower-level function which will generally
  * be wrapped in packet-specific functions
  *
@@ -90,6 +112,64 @@ void lcpf_beacon(struct lcpa_metapack *pack, uint8_t *src, uint8_t *bssid,
  */
 void lcpf_add_ie(struct lcpa_metapack *pack, uint8_t num, uint8_t len, uint8_t *data);
 
+/* IE blocks
+ *
+ * A set of IE tags serialized once and shared, without copying, by any
+ * number of frames.  Blocks are reference counted; each frame the block is
+ * attached to holds a reference which is dropped when the frame is freed.
+ *
+ * Patching a block changes every frame it is attached to.  IEs which must
+ * differ per frame belong outside the block, added with lcpf_add_ie.
+ */
+struct lcpf_ieblock {
+	uint8_t *data;
+	int len;
+	int max_len;
+
+	int refcount;
+
+	/* Set once the block is attached to a frame; its layout is fixed from
+	 * then on, even after those frames are freed */
+	int frozen;
+};
+typedef struct lcpf_ieblock lcpf_ieblock_t;
+
+/* Create an empty block holding one reference, owned by the caller */
+lcpf_ieblock_t *lcpf_ieblock_create();
+
+/* Take and drop references; the block is freed when the last is dropped */
+void lcpf_ieblock_ref(lcpf_ieblock_t *block);
+void lcpf_ieblock_unref(lcpf_ieblock_t *block);
+
+/* Append an IE tag to the block.  Blocks must be complete before they are
+ * attached to a frame; returns 0, or -1 if the block has been attached or
+ * on allocation failure */
+int lcpf_ieblock_add_ie(lcpf_ieblock_t *block, uint8_t num, uint8_t len, 
+		uint8_t *data);
+
+/* Find the first IE tag `num' in the block.  Returns a pointer to the IE
+ * body and its length in ret_len, or NULL if the IE is not present */
+uint8_t *lcpf_ieblock_find_ie(lcpf_ieblock_t *block, uint8_t num, 
+		uint8_t *ret_len);
+
+/* Overwrite `len' bytes of the body of IE `num' starting at `offset'.  The
+ * IE length cannot change.  Returns 0, or -1 if the IE is missing or the
+ * range falls outside it */
+int lcpf_ieblock_patch_ie(lcpf_ieblock_t *block, uint8_t num, 
+		unsigned int offset, unsigned int len, uint8_t *data);
+
+/* Set the DTIM count in the TIM IE of the block */
+int lcpf_ieblock_set_dtim_count(lcpf_ieblock_t *block, uint8_t dtim_count);
+
+/* Attach a block to the end of a frame; the frame takes a reference */
+void lcpf_add_ieblock(struct lcpa_metapack *pack, lcpf_ieblock_t *block);
+
+/* Append a correct FCS (CRC32 of every component) to a frame.  This must be
+ * the last component added; changing the frame afterwards leaves a stale
+ * FCS.  Drivers which build a radiotap header flag frames carrying an
+ * 80211FCS component as including the FCS. */
+void lcpf_add_fcs(struct lcpa_metapack *pack);
+
 /* Generate a disassoc frame */
 void lcpf_disassoc(struct lcpa_metapack *pack, uint8_t *src, uint8_t *dst,
 				   uint8_t *bssid, int framecontrol, int duration, int fragment,
@@ -0,0 +1,663 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_packet.h"
+#include "lorcon_hop.h"
+
+/* Weight of the newest visit in a channel's traffic rate */
+#define LORCON_HOP_RATE_ALPHA   0.25
+
+/* Dwell hints for a phy, see lorcon_hop_set_dwell_hint() */
+struct lorcon_hop_hints {
+    char phy[32];
+    unsigned int valid;
+    lorcon_hop_dwell_hint_t hint[LORCON_HOP_HINT_TYPES];
+};
+
+static pthread_mutex_t lorcon_hop_hint_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct lorcon_hop_hints *lorcon_hop_hint_table = NULL;
+static int lorcon_hop_hint_num = 0;
+static int lorcon_hop_hint_max = 0;
+
+struct lorcon_hop_channel {
+    int complex;
+    int channel;
+    lorcon_channel_t ht;
+
+    /* Channel stamped on packets */
+    int stamp_channel;
+
+    unsigned int base_dwell_ms;
+    unsigned int dwell_ms;
+
+    /* Packets per second while on the channel, smoothed over visits */
+    double rate;
+
+    uint64_t visits;
+    uint64_t errors;
+    uint64_t packets;
+    uint64_t dwell_total_ns;
+    uint64_t switch_total_ns;
+};
+
+struct lorcon_hop {
+    lorcon_t *context;
+
+    int timer_fd;
+
+    struct lorcon_hop_channel *channels;
+    int num_channels;
+    int max_channels;
+
+    int running;
+    int pos;
+
+    /* Current channel was tuned successfully, and when */
+    int tuned;
+    int64_t tuned_ns;
+
+    int adaptive;
+    unsigned int min_dwell_ms;
+    unsigned int max_dwell_ms;
+
+    int stamp;
+
+    /* Shortest dwell per channel type, from the phy's hints at start */
+    unsigned int hint_ms[LORCON_HOP_HINT_TYPES];
+
+    /* Read and written from capture threads, see lorcon_hop_stamp() */
+    int cur_channel;
+    uint64_t cur_packets;
+
+    char errstr[LORCON_STATUS_MAX];
+};
+
+static int64_t lorcon_hop_mono_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+lorcon_hop_t *lorcon_hop_create(lorcon_t *context) {
+    lorcon_hop_t *hop;
+
+    if (context->hop != NULL) {
+        snprintf(context->errstr, LORCON_STATUS_MAX,
+                "Interface already has a channel hopper");
+        return NULL;
+    }
+
+    if ((hop = (lorcon_hop_t *) malloc(sizeof(lorcon_hop_t))) == NULL) {
+        snprintf(context->errstr, LORCON_STATUS_MAX,
+                "Could not allocate channel hopper");
+        return NULL;
+    }
+
+    memset(hop, 0, sizeof(lorcon_hop_t));
+
+    if ((hop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                    TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        snprintf(context->errstr, LORCON_STATUS_MAX,
+                "Could not create hop timer: %s", strerror(errno));
+        free(hop);
+        return NULL;
+    }
+
+    hop->context = context;
+    hop->stamp = 1;
+
+    context->hop = hop;
+
+    return hop;
+}
+
+void lorcon_hop_free(lorcon_hop_t *hop) {
+    lorcon_hop_stop(hop);
+
+    hop->context->hop = NULL;
+
+    close(hop->timer_fd);
+    free(hop->channels);
+    free(hop);
+}
+
+const char *lorcon_hop_get_error(lorcon_hop_t *hop) {
+    return hop->errstr;
+}
+
+static struct lorcon_hop_channel *lorcon_hop_new_channel(lorcon_hop_t *hop,
+        unsigned int dwell_ms) {
+    struct lorcon_hop_channel *c;
+    int nmax;
+
+    if (dwell_ms == 0) {
+        snprintf(hop->errstr, LORCON_STATUS_MAX, "Dwell time must be non-zero");
+        return NULL;
+    }
+
+    if (hop->num_channels == hop->max_channels) {
+        nmax = hop->max_channels ? hop->max_channels * 2 : 16;
+
+        if ((c = (struct lorcon_hop_channel *) realloc(hop->channels,
+                        sizeof(struct lorcon_hop_channel) * nmax)) == NULL) {
+            snprintf(hop->errstr, LORCON_STATUS_MAX,
+                    "Could not allocate hop channel list");
+            return NULL;
+        }
+
+        hop->channels = c;
+        hop->max_channels = nmax;
+    }
+
+    c = &(hop->channels[hop->num_channels++]);
+
+    memset(c, 0, sizeof(struct lorcon_hop_channel));
+    c->base_dwell_ms = dwell_ms;
+    c->dwell_ms = dwell_ms;
+
+    return c;
+}
+
+int lorcon_hop_add_channel(lorcon_hop_t *hop, int channel, unsigned int dwell_ms) {
+    struct lorcon_hop_channel *c;
+
+    if ((c = lorcon_hop_new_channel(hop, dwell_ms)) == NULL)
+        return -1;
+
+    c->channel = channel;
+    c->stamp_channel = channel;
+
+    return 0;
+}
+
+int lorcon_hop_add_complex_channel(lorcon_hop_t *hop, lorcon_channel_t *channel,
+        unsigned int dwell_ms) {
+    struct lorcon_hop_channel *c;
+
+    if ((c = lorcon_hop_new_channel(hop, dwell_ms)) == NULL)
+        return -1;
+
+    c->complex = 1;
+    c->channel = channel->channel;
+    c->ht = *channel;
+
+    /* Complex channels are given by frequency, packets carry the number */
+    c->stamp_channel = wifi_freq_to_chan(channel->channel);
+
+    return 0;
+}
+
+void lorcon_hop_clear_channels(lorcon_hop_t *hop) {
+    lorcon_hop_stop(hop);
+
+    hop->num_channels = 0;
+}
+
+int lorcon_hop_set_adaptive(lorcon_hop_t *hop, int adaptive,
+        unsigned int min_dwell_ms, unsigned int max_dwell_ms) {
+    int x;
+
+    if (adaptive && (min_dwell_ms == 0 || min_dwell_ms > max_dwell_ms)) {
+        snprintf(hop->errstr, LORCON_STATUS_MAX,
+                "Invalid adaptive dwell range %u-%u ms", min_dwell_ms, max_dwell_ms);
+        return -1;
+    }
+
+    hop->adaptive = adaptive;
+    hop->min_dwell_ms = min_dwell_ms;
+    hop->max_dwell_ms = max_dwell_ms;
+
+    if (!adaptive) {
+        for (x = 0; x < hop->num_channels; x++)
+            hop->channels[x].dwell_ms = hop->channels[x].base_dwell_ms;
+    }
+
+    return 0;
+}
+
+void lorcon_hop_set_stamp(lorcon_hop_t *hop, int stamp) {
+    hop->stamp = stamp;
+}
+
+/* Work out the next dwell for a channel from its rate against the mean rate
+ * of the channels visited so far */
+static void lorcon_hop_adapt(lorcon_hop_t *hop, struct lorcon_hop_channel *c) {
+    double mean = 0, dwell;
+    int x, n = 0;
+
+    for (x = 0; x < hop->num_channels; x++) {
+        if (hop->channels[x].visits == 0)
+            continue;
+
+        mean += hop->channels[x].rate;
+        n++;
+    }
+
+    if (n == 0 || mean <= 0) {
+        c->dwell_ms = c->base_dwell_ms;
+        return;
+    }
+
+    mean /= n;
+
+    dwell = (double) c->base_dwell_ms * (c->rate / mean);
+
+    if (dwell < hop->min_dwell_ms)
+        dwell = hop->min_dwell_ms;
+    else if (dwell > hop->max_dwell_ms)
+        dwell = hop->max_dwell_ms;
+
+    c->dwell_ms = (unsigned int) (dwell + 0.5);
+}
+
+/* Account the time and packets on the channel being left */
+static void lorcon_hop_leave(lorcon_hop_t *hop) {
+    struct lorcon_hop_channel *c = &(hop->channels[hop->pos]);
+    uint64_t packets;
+    int64_t elapsed;
+    double rate;
+
+    __atomic_store_n(&hop->cur_channel, 0, __ATOMIC_RELAXED);
+    packets = __atomic_exchange_n(&hop->cur_packets, 0, __ATOMIC_RELAXED);
+
+    if (!hop->tuned)
+        return;
+
+    hop->tuned = 0;
+
+    elapsed = lorcon_hop_mono_ns() - hop->tuned_ns;
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    c->packets += packets;
+    c->dwell_total_ns += elapsed;
+
+    rate = (double) packets * 1000000000.0 / elapsed;
+
+    if (c->visits == 1)
+        c->rate = rate;
+    else
+        c->rate += LORCON_HOP_RATE_ALPHA * (rate - c->rate);
+
+    if (hop->adaptive)
+        lorcon_hop_adapt(hop, c);
+}
+
+static void lorcon_hop_arm(lorcon_hop_t *hop, unsigned int ms) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(struct itimerspec));
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (long) (ms % 1000) * 1000000;
+
+    timerfd_settime(hop->timer_fd, 0, &its, NULL);
+}
+
+/* Tune to the current position and arm the timer for its dwell */
+static int lorcon_hop_tune(lorcon_hop_t *hop) {
+    struct lorcon_hop_channel *c = &(hop->channels[hop->pos]);
+    unsigned int dwell = c->dwell_ms, type;
+    int64_t start, end;
+    int r;
+
+    type = c->complex ? c->ht.type : LORCON_CHANNEL_BASIC;
+
+    if (type < LORCON_HOP_HINT_TYPES && dwell < hop->hint_ms[type])
+        dwell = hop->hint_ms[type];
+
+    start = lorcon_hop_mono_ns();
+
+    if (c->complex)
+        r = lorcon_set_complex_channel(hop->context, &(c->ht));
+    else
+        r = lorcon_set_channel(hop->context, c->channel);
+
+    end = lorcon_hop_mono_ns();
+
+    /* Keep to the schedule even when the change fails */
+    lorcon_hop_arm(hop, dwell);
+
+    if (r < 0) {
+        c->errors++;
+        snprintf(hop->errstr, LORCON_STATUS_MAX, "Could not hop to %d: %s",
+                c->channel, lorcon_get_error(hop->context));
+        return r;
+    }
+
+    c->visits++;
+    c->switch_total_ns += end - start;
+
+    hop->tuned = 1;
+    hop->tuned_ns = end;
+
+    /* Packets read from here on are counted against this channel */
+    __atomic_store_n(&hop->cur_packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hop->cur_channel, c->stamp_channel, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+static void lorcon_hop_load_hints(lorcon_hop_t *hop) {
+    lorcon_hop_dwell_hint_t hint;
+    unsigned int t;
+
+    for (t = 0; t < LORCON_HOP_HINT_TYPES; t++) {
+        if (lorcon_hop_get_dwell_hint(hop->context, t, &hint) < 0)
+            hop->hint_ms[t] = 0;
+        else
+            hop->hint_ms[t] = hint.min_dwell_ms;
+    }
+}
+
+int lorcon_hop_start(lorcon_hop_t *hop) {
+    if (hop->num_channels == 0) {
+        snprintf(hop->errstr, LORCON_STATUS_MAX, "No channels to hop");
+        return -1;
+    }
+
+    if (hop->running)
+        return 0;
+
+    lorcon_hop_load_hints(hop);
+
+    hop->running = 1;
+    hop->pos = 0;
+
+    /* Tuning arms the timer even when it fails; leave nothing running */
+    if (lorcon_hop_tune(hop) < 0) {
+        lorcon_hop_arm(hop, 0);
+        hop->running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void lorcon_hop_stop(lorcon_hop_t *hop) {
+    if (!hop->running)
+        return;
+
+    lorcon_hop_leave(hop);
+    lorcon_hop_arm(hop, 0);
+
+    hop->running = 0;
+}
+
+int lorcon_hop_get_fd(lorcon_hop_t *hop) {
+    return hop->timer_fd;
+}
+
+int lorcon_hop_service(lorcon_hop_t *hop) {
+    uint64_t expirations;
+
+    if (!hop->running)
+        return 0;
+
+    if (read(hop->timer_fd, &expirations, sizeof(uint64_t)) < 0)
+        return 0;
+
+    lorcon_hop_leave(hop);
+
+    hop->pos = (hop->pos + 1) % hop->num_channels;
+
+    return lorcon_hop_tune(hop);
+}
+
+int lorcon_hop_get_channel(lorcon_hop_t *hop) {
+    return __atomic_load_n(&hop->cur_channel, __ATOMIC_RELAXED);
+}
+
+int lorcon_hop_get_num_channels(lorcon_hop_t *hop) {
+    return hop->num_channels;
+}
+
+int lorcon_hop_get_stats(lorcon_hop_t *hop, int index, lorcon_hop_stats_t *stats) {
+    struct lorcon_hop_channel *c;
+
+    if (index < 0 || index >= hop->num_channels) {
+        snprintf(hop->errstr, LORCON_STATUS_MAX, "No hop channel %d", index);
+        return -1;
+    }
+
+    c = &(hop->channels[index]);
+
+    stats->channel = c->channel;
+    stats->visits = c->visits;
+    stats->errors = c->errors;
+    stats->packets = c->packets;
+    stats->dwell_total_ms = c->dwell_total_ns / 1000000;
+    stats->dwell_ms = c->dwell_ms;
+    stats->switch_us = c->visits ?
+        (unsigned int) (c->switch_total_ns / c->visits / 1000) : 0;
+
+    /* Include the visit in progress */
+    if (hop->tuned && index == hop->pos)
+        stats->packets += __atomic_load_n(&hop->cur_packets, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+void lorcon_hop_stamp(struct lorcon_hop *hop, lorcon_packet_t *packet) {
+    int channel = __atomic_load_n(&hop->cur_channel, __ATOMIC_RELAXED);
+
+    /* Changing channel; we can't say where this came from */
+    if (channel == 0)
+        return;
+
+    __atomic_add_fetch(&hop->cur_packets, 1, __ATOMIC_RELAXED);
+
+    if (hop->stamp && packet->channel == 0)
+        packet->channel = channel;
+}
+
+/* Hints are kept by phy name, so they survive interfaces being recreated
+ * and can be saved; interfaces whose phy we can't look up use their own
+ * name */
+static void lorcon_hop_phy_name(lorcon_t *context, char *name, size_t len) {
+    const lorcon_phy_caps_t *caps = lorcon_get_phy_caps(context);
+
+    if (caps != NULL && caps->name[0] != 0)
+        snprintf(name, len, "%s", caps->name);
+    else
+        snprintf(name, len, "%s", lorcon_get_capiface(context));
+
+    lorcon_put_phy_caps(caps);
+}
+
+/* Entry for a phy, creating it if asked; hint lock held */
+static struct lorcon_hop_hints *lorcon_hop_find_hints(const char *phy, int create) {
+    struct lorcon_hop_hints *h;
+    int x, nmax;
+
+    for (x = 0; x < lorcon_hop_hint_num; x++) {
+        if (strcmp(lorcon_hop_hint_table[x].phy, phy) == 0)
+            return &(lorcon_hop_hint_table[x]);
+    }
+
+    if (!create)
+        return NULL;
+
+    if (lorcon_hop_hint_num == lorcon_hop_hint_max) {
+        nmax = lorcon_hop_hint_max ? lorcon_hop_hint_max * 2 : 4;
+
+        if ((h = (struct lorcon_hop_hints *) realloc(lorcon_hop_hint_table,
+                        sizeof(struct lorcon_hop_hints) * nmax)) == NULL)
+            return NULL;
+
+        lorcon_hop_hint_table = h;
+        lorcon_hop_hint_max = nmax;
+    }
+
+    h = &(lorcon_hop_hint_table[lorcon_hop_hint_num++]);
+
+    memset(h, 0, sizeof(struct lorcon_hop_hints));
+    snprintf(h->phy, sizeof(h->phy), "%s", phy);
+
+    return h;
+}
+
+static int lorcon_hop_store_hint(const char *phy, unsigned int type,
+        const lorcon_hop_dwell_hint_t *hint) {
+    struct lorcon_hop_hints *h;
+
+    pthread_mutex_lock(&lorcon_hop_hint_lock);
+
+    if ((h = lorcon_hop_find_hints(phy, 1)) == NULL) {
+        pthread_mutex_unlock(&lorcon_hop_hint_lock);
+        return -1;
+    }
+
+    h->hint[type] = *hint;
+    h->valid |= (1 << type);
+
+    pthread_mutex_unlock(&lorcon_hop_hint_lock);
+
+    return 0;
+}
+
+int lorcon_hop_set_dwell_hint(lorcon_t *context, unsigned int type,
+        const lorcon_hop_dwell_hint_t *hint) {
+    char phy[32];
+
+    if (type >= LORCON_HOP_HINT_TYPES) {
+        snprintf(context->errstr, LORCON_STATUS_MAX, "Invalid channel type %u", type);
+        return -1;
+    }
+
+    lorcon_hop_phy_name(context, phy, sizeof(phy));
+
+    if (lorcon_hop_store_hint(phy, type, hint) < 0) {
+        snprintf(context->errstr, LORCON_STATUS_MAX, "Could not allocate dwell hints");
+        return -1;
+    }
+
+    return 0;
+}
+
+int lorcon_hop_get_dwell_hint(lorcon_t *context, unsigned int type,
+        lorcon_hop_dwell_hint_t *ret_hint) {
+    struct lorcon_hop_hints *h;
+    char phy[32];
+    int r = -1;
+
+    if (type >= LORCON_HOP_HINT_TYPES)
+        return -1;
+
+    lorcon_hop_phy_name(context, phy, sizeof(phy));
+
+    pthread_mutex_lock(&lorcon_hop_hint_lock);
+
+    if ((h = lorcon_hop_find_hints(phy, 0)) != NULL && (h->valid & (1 << type))) {
+        *ret_hint = h->hint[type];
+        r = 0;
+    }
+
+    pthread_mutex_unlock(&lorcon_hop_hint_lock);
+
+    return r;
+}
+
+int lorcon_hop_save_dwell_hints(const char *path) {
+    FILE *f;
+    lorcon_hop_dwell_hint_t *d;
+    unsigned int t;
+    int x, r = 0;
+
+    if ((f = fopen(path, "w")) == NULL)
+        return -1;
+
+    fprintf(f, "# lorcon dwell hints: phy type samples ack_p50_us ack_p99_us "
+            "frame_p50_us frame_p99_us min_dwell_ms\n");
+
+    pthread_mutex_lock(&lorcon_hop_hint_lock);
+
+    for (x = 0; x < lorcon_hop_hint_num; x++) {
+        for (t = 0; t < LORCON_HOP_HINT_TYPES; t++) {
+            if ((lorcon_hop_hint_table[x].valid & (1 << t)) == 0)
+                continue;
+
+            d = &(lorcon_hop_hint_table[x].hint[t]);
+
+            fprintf(f, "%s %u %u %u %u %u %u %u\n", lorcon_hop_hint_table[x].phy,
+                    t, d->samples, d->ack_p50_us, d->ack_p99_us,
+                    d->frame_p50_us, d->frame_p99_us, d->min_dwell_ms);
+        }
+    }
+
+    pthread_mutex_unlock(&lorcon_hop_hint_lock);
+
+    if (ferror(f))
+        r = -1;
+
+    if (fclose(f) != 0)
+        r = -1;
+
+    return r;
+}
+
+int lorcon_hop_load_dwell_hints(const char *path) {
+    FILE *f;
+    char line[256], phy[32];
+    lorcon_hop_dwell_hint_t d;
+    unsigned int t;
+    int n = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#')
+            continue;
+
+        if (sscanf(line, "%31s %u %u %u %u %u %u %u", phy, &t, &d.samples,
+                    &d.ack_p50_us, &d.ack_p99_us, &d.frame_p50_us,
+                    &d.frame_p99_us, &d.min_dwell_ms) != 8 ||
+                t >= LORCON_HOP_HINT_TYPES)
+            continue;
+
+        if (lorcon_hop_store_hint(phy, t, &d) < 0) {
+            fclose(f);
+            errno = ENOMEM;
+            return -1;
+        }
+
+        n++;
+    }
+
+    fclose(f);
+
+    return n;
+}
@@ -0,0 +1,157 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/* LORCON HOP
+ *
+ * Channel hopping for a single interface.  The hopper cycles through a
+ * list of channels, plain or complex (HT/VHT), staying on each for its
+ * dwell time.  It is driven by a timer fd: watch lorcon_hop_get_fd and
+ * call lorcon_hop_service when it is readable.
+ *
+ * In adaptive mode the dwell on each channel follows the traffic seen
+ * there: busy channels are held longer, up to the maximum dwell, and idle
+ * ones are left sooner, down to the minimum, so more of each cycle goes
+ * where there is something to capture.  Every channel is still visited
+ * once per cycle.
+ *
+ * While hopping, captured packets which don't carry a channel in their
+ * capture headers are stamped with the channel the interface was on.
+ *
+ * A context has at most one hopper; free it before the context.
+ */
+
+#ifndef __LORCON_HOP_H__
+#define __LORCON_HOP_H__
+
+#include <stdint.h>
+
+struct lorcon;
+typedef struct lorcon lorcon_t;
+
+struct lorcon_channel;
+typedef struct lorcon_channel lorcon_channel_t;
+
+struct lorcon_hop;
+typedef struct lorcon_hop lorcon_hop_t;
+
+/* Create a hopper for an open interface, NULL on failure (see
+ * lorcon_get_error on the context) */
+lorcon_hop_t *lorcon_hop_create(lorcon_t *context);
+void lorcon_hop_free(lorcon_hop_t *hop);
+
+const char *lorcon_hop_get_error(lorcon_hop_t *hop);
+
+/* Add a channel with its base dwell in milliseconds.  Channels are visited
+ * in the order they are added.  0 on success, negative on failure */
+int lorcon_hop_add_channel(lorcon_hop_t *hop, int channel, unsigned int dwell_ms);
+int lorcon_hop_add_complex_channel(lorcon_hop_t *hop, lorcon_channel_t *channel,
+        unsigned int dwell_ms);
+void lorcon_hop_clear_channels(lorcon_hop_t *hop);
+
+/* Adaptive dwell.  Each channel's dwell becomes its base dwell scaled by
+ * how busy it has recently been compared with the average channel,
+ * clamped to [min_dwell_ms, max_dwell_ms] */
+int lorcon_hop_set_adaptive(lorcon_hop_t *hop, int adaptive,
+        unsigned int min_dwell_ms, unsigned int max_dwell_ms);
+
+/* Stamp captured packets with the current channel; on by default */
+void lorcon_hop_set_stamp(lorcon_hop_t *hop, int stamp);
+
+/* Tune to the first channel and start the timer; stopping leaves the
+ * interface on its current channel */
+int lorcon_hop_start(lorcon_hop_t *hop);
+void lorcon_hop_stop(lorcon_hop_t *hop);
+
+/* Timer fd, readable when it is time to hop */
+int lorcon_hop_get_fd(lorcon_hop_t *hop);
+
+/* Hop if the dwell is up; never blocks.  Returns 1 if the channel was
+ * changed, 0 if it wasn't time yet, negative if the change failed (the
+ * hopper keeps going and tries the next channel when its dwell is up) */
+int lorcon_hop_service(lorcon_hop_t *hop);
+
+/* Channel the interface is on, or 0 while changing or stopped */
+int lorcon_hop_get_channel(lorcon_hop_t *hop);
+
+/* Per-channel statistics, by the index the channel was added at */
+typedef struct lorcon_hop_stats {
+    /* Channel or control frequency */
+    int channel;
+
+    /* Times visited, and failed changes to it */
+    uint64_t visits;
+    uint64_t errors;
+
+    /* Packets captured and milliseconds spent on the channel */
+    uint64_t packets;
+    uint64_t dwell_total_ms;
+
+    /* Dwell which will be used on the next visit */
+    unsigned int dwell_ms;
+
+    /* Mean time to change to the channel, in microseconds */
+    unsigned int switch_us;
+} lorcon_hop_stats_t;
+
+int lorcon_hop_get_num_channels(lorcon_hop_t *hop);
+int lorcon_hop_get_stats(lorcon_hop_t *hop, int index, lorcon_hop_stats_t *stats);
+
+/* Dwell hints
+ *
+ * How long a channel change takes depends on the chipset and the width.
+ * A hint records, for a phy and channel type (LORCON_CHANNEL_*), how long
+ * changes took to be acknowledged and until the first frame arrived on
+ * the new channel, and the shortest dwell worth spending there.  Hints are
+ * measured by tools/chanswitch_bench, and kept for the process; they can
+ * be saved to and loaded from a file.
+ *
+ * A hopper looks up the hints for its phy when it starts and never dwells
+ * less than them, whatever its adaptive range.
+ */
+#define LORCON_HOP_HINT_TYPES   10
+
+typedef struct lorcon_hop_dwell_hint {
+    unsigned int samples;
+
+    /* Command to acknowledgement, in microseconds */
+    unsigned int ack_p50_us;
+    unsigned int ack_p99_us;
+
+    /* Command to the first frame captured on the new channel */
+    unsigned int frame_p50_us;
+    unsigned int frame_p99_us;
+
+    unsigned int min_dwell_ms;
+} lorcon_hop_dwell_hint_t;
+
+/* Set or get the hint for the phy under an interface.  Get returns -1 if
+ * there is none */
+int lorcon_hop_set_dwell_hint(lorcon_t *context, unsigned int type,
+        const lorcon_hop_dwell_hint_t *hint);
+int lorcon_hop_get_dwell_hint(lorcon_t *context, unsigned int type,
+        lorcon_hop_dwell_hint_t *ret_hint);
+
+/* Save every hint, or load hints from a file saved earlier (replacing
+ * ones for the same phy and type).  Load returns the number read; both
+ * return -1 with errno set on failure */
+int lorcon_hop_save_dwell_hints(const char *path);
+int lorcon_hop_load_dwell_hints(const char *path);
+
+#endif
+
@@ -30,6 +30,7 @@
 
 #include "lorcon.h"
 #include "lorcon_packet.h"
+#include "lorcon_chandb.h"
 
 /* This file is meant for use inside the lorcon library ONLY, apps should not
  * count on it existing or being consistent */
@@ -38,6 +39,27 @@
 
 #define LORCON_WEPKEY_MAX	26
 
+/* Control channel events */
+#define LORCON_CONTROL_BREAK	1
+#define LORCON_CONTROL_WAKEUP	2
+
+/* Asynchronous channel changes in flight at once */
+#define LORCON_CHANNEL_MAX_PENDING	16
+
+struct lorcon_channel_request {
+	/* Id given to the caller, and the one the driver reports completion by */
+	unsigned int id;
+	unsigned int drv_id;
+	int64_t sent_ns;
+
+	/* Channel asked for and wall clock time sent, for the channel epoch */
+	lorcon_channel_t channel;
+	int64_t sent_us;
+};
+
+/* Channel changes remembered for stamping packets read after a hop */
+#define LORCON_CHANNEL_EPOCHS		8
+
 struct lorcon_wep {
 	u_char bssid[6];
 	u_char key[LORCON_WEPKEY_MAX];
@@ -72,6 +94,12 @@ struct lorcon {
 
 	int timeout_ms;
 
+	/* pcap is in non-blocking mode, see lorcon_set_nonblock() */
+	int nonblock;
+
+	/* Check the FCS of captured frames in lorcon_packet_decode */
+	int validate_fcs;
+
 	void *auxptr;
 
     void *userauxptr;
@@ -79,6 +107,44 @@ struct lorcon {
 	lorcon_handler handler_cb;
 	void *handler_user;
 
+	/* Control channel; events are posted as bits in control_pending and
+	 * signalled on the eventfd */
+	int control_fd;
+	unsigned int control_pending;
+
+	/* pcap reads in progress, see lorcon_pcap_enter() */
+	int pcap_active;
+	lorcon_wakeup_handler wakeup_cb;
+	void *wakeup_aux;
+
+	/* Asynchronous channel changes waiting for the driver to complete them,
+	 * oldest first; see lorcon_set_channel_async() */
+	lorcon_channel_handler chan_cb;
+	void *chan_aux;
+	struct lorcon_channel_request chan_pending[LORCON_CHANNEL_MAX_PENDING];
+	int chan_num_pending;
+	unsigned int chan_seq;
+
+	/* Recent channel changes, newest at (epoch_count - 1) %
+	 * LORCON_CHANNEL_EPOCHS; epoch_lock is odd while one is written */
+	lorcon_channel_epoch_t epochs[LORCON_CHANNEL_EPOCHS];
+	unsigned int epoch_count;
+	unsigned int epoch_lock;
+
+	/* Channel hopper, see lorcon_hop.h; NULL when there is none */
+	struct lorcon_hop *hop;
+
+	/* nl80211 event listener registration, see lorcon_enable_events();
+	 * guarded by the listener lock */
+	int ev_registered;
+	unsigned int ev_serial;
+	int ev_ifindex;
+	int ev_wiphy;
+	int ev_removed;
+	lorcon_event_handler ev_cb;
+	void *ev_aux;
+	struct lorcon *ev_next;
+
 	int (*close_cb)(lorcon_t *context);
 	
 	int (*openinject_cb)(lorcon_t *context);
@@ -93,6 +159,27 @@ struct lorcon {
     int (*setchan_ht_cb)(lorcon_t *context, lorcon_channel_t *channel);
 	int (*getchan_ht_cb)(lorcon_t *context, lorcon_channel_t *ret_channel);
 
+	/* Asynchronous channel changes: send the request and return its id
+	 * without waiting.  chanfd_cb returns an fd which is readable when
+	 * replies are waiting, and chancomplete_cb reads them and reports each
+	 * with lorcon_channel_done() */
+	int (*setchan_async_cb)(lorcon_t *context, int chan, unsigned int *ret_id);
+	int (*setchan_ht_async_cb)(lorcon_t *context, lorcon_channel_t *channel,
+			unsigned int *ret_id);
+	int (*chanfd_cb)(lorcon_t *context);
+	int (*chancomplete_cb)(lorcon_t *context);
+
+	/* Returns a reference, released by lorcon_put_phy_caps() */
+	const lorcon_phy_caps_t *(*getphycaps_cb)(lorcon_t *context);
+
+	/* Fetch survey entries, returning how many (allocated in
+	 * *ret_entries) or -1 */
+	int (*getsurvey_cb)(lorcon_t *context, lorcon_survey_entry_t **ret_entries);
+
+	/* Let the driver update cached state from a listener event; called
+	 * with the listener lock held, so it must not call back into it */
+	int (*event_cb)(lorcon_t *context, const lorcon_event_t *event);
+
 	int (*sendpacket_cb)(lorcon_t *context, lorcon_packet_t *packet);
 	int (*getpacket_cb)(lorcon_t *context, lorcon_packet_t **packet);
 
@@ -108,4 +195,33 @@ struct lorcon {
             const u_char *bytes);
 };
 
+/* Read the nl80211 event listener from inside a lorcon call: contexts and
+ * drivers are updated as in lorcon_events_service(), but user handlers,
+ * which may free their context, are held for its next call.
+ * lorcon_events_deferred_pending() says whether any are waiting. */
+int lorcon_events_update(void);
+int lorcon_events_deferred_pending(void);
+
+/* Post control events and wake whatever is waiting on the context */
+void lorcon_control_post(lorcon_t *context, unsigned int events);
+
+/* Bracket every pcap read.  pcap's break flag sticks until a read sees it,
+ * so lorcon_breakloop() only sets it while one is running; a read stopped
+ * by it (ret -2) also takes the break posted to the control channel, so
+ * one break never ends two loops */
+void lorcon_pcap_enter(lorcon_t *context);
+void lorcon_pcap_leave(lorcon_t *context, int ret);
+
+/* Called by drivers as asynchronous channel changes complete, with the id
+ * the driver returned when the change was sent and 0 or a negative error */
+void lorcon_channel_done(lorcon_t *context, unsigned int drv_id, int error);
+
+/* Stamp a captured packet with the channel the context was tuned to when
+ * it arrived */
+void lorcon_channel_stamp(lorcon_t *context, lorcon_packet_t *packet);
+
+/* Count a captured packet against the hopper's current channel and stamp
+ * the channel on it */
+void lorcon_hop_stamp(struct lorcon_hop *hop, lorcon_packet_t *packet);
+
 #endif
@@ -17,12 +17,16 @@
 
 */
 
+#include <errno.h>
 #include <malloc.h>
-#include <sys/select.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <pcap.h>
+
 #include "lorcon.h"
 #include "lorcon_int.h"
 #include "lorcon_multi.h"
@@ -38,49 +42,193 @@ lorcon_multi_t *lorcon_multi_create() {
     if (r == NULL)
         return NULL;
 
+    if ((r->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(r);
+        return NULL;
+    }
+
+    if (lorcon_multi_control_open(r) < 0) {
+        close(r->epoll_fd);
+        free(r);
+        return NULL;
+    }
+
     r->interfaces = NULL;
+    r->num_interfaces = 0;
+    r->num_always_ready = 0;
+    r->num_events = 0;
+    r->budget = LORCON_MULTI_DEFAULT_BUDGET;
+    r->tx_rr = 0;
+    r->drain_intf = NULL;
+    r->events_fd = -1;
+    r->stats_cb = NULL;
+    r->stats_aux = NULL;
+    r->stats_interval_us = 0;
+    r->stats_due_us = 0;
+    r->plan_cycle_ms = 0;
+    r->plan_weights = NULL;
+    r->plan_num_weights = 0;
+    r->plan_union = NULL;
+    r->plan_num_union = 0;
     r->errstr[0] = 0;
     r->handler_cb = NULL;
     r->handler_user = NULL;
 
+    r->threaded = 0;
+    r->thr_consumers = NULL;
+    r->thr_num_consumers = 0;
+    r->thr_queue = NULL;
+
+    r->merge_heap = NULL;
+    r->merge_held = 0;
+
+    r->dedup_ring = NULL;
+    r->dedup_table = NULL;
+
     return r;
 }
 
 void lorcon_multi_free(lorcon_multi_t *ctx, int free_interfaces) {
     lorcon_multi_interface_t *ib, *i = ctx->interfaces;
 
+    lorcon_multi_stop_threaded(ctx);
+
+    /* Discard anything still held by dedup or the merge */
+    ctx->handler_cb = NULL;
+    lorcon_multi_service(ctx, 1);
+    free(ctx->dedup_ring);
+    free(ctx->dedup_table);
+    free(ctx->merge_heap);
+    free(ctx->plan_weights);
+    free(ctx->plan_union);
+
     while (i) {
         ib = i->next;
 
+        lorcon_multi_plan_release(i);
+
         if (free_interfaces) 
             lorcon_free(i->lorcon_intf);
+        else if (i->prev_nonblock == 0)
+            lorcon_set_nonblock(i->lorcon_intf, 0);
 
         free(i);
 
         i = ib;
     }
 
+    lorcon_multi_control_close(ctx);
+    close(ctx->epoll_fd);
+
     free(ctx);
 }
 
 int lorcon_multi_add_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf) {
-    lorcon_multi_interface_t *i = 
-        (lorcon_multi_interface_t *) malloc(sizeof(lorcon_multi_interface_t));
+    struct epoll_event ev;
+    lorcon_multi_interface_t *i;
+    int fd = lorcon_get_selectable_fd(lorcon_intf);
+    int r;
+
+    if (lorcon_multi_control_defer(ctx, 1, lorcon_intf, 0, &r))
+        return r;
+
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                "Cannot add interfaces while threaded capture is running");
+        return -1;
+    }
+
+    if (fd < 0 || lorcon_intf->pcap == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                "%s has no selectable capture fd, is it open?",
+                lorcon_get_capiface(lorcon_intf));
+        return -1;
+    }
+
+    i = (lorcon_multi_interface_t *) malloc(sizeof(lorcon_multi_interface_t));
 
     if (i == NULL)  {
         snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
         return -1;
     }
 
-    i->next = ctx->interfaces;
     i->lorcon_intf = lorcon_intf;
+    i->error_handler = NULL;
+    i->error_aux = NULL;
+    i->fd = fd;
+    i->always_ready = 0;
+    i->st_packets = i->st_bytes = i->st_callback_ns = 0;
+    i->st_last_us = 0;
+    i->tx_packets = i->tx_bytes = i->tx_errors = i->tx_failovers = 0;
+    i->plan_supported = NULL;
+    i->plan_num_supported = 0;
+    i->plan_fetched = 0;
+    i->plan = NULL;
+    i->plan_len = 0;
+    i->plan_load = 0;
+    i->plan_channel = 0;
+    i->weight = 1;
+    i->deficit = 0;
+    i->drain_wakeups = i->drain_packets = i->drain_exhausted = 0;
+    i->drain_max = 0;
+    i->cpu = -1;
+    i->worker_started = 0;
+    i->thr_failed = 0;
+    i->thr_queued = i->thr_delivered = i->thr_dropped = 0;
+
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN;
+    ev.data.ptr = i;
+
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno != EPERM) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                    "Could not add %s to epoll set: %s",
+                    lorcon_get_capiface(lorcon_intf), strerror(errno));
+            free(i);
+            return -1;
+        }
+
+        /* Regular files can't be polled, but are always readable */
+        i->always_ready = 1;
+        ctx->num_always_ready++;
+    }
+
+    /* Interfaces are drained until they run dry, which needs reads that
+     * don't block */
+    i->prev_nonblock = lorcon_get_nonblock(lorcon_intf);
+
+    if (i->prev_nonblock == 0)
+        lorcon_set_nonblock(lorcon_intf, 1);
+
+    /* Not fatal; we'd only hear of its removal later */
+    if (ctx->events_fd >= 0)
+        lorcon_enable_events(lorcon_intf);
+
+    i->next = ctx->interfaces;
     ctx->interfaces = i;
+    ctx->num_interfaces++;
+
+    if (ctx->plan_cycle_ms != 0)
+        lorcon_multi_plan_rebalance(ctx);
+
     return 0;
 }
 
-void lorcon_multi_del_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+int lorcon_multi_del_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
         int free_interface) {
     lorcon_multi_interface_t *pi = NULL, *i = ctx->interfaces;
+    int e, r;
+
+    if (lorcon_multi_control_defer(ctx, 0, lorcon_intf, free_interface, &r))
+        return r;
+
+    /* Workers and queued packets hold pointers to their interface */
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                "Cannot remove interfaces while threaded capture is running");
+        return -1;
+    }
 
     while (i != NULL) {
         if (i->lorcon_intf == lorcon_intf) {
@@ -89,17 +237,40 @@ void lorcon_multi_del_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
             else
                 pi->next = i->next;
 
+            ctx->num_interfaces--;
+
+            if (i->always_ready)
+                ctx->num_always_ready--;
+            else
+                epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, i->fd, NULL);
+
+            /* Cancel any event for this interface still waiting to be
+             * handled by the loop */
+            for (e = 0; e < ctx->num_events; e++) {
+                if (ctx->events[e].data.ptr == i)
+                    ctx->events[e].data.ptr = NULL;
+            }
+
             if (free_interface)
                 lorcon_free(i->lorcon_intf);
+            else if (i->prev_nonblock == 0)
+                lorcon_set_nonblock(i->lorcon_intf, 0);
 
+            lorcon_multi_plan_release(i);
             free(i);
+
+            /* Hand its channels to the remaining radios */
+            if (ctx->plan_cycle_ms != 0)
+                lorcon_multi_plan_rebalance(ctx);
             
-            return;
+            return 0;
         }
 
         pi = i;
         i = i->next;
     }
+
+    return 0;
 }
 
 lorcon_multi_interface_t *lorcon_multi_get_interfaces(lorcon_multi_t *ctx) {
@@ -118,111 +289,311 @@ lorcon_t *lorcon_multi_interface_get_lorcon(lorcon_multi_interface_t *intf) {
     return intf->lorcon_intf;
 }
 
-int lorcon_multi_loop(lorcon_multi_t *ctx, int count, lorcon_handler callback,
-        u_char *user) {
-    int packets = 0;
-    fd_set rset;
-    int maxfd = 0;
-    int r;
-    lorcon_multi_interface_t *intf = NULL;
+/* Drop a failed interface from the group and tell the owner, who may add it
+ * back */
+void lorcon_multi_fail_interface(lorcon_multi_t *ctx, 
+        lorcon_multi_interface_t *intf, const char *why) {
+    lorcon_multi_error_handler handler = intf->error_handler;
+    void *aux = intf->error_aux;
+    lorcon_t *lorcon_intf = intf->lorcon_intf;
 
-    if (ctx->interfaces == NULL) {
-        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
-                "Cannot multi_loop with no interfaces");
+    fprintf(stderr, "Interface %s, removing from multicap: %s\n", why,
+            lorcon_get_capiface(lorcon_intf));
+
+    lorcon_multi_del_interface(ctx, lorcon_intf, 0);
+
+    if (handler != NULL)
+        (*handler)(ctx, lorcon_intf, aux);
+}
+
+void lorcon_multi_deliver(lorcon_multi_t *ctx, lorcon_packet_t *packet,
+        int persistent) {
+    if (ctx->dedup_ring != NULL)
+        lorcon_multi_dedup_push(ctx, packet, persistent);
+    else
+        lorcon_multi_merge_push(ctx, packet, persistent);
+}
+
+void lorcon_multi_service(lorcon_multi_t *ctx, int flush) {
+    /* Dedup feeds the merge, so it goes first */
+    lorcon_multi_dedup_release(ctx, flush);
+    lorcon_multi_merge_release(ctx, flush);
+
+    if (!flush)
+        lorcon_multi_stats_tick(ctx);
+}
+
+/* Sooner of two timeouts where -1 is none */
+static int lorcon_multi_min_timeout(int a, int b) {
+    if (a < 0)
+        return b;
+
+    if (b < 0 || a < b)
+        return a;
+
+    return b;
+}
+
+int lorcon_multi_service_timeout(lorcon_multi_t *ctx) {
+    return lorcon_multi_min_timeout(
+            lorcon_multi_min_timeout(lorcon_multi_dedup_timeout(ctx),
+                lorcon_multi_merge_timeout(ctx)),
+            lorcon_multi_stats_timeout(ctx));
+}
+
+void lorcon_multi_flush(lorcon_multi_t *ctx) {
+    lorcon_multi_service(ctx, 1);
+}
+
+/* Fail interfaces the event listener has seen removed */
+static void lorcon_multi_events_check(lorcon_multi_t *ctx) {
+    lorcon_multi_interface_t *intf;
+    int left = ctx->num_interfaces;
+
+    /* The handler may change the list, so start over after each; stop if
+     * it keeps adding removed interfaces back */
+    for (intf = ctx->interfaces; intf != NULL && left > 0; ) {
+        if (lorcon_get_removed(intf->lorcon_intf)) {
+            lorcon_multi_fail_interface(ctx, intf, "was removed");
+            intf = ctx->interfaces;
+            left--;
+            continue;
+        }
+
+        intf = intf->next;
+    }
+}
+
+int lorcon_multi_enable_events(lorcon_multi_t *ctx) {
+    struct epoll_event ev;
+    lorcon_multi_interface_t *intf;
+    int fd;
+
+    if (ctx->events_fd >= 0)
+        return 0;
+
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        if (lorcon_enable_events(intf->lorcon_intf) < 0) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "%s: %s",
+                    lorcon_get_capiface(intf->lorcon_intf),
+                    lorcon_get_error(intf->lorcon_intf));
+            return -1;
+        }
+    }
+
+    if ((fd = lorcon_events_get_fd()) < 0) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "nl80211 event listener is not running; add an interface first");
         return -1;
     }
 
-    while (packets < count || count <= 0) {
-        FD_ZERO(&rset);
-        maxfd = 0;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &(ctx->events_fd);
+
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Could not add nl80211 events to epoll set: %s", strerror(errno));
+        return -1;
+    }
 
-        while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
-            int fd = lorcon_get_selectable_fd(intf->lorcon_intf);
+    ctx->events_fd = fd;
 
-            if (fd < 0) {
-                lorcon_multi_del_interface(ctx, intf->lorcon_intf, 0);
+    return 0;
+}
 
-                if (intf->error_handler != NULL) {
-                    (*(intf->error_handler))(ctx, intf->lorcon_intf, intf->error_aux);
-                }
+static void lorcon_multi_loop_handler(lorcon_t *context, 
+        lorcon_packet_t *packet, u_char *user) {
+    lorcon_multi_t *ctx = (lorcon_multi_t *) user;
 
-                /* reset loop */
-                intf = NULL;
-                continue;
-            }
+    lorcon_multi_account(ctx->drain_intf, packet->length, &(packet->ts));
+    lorcon_multi_deliver(ctx, packet, 0);
+}
+
+/* Give an interface its turn: drain until it has no more packets or it has
+ * used its deficit.  limit caps the turn when the loop is nearly done.
+ * Returns the number of packets, or -1 if the interface failed */
+static int lorcon_multi_drain(lorcon_multi_t *ctx, 
+        lorcon_multi_interface_t *intf, int limit) {
+    int got = 0, want, r;
+
+    intf->deficit += ctx->budget * intf->weight;
+    intf->drain_wakeups++;
+
+    ctx->drain_intf = intf;
+
+    for (;;) {
+        want = intf->deficit - got;
+
+        if (limit > 0 && want > limit - got)
+            want = limit - got;
+
+        if (want <= 0)
+            break;
+
+        r = lorcon_dispatch(intf->lorcon_intf, want, lorcon_multi_loop_handler,
+                (u_char *) ctx);
+
+        /* Nothing from a capture file means the end of it */
+        if (r < 0 || (r == 0 && intf->always_ready && got == 0))
+            return -1;
 
-            FD_SET(fd, &rset);
+        if (r == 0)
+            break;
 
-            if (maxfd < fd)
-                maxfd = fd;
+        got += r;
 
+        /* Savefiles are read one at a time so others get a look in */
+        if (intf->always_ready)
+            break;
+    }
+
+    intf->drain_packets += got;
+
+    if ((unsigned int) got > intf->drain_max)
+        intf->drain_max = got;
+
+    if (got >= intf->deficit) {
+        /* Used the whole turn; there's probably more waiting */
+        intf->drain_exhausted++;
+        intf->deficit = 0;
+    } else if (limit > 0 && got >= limit) {
+        /* Cut short by the caller; keep the rest of the turn */
+        intf->deficit -= got;
+    } else {
+        /* Ran dry; unused credit doesn't carry over */
+        intf->deficit = 0;
+    }
+
+    return got;
+}
+
+static int lorcon_multi_loop_run(lorcon_multi_t *ctx, int count, 
+        lorcon_handler callback, u_char *user) {
+    int packets = 0;
+    int nev, e, r, timeout, brk = 0;
+    lorcon_multi_interface_t *intf = NULL, *next;
+
+    if (ctx->interfaces == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                "Cannot multi_loop with no interfaces");
+        return -1;
+    }
+
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, 
+                "Cannot multi_loop while threaded capture is running");
+        return -1;
+    }
+
+    ctx->handler_cb = callback;
+    ctx->handler_user = user;
+
+    while (packets < count || count <= 0) {
+        /* Whoever read the listener, removals are flagged on the contexts;
+         * run any handlers a read inside another lorcon call held back */
+        if (ctx->events_fd >= 0) {
+            if (lorcon_events_deferred_pending())
+                lorcon_events_service();
+
+            lorcon_multi_events_check(ctx);
         }
 
-        if (maxfd == 0) {
+        if (ctx->num_interfaces == 0) {
             fprintf(stderr, "lorcon_multi_loop no interfaces with packets left\n");
             return 0;
         }
 
-        /* Blocking select */
-        if (select(maxfd + 1, &rset, NULL, NULL, NULL) < 0) {
-            if (errno != EINTR && errno != EAGAIN) {
-                snprintf(ctx->errstr, LORCON_STATUS_MAX,
-                        "select fail: %s", strerror(errno));
-                return -1;
-            }
+        /* Don't block while there are unpollable sources to read, or past
+         * the time a held packet has to be released */
+        if (ctx->num_always_ready)
+            timeout = 0;
+        else
+            timeout = lorcon_multi_service_timeout(ctx);
+
+        nev = epoll_wait(ctx->epoll_fd, ctx->events, LORCON_MULTI_MAX_EVENTS, 
+                timeout);
+
+        if (nev < 0) {
+            if (errno == EINTR)
+                continue;
+
+            snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                    "epoll_wait fail: %s", strerror(errno));
+            return -1;
         }
 
-        intf = NULL;
-        while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
-            int fd = lorcon_get_selectable_fd(intf->lorcon_intf);
+        ctx->num_events = nev;
 
-            if (fd < 0) {
-                lorcon_multi_del_interface(ctx, intf->lorcon_intf, 0);
+        for (e = 0; e < ctx->num_events; e++) {
+            if (ctx->events[e].data.ptr == &(ctx->control_fd)) {
+                if (lorcon_multi_control_service(ctx))
+                    brk = 1;
+                continue;
+            }
 
-                if (intf->error_handler != NULL) {
-                    (*(intf->error_handler))(ctx, intf->lorcon_intf, intf->error_aux);
-                }
+            if (ctx->events[e].data.ptr == &(ctx->events_fd)) {
+                lorcon_events_service();
+                lorcon_multi_events_check(ctx);
+                continue;
+            }
 
-                /* reset loop */
-                intf = NULL;
+            /* Removed while handling an earlier event */
+            if ((intf = (lorcon_multi_interface_t *) ctx->events[e].data.ptr) == NULL)
+                continue;
+
+            r = lorcon_multi_drain(ctx, intf, count > 0 ? count - packets : 0);
 
+            if (r < 0) {
+                lorcon_multi_fail_interface(ctx, intf, "stopped reporting packets");
                 continue;
             }
 
-            if (FD_ISSET(fd, &rset)) {
-                r = lorcon_dispatch(intf->lorcon_intf, 1, callback, user);
+            packets += r;
+        }
 
-                if (r <= 0) {
-                    /*
-                    snprintf(ctx->errstr, LORCON_STATUS_MAX,
-                            "%s failed dispatch",
-                            lorcon_get_capiface(intf->lorcon_intf));
-                    return -1; 
-                    */
+        ctx->num_events = 0;
 
-                    fprintf(stderr, "Interface stopped reporting packets, removing "
-                            "from multicap: %s\n", 
-                            lorcon_get_capiface(intf->lorcon_intf));
-                    lorcon_multi_del_interface(ctx, intf->lorcon_intf, 0);
+        lorcon_multi_service(ctx, 0);
 
-                    if (intf->error_handler != NULL) {
-                        (*(intf->error_handler))(ctx, intf->lorcon_intf, intf->error_aux);
-                    }
+        if (brk)
+            return -2;
 
-                    /* reset loop */
-                    intf = NULL;
-                    continue;
-                }
+        if (ctx->num_always_ready == 0)
+            continue;
 
-                packets++;
+        for (intf = ctx->interfaces; intf != NULL; intf = next) {
+            next = intf->next;
+
+            if (!intf->always_ready)
+                continue;
+
+            r = lorcon_multi_drain(ctx, intf, count > 0 ? count - packets : 0);
+
+            if (r < 0) {
+                lorcon_multi_fail_interface(ctx, intf, "stopped reporting packets");
+                /* The handler may have changed the list */
+                break;
             }
-        }
 
+            packets += r;
+        }
     }
 
     return packets;
 }
 
+int lorcon_multi_loop(lorcon_multi_t *ctx, int count, lorcon_handler callback,
+        u_char *user) {
+    int r;
+
+    lorcon_multi_control_enter(ctx);
+    r = lorcon_multi_loop_run(ctx, count, callback, user);
+    lorcon_multi_control_exit(ctx);
+
+    return r;
+}
+
 void lorcon_multi_set_interface_error_handler(lorcon_multi_t *ctx,
         lorcon_t *lorcon_interface, lorcon_multi_error_handler handler, 
         void *aux) {
@@ -251,3 +622,133 @@ void lorcon_multi_remove_interface_error_handler(lorcon_multi_t *ctx,
 }
 
 
+void lorcon_multi_set_budget(lorcon_multi_t *ctx, unsigned int budget) {
+    if (budget == 0)
+        budget = 1;
+
+    ctx->budget = budget;
+}
+
+int lorcon_multi_set_interface_weight(lorcon_multi_t *ctx, 
+        lorcon_t *lorcon_interface, unsigned int weight) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_interface) {
+            intf->weight = weight > 0 ? weight : 1;
+            return 0;
+        }
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
+lorcon_multi_interface_t *lorcon_multi_find_interface(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_intf) {
+    lorcon_multi_interface_t *intf;
+
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        if (intf->lorcon_intf == lorcon_intf)
+            return intf;
+    }
+
+    return NULL;
+}
+
+int lorcon_multi_get_drain_stats(lorcon_multi_t *ctx, 
+        lorcon_t *lorcon_interface, lorcon_multi_drain_stats_t *stats) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_interface) {
+            stats->wakeups = intf->drain_wakeups;
+            stats->packets = intf->drain_packets;
+            stats->exhausted = intf->drain_exhausted;
+            stats->max_per_wakeup = intf->drain_max;
+            return 0;
+        }
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
+
+int lorcon_multi_get_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_interface,
+        lorcon_multi_stats_t *stats) {
+    lorcon_multi_interface_t *intf;
+    struct pcap_stat ps;
+
+    if ((intf = lorcon_multi_find_interface(ctx, lorcon_interface)) == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+        return -1;
+    }
+
+    stats->packets = __atomic_load_n(&intf->st_packets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&intf->st_bytes, __ATOMIC_RELAXED);
+    stats->callback_us =
+        __atomic_load_n(&intf->st_callback_ns, __ATOMIC_RELAXED) / 1000;
+    stats->last_packet_us = __atomic_load_n(&intf->st_last_us, __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&intf->drain_wakeups, __ATOMIC_RELAXED);
+
+    /* Savefiles and some capture types can't report drops */
+    memset(&ps, 0, sizeof(struct pcap_stat));
+
+    if (pcap_stats(intf->lorcon_intf->pcap, &ps) < 0)
+        memset(&ps, 0, sizeof(struct pcap_stat));
+
+    stats->kernel_drops = ps.ps_drop;
+    stats->interface_drops = ps.ps_ifdrop;
+
+    return 0;
+}
+
+void lorcon_multi_set_stats_callback(lorcon_multi_t *ctx,
+        unsigned int interval_ms, lorcon_multi_stats_handler handler,
+        void *aux) {
+    ctx->stats_cb = handler;
+    ctx->stats_aux = aux;
+    ctx->stats_interval_us = (int64_t) interval_ms * 1000;
+    ctx->stats_due_us = lorcon_multi_mono_us() + ctx->stats_interval_us;
+
+    /* A loop already waiting needs to know about the new deadline */
+    lorcon_multi_control_post(ctx, 0);
+}
+
+void lorcon_multi_stats_tick(lorcon_multi_t *ctx) {
+    int64_t due, now;
+
+    if (ctx->stats_cb == NULL || ctx->stats_interval_us == 0)
+        return;
+
+    due = __atomic_load_n(&ctx->stats_due_us, __ATOMIC_RELAXED);
+    now = lorcon_multi_mono_us();
+
+    if (now < due)
+        return;
+
+    /* With several consumers only the one which moves the deadline on
+     * makes the call */
+    if (!__atomic_compare_exchange_n(&ctx->stats_due_us, &due,
+                now + ctx->stats_interval_us, 0, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+        return;
+
+    (*(ctx->stats_cb))(ctx, ctx->stats_aux);
+}
+
+int lorcon_multi_stats_timeout(lorcon_multi_t *ctx) {
+    int64_t due;
+
+    if (ctx->stats_cb == NULL || ctx->stats_interval_us == 0)
+        return -1;
+
+    due = __atomic_load_n(&ctx->stats_due_us, __ATOMIC_RELAXED) -
+        lorcon_multi_mono_us();
+
+    if (due <= 0)
+        return 0;
+
+    return (int) ((due + 999) / 1000);
+}
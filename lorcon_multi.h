@@ -19,12 +19,16 @@
 
 /* LORCON MULTI
  *
- * LM allows simultaneous sniffing on multiple interfaces.  Currently the
- * only supported mechanism for processing packets is lorcon_multi_loop()
- * which operates in the same fashion as pcap_loop().
+ * LM allows simultaneous sniffing on multiple interfaces.  Packets can be
+ * processed with lorcon_multi_loop(), which operates in the same fashion as
+ * pcap_loop(), or with threaded capture (lorcon_multi_start_threaded()).
+ * Packets can also be injected through the group, spread over the
+ * interfaces in it (lorcon_multi_inject()).
  *
  * LM currently only functions on interfaces which present a pollable 
- * file descriptor.
+ * file descriptor.  Interfaces are registered with a persistent epoll set
+ * when they are added, so each wakeup only touches the interfaces which
+ * have packets waiting.
  */
 
 #ifndef __LORCON_MULTI_H__
@@ -53,10 +57,12 @@ lorcon_multi_t *lorcon_multi_create();
 /* Destroy a multi-context, and optionally shut down any interfaces used in it */
 void lorcon_multi_free(lorcon_multi_t *ctx, int free_interfaces);
 
-/* Add an existing lorcon interface to a multi.  0 on success, negative on failure */
+/* Add an existing lorcon interface to a multi.  The interface must already
+ * be open for capture.  0 on success, negative on failure */
 int lorcon_multi_add_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf);
-/* Remove an interface from a multi */
-void lorcon_multi_del_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+/* Remove an interface from a multi.  Fails, leaving the interface in the
+ * group and unfreed, while threaded capture is running */
+int lorcon_multi_del_interface(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
         int free_interface);
 /* Iterate interfaces */
 lorcon_multi_interface_t *lorcon_multi_get_interfaces(lorcon_multi_t *ctx);
@@ -67,6 +73,9 @@ lorcon_t *lorcon_multi_interface_get_lorcon(lorcon_multi_interface_t *intf);
 /* Callback for interface failure.  On failure, interfaces are removed from the
  * multi group, but may be re-added by this callback. 
  * If there are no interfaces left at the next loop, lorcon_loop will exit.
+ * With threaded capture the interface is failed when capture is stopped,
+ * and the callback runs on the stopping thread once it has left the group
+ * and its queued packets have been delivered.
  */
 typedef void (*lorcon_multi_error_handler)(lorcon_multi_t *ctx, 
         lorcon_t *lorcon_interface, void *aux);
@@ -76,8 +85,311 @@ void lorcon_multi_set_interface_error_handler(lorcon_multi_t *ctx,
 void lorcon_multi_remove_interface_error_handler(lorcon_multi_t *ctx, 
         lorcon_t *lorcon_interface);
 
-/* Enter a blocking capture loop for `count' packets */
+/* Enter a blocking capture loop for `count' packets.  Returns -2 if
+ * stopped by lorcon_multi_breakloop() */
 int lorcon_multi_loop(lorcon_multi_t *ctx, int count, lorcon_handler callback,
         unsigned char *user);
 
+/* Control channel
+ *
+ * lorcon_multi_loop always waits on a control eventfd as well as the
+ * interfaces, so other threads can act on it without waiting for a frame:
+ * lorcon_multi_breakloop() makes it return, and lorcon_multi_wakeup() runs
+ * the wakeup handler on the loop thread.  Adding or removing an interface
+ * from another thread while the loop runs is handed to the loop thread;
+ * the call returns once the change has been made.
+ */
+typedef void (*lorcon_multi_wakeup_handler)(lorcon_multi_t *ctx, void *aux);
+
+void lorcon_multi_breakloop(lorcon_multi_t *ctx);
+void lorcon_multi_wakeup(lorcon_multi_t *ctx);
+void lorcon_multi_set_wakeup_handler(lorcon_multi_t *ctx,
+        lorcon_multi_wakeup_handler handler, void *aux);
+
+/* nl80211 events
+ *
+ * Register every interface, current and future, with the nl80211 event
+ * listener (see lorcon_enable_events) and wait on its fd in the loop.  An
+ * interface whose VAP or radio is removed is failed through its error
+ * handler as soon as the kernel says so, instead of when its capture
+ * stops.  The listener is shared by the process and anything may read
+ * it first (another group, or lorcon_get_channel on a registered
+ * interface), so the loop looks for removed interfaces every time it
+ * wakes rather than only when the listener fd is readable.
+ */
+int lorcon_multi_enable_events(lorcon_multi_t *ctx);
+
+/* Fair draining
+ *
+ * Each time an interface has packets waiting, lorcon_multi_loop drains up
+ * to budget * weight packets from it (or until it has none left) before
+ * moving on, so busy interfaces need fewer wakeups but can't starve quiet
+ * ones.  The default budget is 64 and the default weight is 1.
+ *
+ * Interfaces in a multi are switched to non-blocking capture; the previous
+ * mode is restored when they are removed.
+ */
+void lorcon_multi_set_budget(lorcon_multi_t *ctx, unsigned int budget);
+int lorcon_multi_set_interface_weight(lorcon_multi_t *ctx, 
+        lorcon_t *lorcon_interface, unsigned int weight);
+
+typedef struct lorcon_multi_drain_stats {
+    /* Turns the interface was given, packets drained, and turns which
+     * ended with the budget used up rather than the interface empty */
+    uint64_t wakeups;
+    uint64_t packets;
+    uint64_t exhausted;
+
+    /* Most packets drained in one turn */
+    unsigned int max_per_wakeup;
+} lorcon_multi_drain_stats_t;
+
+int lorcon_multi_get_drain_stats(lorcon_multi_t *ctx, 
+        lorcon_t *lorcon_interface, lorcon_multi_drain_stats_t *stats);
+
+/* Capture health
+ *
+ * Per-interface counters of packets and bytes captured, packets dropped
+ * before lorcon saw them (pcap_stats() ps_drop and ps_ifdrop; 0 where the
+ * source can't report them), time spent in the packet callback and the
+ * timestamp of the latest packet.  Drops climbing while callback time
+ * grows points to a saturated consumer; drops with idle callbacks to a
+ * radio the loop isn't draining fast enough.
+ *
+ * A stats handler, if set, is called every interval_ms from the loop (or
+ * a threaded consumer), where it can read the counters and work out rates
+ * from the change since the last call.  An interval of 0 stops it.
+ */
+typedef struct lorcon_multi_stats {
+    uint64_t packets;
+    uint64_t bytes;
+
+    uint64_t kernel_drops;
+    uint64_t interface_drops;
+
+    uint64_t callback_us;
+
+    /* Capture time of the latest packet, microseconds since the epoch; 0
+     * before the first */
+    int64_t last_packet_us;
+
+    /* Times the interface was woken to read packets */
+    uint64_t wakeups;
+} lorcon_multi_stats_t;
+
+int lorcon_multi_get_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_interface,
+        lorcon_multi_stats_t *stats);
+
+typedef void (*lorcon_multi_stats_handler)(lorcon_multi_t *ctx, void *aux);
+
+void lorcon_multi_set_stats_callback(lorcon_multi_t *ctx,
+        unsigned int interval_ms, lorcon_multi_stats_handler handler,
+        void *aux);
+
+/* Duplicate suppression
+ *
+ * Interfaces on overlapping channels see the same frame.  With dedup
+ * enabled, frames are keyed on transmitter, receiver, frame control,
+ * sequence, length and CRC, and remembered for window_us in a fixed table
+ * of max_entries (0 selects a default; the oldest entry is dropped early
+ * when it is full).
+ *
+ * LORCON_MULTI_DEDUP_FIRST delivers the first copy at once and discards
+ * the rest; since it goes out before any other copy arrives, its
+ * packet->receivers lists only the interface it came from.
+ * LORCON_MULTI_DEDUP_BEST holds the frame for the window and delivers the
+ * copy with the strongest signal, with every interface which received it
+ * in packet->receivers.
+ *
+ * A window of 0 disables dedup.  Dedup runs before the timestamp merge.
+ */
+#define LORCON_MULTI_DEDUP_FIRST        0
+#define LORCON_MULTI_DEDUP_BEST         1
+
+int lorcon_multi_set_dedup(lorcon_multi_t *ctx, int mode,
+        unsigned int window_us, unsigned int max_entries);
+
+typedef struct lorcon_multi_dedup_stats {
+    uint64_t unique;
+    uint64_t duplicates;
+    uint64_t forced;
+} lorcon_multi_dedup_stats_t;
+
+void lorcon_multi_get_dedup_stats(lorcon_multi_t *ctx,
+        lorcon_multi_dedup_stats_t *stats);
+
+/* Deliver every packet held by dedup and the merge now */
+void lorcon_multi_flush(lorcon_multi_t *ctx);
+
+/* Timestamp ordered merge
+ *
+ * Packets from different interfaces reach the callback in the order the
+ * interfaces are serviced.  With merging enabled, packets are held in a
+ * heap for up to window_us and delivered in capture timestamp order.  A
+ * packet is released once a packet window_us newer has been captured, or
+ * once it has been held for window_us.
+ *
+ * Packets arriving older than one already delivered can't be put in order;
+ * they are delivered immediately and counted as late.  If max_held packets
+ * are waiting (0 selects a default), the oldest is released early and
+ * counted as forced.
+ *
+ * A window of 0 disables merging.  Held packets are delivered when merging
+ * is changed or disabled, by lorcon_multi_merge_flush(), and by the loop as
+ * they fall due; packets still held when the context is freed are
+ * discarded.  Threaded capture supports merging (and dedup) with a single
+ * consumer.
+ */
+int lorcon_multi_set_merge(lorcon_multi_t *ctx, unsigned int window_us,
+        unsigned int max_held);
+
+/* Deliver every held packet now */
+void lorcon_multi_merge_flush(lorcon_multi_t *ctx);
+
+typedef struct lorcon_multi_merge_stats {
+    uint64_t delivered;
+    uint64_t late;
+    uint64_t forced;
+    unsigned int held;
+} lorcon_multi_merge_stats_t;
+
+void lorcon_multi_get_merge_stats(lorcon_multi_t *ctx,
+        lorcon_multi_merge_stats_t *stats);
+
+/* Threaded capture
+ *
+ * Runs a capture thread per interface, each feeding a shared lock-free
+ * queue, and num_consumers threads which drain the queue and call
+ * callback.  Packets are copied out of the capture buffer and, as with
+ * lorcon_loop, the callback owns each packet and must free it.  With more
+ * than one consumer the callback is called concurrently.
+ *
+ * queue_len is rounded up to a power of two; 0 selects the default.  When
+ * the queue is full new packets are dropped and counted against the
+ * interface which captured them.
+ *
+ * Interfaces can't be added or removed while threaded capture is running.
+ * Calling lorcon_breakloop() on an interface ends its capture thread only;
+ * a capture error or the end of a savefile also ends it, and the
+ * interface is failed through its error handler when capture is stopped.
+ */
+int lorcon_multi_start_threaded(lorcon_multi_t *ctx, int num_consumers,
+        int queue_len, lorcon_handler callback, unsigned char *user);
+
+/* Stop all capture threads, deliver whatever is still queued, and join the
+ * consumers.  Must not be called from the packet callback */
+void lorcon_multi_stop_threaded(lorcon_multi_t *ctx);
+
+/* Pin the capture thread of an interface to a CPU (-1, the default, leaves
+ * it unpinned).  Takes effect at the next lorcon_multi_start_threaded */
+int lorcon_multi_set_interface_cpu(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+        int cpu);
+
+typedef struct lorcon_multi_queue_stats {
+    /* Packets queued, delivered to the callback, and dropped on a full
+     * queue since threaded capture started */
+    uint64_t queued;
+    uint64_t delivered;
+    uint64_t dropped;
+
+    /* Packets currently waiting in the queue */
+    uint64_t depth;
+} lorcon_multi_queue_stats_t;
+
+int lorcon_multi_get_queue_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+        lorcon_multi_queue_stats_t *stats);
+
+/* Channel coverage planning
+ *
+ * Splits the channels the radios in the group can tune between them, so
+ * no two radios spend time on the same channel.  Each radio is given a
+ * hop schedule lasting cycle_ms, in which each of its channels gets a
+ * dwell proportional to the channel weight (default 1; 0 leaves the
+ * channel out).  Channels which only some radios support are placed
+ * first, then the rest go to the least loaded radio.  A radio with a
+ * single channel simply stays there; radios left without channels are
+ * free for other use.
+ *
+ * Supported channels come from nl80211, or can be given per interface
+ * for drivers which can't report them.  Once planning is on, the plan is
+ * recomputed whenever an interface is added or removed or a weight or
+ * channel list changes.  A cycle of 0 turns planning off.
+ *
+ * The plan doesn't hop by itself; lorcon_multi_plan_tune() sets every
+ * radio to the channel its schedule calls for elapsed_ms into the plan,
+ * and only touches radios whose channel changes.
+ */
+typedef struct lorcon_multi_plan_entry {
+    int channel;
+    unsigned int dwell_ms;
+} lorcon_multi_plan_entry_t;
+
+typedef struct lorcon_multi_coverage {
+    int channel;
+    unsigned int weight;
+
+    /* Radio covering the channel, or NULL, and the fraction of each cycle
+     * it spends there */
+    lorcon_t *interface;
+    double duty_cycle;
+} lorcon_multi_coverage_t;
+
+int lorcon_multi_plan_channels(lorcon_multi_t *ctx, unsigned int cycle_ms);
+int lorcon_multi_set_channel_weight(lorcon_multi_t *ctx, int channel,
+        unsigned int weight);
+
+/* Override the channels an interface supports; an empty list goes back to
+ * asking nl80211 */
+int lorcon_multi_set_interface_channels(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_interface, const int *channels, int num_channels);
+
+/* Copy up to max_entries of the schedule of an interface, in channel
+ * order.  Returns the length of the schedule */
+int lorcon_multi_get_interface_plan(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_interface, lorcon_multi_plan_entry_t *entries,
+        int max_entries);
+
+/* Copy up to max_entries of the coverage of every channel any radio
+ * supports, in channel order.  Returns the number of channels */
+int lorcon_multi_get_coverage(lorcon_multi_t *ctx,
+        lorcon_multi_coverage_t *coverage, int max_entries);
+
+int lorcon_multi_plan_tune(lorcon_multi_t *ctx, uint64_t elapsed_ms);
+
+/* Load balanced injection
+ *
+ * Sends a packet on one interface of the group, chosen by policy:
+ *
+ * LORCON_MULTI_TX_ROUNDROBIN rotates through the interfaces.
+ * LORCON_MULTI_TX_LEASTQUEUE picks the interface with the fewest bytes
+ * waiting in its kernel send queue; interfaces which can't report a queue
+ * depth count as empty.
+ * LORCON_MULTI_TX_CHANNEL only considers interfaces currently tuned to
+ * packet->channel, in round-robin order.  A packet without a channel is
+ * sent round-robin.
+ *
+ * If the injection fails, the next candidate is tried, until one succeeds
+ * or all have failed.  Returns the injected length, or negative on failure
+ * with the last error in lorcon_multi_get_error().  Must not race with
+ * adding or removing interfaces.
+ */
+#define LORCON_MULTI_TX_ROUNDROBIN      0
+#define LORCON_MULTI_TX_LEASTQUEUE      1
+#define LORCON_MULTI_TX_CHANNEL         2
+
+int lorcon_multi_inject(lorcon_multi_t *ctx, struct lorcon_packet *packet,
+        int policy);
+
+typedef struct lorcon_multi_tx_stats {
+    /* Packets and bytes sent, failed injections, and packets sent after
+     * an earlier candidate failed */
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t failovers;
+} lorcon_multi_tx_stats_t;
+
+int lorcon_multi_get_tx_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_interface,
+        lorcon_multi_tx_stats_t *stats);
+
 #endif
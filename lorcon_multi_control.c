@@ -0,0 +1,203 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+
+int lorcon_multi_control_open(lorcon_multi_t *ctx) {
+    struct epoll_event ev;
+
+    ctx->control_pending = 0;
+    ctx->wakeup_cb = NULL;
+    ctx->wakeup_aux = NULL;
+    ctx->control_ops = NULL;
+    ctx->loop_running = 0;
+
+    if ((ctx->control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return -1;
+
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &(ctx->control_fd);
+
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->control_fd, &ev) < 0) {
+        close(ctx->control_fd);
+        return -1;
+    }
+
+    pthread_mutex_init(&(ctx->control_lock), NULL);
+    pthread_cond_init(&(ctx->control_cond), NULL);
+
+    return 0;
+}
+
+void lorcon_multi_control_close(lorcon_multi_t *ctx) {
+    close(ctx->control_fd);
+
+    pthread_mutex_destroy(&(ctx->control_lock));
+    pthread_cond_destroy(&(ctx->control_cond));
+}
+
+void lorcon_multi_control_post(lorcon_multi_t *ctx, unsigned int events) {
+    uint64_t one = 1;
+
+    __atomic_or_fetch(&ctx->control_pending, events, __ATOMIC_SEQ_CST);
+
+    if (write(ctx->control_fd, &one, sizeof(uint64_t)) < 0)
+        return;
+}
+
+/* Make every queued interface change and wake the threads waiting on them.
+ * Returns the number made */
+static int lorcon_multi_control_run_ops(lorcon_multi_t *ctx) {
+    struct lorcon_multi_control_op *op, *next;
+    int ret, n = 0;
+
+    pthread_mutex_lock(&(ctx->control_lock));
+    op = ctx->control_ops;
+    ctx->control_ops = NULL;
+    pthread_mutex_unlock(&(ctx->control_lock));
+
+    for (; op != NULL; op = next) {
+        next = op->next;
+
+        /* We're the loop thread, so these apply directly */
+        if (op->add) {
+            ret = lorcon_multi_add_interface(ctx, op->lorcon_intf);
+        } else {
+            ret = lorcon_multi_del_interface(ctx, op->lorcon_intf,
+                    op->free_interface);
+        }
+
+        /* The op belongs to the waiting thread once done is set */
+        pthread_mutex_lock(&(ctx->control_lock));
+        op->ret = ret;
+        op->done = 1;
+        pthread_cond_broadcast(&(ctx->control_cond));
+        pthread_mutex_unlock(&(ctx->control_lock));
+
+        n++;
+    }
+
+    return n;
+}
+
+void lorcon_multi_control_enter(lorcon_multi_t *ctx) {
+    pthread_mutex_lock(&(ctx->control_lock));
+    ctx->loop_running = 1;
+    ctx->loop_thread = pthread_self();
+    pthread_mutex_unlock(&(ctx->control_lock));
+}
+
+void lorcon_multi_control_exit(lorcon_multi_t *ctx) {
+    /* Stay the owner until nothing is left queued, so no change is made
+     * from two threads at once */
+    for (;;) {
+        pthread_mutex_lock(&(ctx->control_lock));
+
+        if (ctx->control_ops == NULL) {
+            ctx->loop_running = 0;
+            pthread_mutex_unlock(&(ctx->control_lock));
+            return;
+        }
+
+        pthread_mutex_unlock(&(ctx->control_lock));
+
+        lorcon_multi_control_run_ops(ctx);
+    }
+}
+
+int lorcon_multi_control_defer(lorcon_multi_t *ctx, int add,
+        lorcon_t *lorcon_intf, int free_interface, int *ret) {
+    struct lorcon_multi_control_op op;
+
+    pthread_mutex_lock(&(ctx->control_lock));
+
+    if (!ctx->loop_running || pthread_equal(ctx->loop_thread, pthread_self())) {
+        pthread_mutex_unlock(&(ctx->control_lock));
+        return 0;
+    }
+
+    op.add = add;
+    op.lorcon_intf = lorcon_intf;
+    op.free_interface = free_interface;
+    op.ret = 0;
+    op.done = 0;
+    op.next = ctx->control_ops;
+    ctx->control_ops = &op;
+
+    lorcon_multi_control_post(ctx, LORCON_MULTI_CONTROL_OPS);
+
+    while (!op.done)
+        pthread_cond_wait(&(ctx->control_cond), &(ctx->control_lock));
+
+    pthread_mutex_unlock(&(ctx->control_lock));
+
+    *ret = op.ret;
+
+    return 1;
+}
+
+int lorcon_multi_control_service(lorcon_multi_t *ctx) {
+    uint64_t v;
+    unsigned int events;
+
+    if (read(ctx->control_fd, &v, sizeof(uint64_t)) < 0)
+        v = 0;
+
+    events = __atomic_exchange_n(&ctx->control_pending, 0, __ATOMIC_SEQ_CST);
+
+    if (events & LORCON_MULTI_CONTROL_OPS)
+        lorcon_multi_control_run_ops(ctx);
+
+    if ((events & LORCON_CONTROL_WAKEUP) && ctx->wakeup_cb != NULL)
+        (*(ctx->wakeup_cb))(ctx, ctx->wakeup_aux);
+
+    return (events & LORCON_CONTROL_BREAK) != 0;
+}
+
+void lorcon_multi_breakloop(lorcon_multi_t *ctx) {
+    lorcon_multi_control_post(ctx, LORCON_CONTROL_BREAK);
+}
+
+void lorcon_multi_wakeup(lorcon_multi_t *ctx) {
+    lorcon_multi_control_post(ctx, LORCON_CONTROL_WAKEUP);
+}
+
+void lorcon_multi_set_wakeup_handler(lorcon_multi_t *ctx,
+        lorcon_multi_wakeup_handler handler, void *aux) {
+    ctx->wakeup_cb = handler;
+    ctx->wakeup_aux = aux;
+}
+
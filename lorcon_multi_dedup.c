@@ -0,0 +1,326 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_packet.h"
+#include "lorcon_crc32.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+
+#define LORCON_MULTI_DEFAULT_DEDUP      4096
+
+/* Key a frame on its transmitter, receiver, frame control, sequence
+ * control, length and a CRC of the whole frame.  When the capture kept the
+ * FCS it is that CRC already, so it is used instead of computing one */
+static uint64_t lorcon_multi_dedup_key(lorcon_packet_t *packet) {
+    const u_char *frame = packet->packet_header;
+    uint64_t key;
+    uint32_t crc;
+    int len = packet->length_header;
+    int x;
+
+    if (frame == NULL) {
+        frame = packet->packet_raw;
+        len = packet->length;
+    }
+
+    if (packet->fcs_present && !packet->fcs_bad) {
+        crc = (uint32_t) frame[len] | ((uint32_t) frame[len + 1] << 8) |
+            ((uint32_t) frame[len + 2] << 16) | ((uint32_t) frame[len + 3] << 24);
+    } else {
+        crc = lorcon_crc32(frame, len);
+    }
+
+    key = ((uint64_t) crc << 32) | (uint32_t) len;
+
+    /* Mix in FC, addr1, addr2 and sequence control */
+    for (x = 0; x < 16 && x < len; x++)
+        key = (key ^ frame[x]) * 0x100000001B3ULL;
+
+    if (len >= 24)
+        key = (key ^ frame[22] ^ ((uint64_t) frame[23] << 8)) * 0x100000001B3ULL;
+
+    /* Fold the high half down so the low bits used for the table index
+     * see everything */
+    return key ^ (key >> 29);
+}
+
+static uint64_t *lorcon_multi_dedup_find(lorcon_multi_t *ctx, uint64_t key) {
+    unsigned int slot = (unsigned int) key & ctx->dedup_table_mask;
+    uint64_t v;
+
+    while ((v = ctx->dedup_table[slot]) != 0) {
+        if (ctx->dedup_ring[(v - 1) & ctx->dedup_ring_mask].key == key)
+            return &(ctx->dedup_table[slot]);
+
+        slot = (slot + 1) & ctx->dedup_table_mask;
+    }
+
+    return NULL;
+}
+
+/* Linear probing delete with backward shift, so lookups never have to step
+ * over tombstones */
+static void lorcon_multi_dedup_unlink(lorcon_multi_t *ctx, uint64_t *entry) {
+    unsigned int hole = (unsigned int) (entry - ctx->dedup_table);
+    unsigned int slot = hole, home;
+    uint64_t v;
+
+    for (;;) {
+        slot = (slot + 1) & ctx->dedup_table_mask;
+
+        if ((v = ctx->dedup_table[slot]) == 0)
+            break;
+
+        home = (unsigned int) ctx->dedup_ring[(v - 1) & ctx->dedup_ring_mask].key &
+            ctx->dedup_table_mask;
+
+        /* Move it back if the hole lies between its home and where it is */
+        if (((slot - home) & ctx->dedup_table_mask) >=
+                ((slot - hole) & ctx->dedup_table_mask)) {
+            ctx->dedup_table[hole] = v;
+            hole = slot;
+        }
+    }
+
+    ctx->dedup_table[hole] = 0;
+}
+
+/* Forget the oldest entry, passing on its packet if one is held */
+static void lorcon_multi_dedup_expire(lorcon_multi_t *ctx) {
+    struct lorcon_multi_dedup_entry *e =
+        &(ctx->dedup_ring[ctx->dedup_tail & ctx->dedup_ring_mask]);
+    uint64_t *slot;
+    lorcon_packet_t *packet = e->packet;
+
+    if ((slot = lorcon_multi_dedup_find(ctx, e->key)) != NULL &&
+            *slot == ctx->dedup_tail + 1)
+        lorcon_multi_dedup_unlink(ctx, slot);
+
+    e->packet = NULL;
+    ctx->dedup_tail++;
+
+    if (packet != NULL)
+        lorcon_multi_merge_push(ctx, packet, 1);
+}
+
+void lorcon_multi_dedup_release(lorcon_multi_t *ctx, int flush) {
+    int64_t now;
+
+    if (ctx->dedup_ring == NULL || ctx->dedup_head == ctx->dedup_tail)
+        return;
+
+    now = lorcon_multi_mono_us();
+
+    while (ctx->dedup_head != ctx->dedup_tail) {
+        if (!flush &&
+                ctx->dedup_ring[ctx->dedup_tail & ctx->dedup_ring_mask].arrival_us +
+                ctx->dedup_window_us > now)
+            break;
+
+        lorcon_multi_dedup_expire(ctx);
+    }
+}
+
+int lorcon_multi_dedup_timeout(lorcon_multi_t *ctx) {
+    int64_t due;
+
+    /* Only held copies need a timely release */
+    if (ctx->dedup_ring == NULL || ctx->dedup_mode != LORCON_MULTI_DEDUP_BEST ||
+            ctx->dedup_head == ctx->dedup_tail)
+        return -1;
+
+    due = ctx->dedup_ring[ctx->dedup_tail & ctx->dedup_ring_mask].arrival_us +
+        ctx->dedup_window_us - lorcon_multi_mono_us();
+
+    if (due <= 0)
+        return 0;
+
+    return (int) ((due + 999) / 1000);
+}
+
+static void lorcon_multi_dedup_add_receiver(lorcon_packet_t *packet,
+        struct lorcon *intf) {
+    int x;
+
+    for (x = 0; x < packet->num_receivers; x++) {
+        if (packet->receivers[x] == intf)
+            return;
+    }
+
+    if (packet->num_receivers < LORCON_PACKET_MAX_RECEIVERS)
+        packet->receivers[packet->num_receivers++] = intf;
+}
+
+void lorcon_multi_dedup_push(lorcon_multi_t *ctx, lorcon_packet_t *packet,
+        int persistent) {
+    struct lorcon_multi_dedup_entry *e;
+    lorcon_packet_t *held, *copy;
+    uint64_t key, *slot;
+    unsigned int s;
+
+    lorcon_multi_dedup_release(ctx, 0);
+
+    key = lorcon_multi_dedup_key(packet);
+
+    if ((slot = lorcon_multi_dedup_find(ctx, key)) != NULL) {
+        ctx->dedup_duplicates++;
+
+        e = &(ctx->dedup_ring[(*slot - 1) & ctx->dedup_ring_mask]);
+
+        if ((held = e->packet) == NULL) {
+            /* First copy already went out */
+            lorcon_packet_free(packet);
+            return;
+        }
+
+        lorcon_multi_dedup_add_receiver(held, packet->interface);
+
+        if (!packet->signal_present ||
+                (held->signal_present && held->signal_dbm >= packet->signal_dbm)) {
+            lorcon_packet_free(packet);
+            return;
+        }
+
+        /* Stronger copy; keep it instead, with the receivers so far */
+        if (!persistent) {
+            if ((copy = lorcon_packet_dup(packet)) == NULL) {
+                lorcon_packet_free(packet);
+                return;
+            }
+
+            lorcon_packet_free(packet);
+            packet = copy;
+        }
+
+        memcpy(packet->receivers, held->receivers, sizeof(held->receivers));
+        packet->num_receivers = held->num_receivers;
+
+        lorcon_packet_free(held);
+        e->packet = packet;
+
+        return;
+    }
+
+    ctx->dedup_unique++;
+
+    packet->receivers[0] = packet->interface;
+    packet->num_receivers = 1;
+
+    if (ctx->dedup_head - ctx->dedup_tail > ctx->dedup_ring_mask) {
+        ctx->dedup_forced++;
+        lorcon_multi_dedup_expire(ctx);
+    }
+
+    e = &(ctx->dedup_ring[ctx->dedup_head & ctx->dedup_ring_mask]);
+    e->key = key;
+    e->arrival_us = lorcon_multi_mono_us();
+    e->packet = NULL;
+
+    s = (unsigned int) key & ctx->dedup_table_mask;
+
+    while (ctx->dedup_table[s] != 0)
+        s = (s + 1) & ctx->dedup_table_mask;
+
+    ctx->dedup_table[s] = ++ctx->dedup_head;
+
+    if (ctx->dedup_mode != LORCON_MULTI_DEDUP_BEST) {
+        lorcon_multi_merge_push(ctx, packet, persistent);
+        return;
+    }
+
+    if (!persistent) {
+        if ((copy = lorcon_packet_dup(packet)) == NULL) {
+            lorcon_multi_merge_push(ctx, packet, 0);
+            return;
+        }
+
+        lorcon_packet_free(packet);
+        packet = copy;
+    }
+
+    e->packet = packet;
+}
+
+int lorcon_multi_set_dedup(lorcon_multi_t *ctx, int mode,
+        unsigned int window_us, unsigned int max_entries) {
+    unsigned int n = 1;
+
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Cannot change dedup while threaded capture is running");
+        return -1;
+    }
+
+    lorcon_multi_dedup_release(ctx, 1);
+
+    free(ctx->dedup_ring);
+    free(ctx->dedup_table);
+    ctx->dedup_ring = NULL;
+    ctx->dedup_table = NULL;
+
+    if (window_us == 0)
+        return 0;
+
+    if (max_entries == 0)
+        max_entries = LORCON_MULTI_DEFAULT_DEDUP;
+
+    while (n < max_entries)
+        n <<= 1;
+
+    /* Keep the table at most half full */
+    ctx->dedup_ring = (struct lorcon_multi_dedup_entry *)
+        malloc(sizeof(struct lorcon_multi_dedup_entry) * n);
+    ctx->dedup_table = (uint64_t *) calloc(n * 2, sizeof(uint64_t));
+
+    if (ctx->dedup_ring == NULL || ctx->dedup_table == NULL) {
+        free(ctx->dedup_ring);
+        free(ctx->dedup_table);
+        ctx->dedup_ring = NULL;
+        ctx->dedup_table = NULL;
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+        return -1;
+    }
+
+    ctx->dedup_mode = mode;
+    ctx->dedup_ring_mask = n - 1;
+    ctx->dedup_table_mask = (n * 2) - 1;
+    ctx->dedup_head = ctx->dedup_tail = 0;
+    ctx->dedup_window_us = window_us;
+    ctx->dedup_unique = ctx->dedup_duplicates = ctx->dedup_forced = 0;
+
+    return 0;
+}
+
+void lorcon_multi_get_dedup_stats(lorcon_multi_t *ctx,
+        lorcon_multi_dedup_stats_t *stats) {
+    stats->unique = ctx->dedup_unique;
+    stats->duplicates = ctx->dedup_duplicates;
+    stats->forced = ctx->dedup_forced;
+}
+
@@ -0,0 +1,176 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_packet.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+
+/* Groups up to this size pick a transmitter without allocating */
+#define LORCON_MULTI_TX_STACK   16
+
+/* Bytes waiting in the kernel send queue of an interface; interfaces we
+ * can't ask are treated as idle */
+static int lorcon_multi_tx_depth(lorcon_multi_interface_t *intf) {
+    int outq = 0;
+    int fd = intf->lorcon_intf->inject_fd;
+
+    if (fd < 0 || ioctl(fd, SIOCOUTQ, &outq) < 0)
+        return 0;
+
+    return outq;
+}
+
+int lorcon_multi_inject(lorcon_multi_t *ctx, lorcon_packet_t *packet,
+        int policy) {
+    lorcon_multi_interface_t *all_stack[LORCON_MULTI_TX_STACK];
+    lorcon_multi_interface_t *cand_stack[LORCON_MULTI_TX_STACK];
+    int depth_stack[LORCON_MULTI_TX_STACK];
+    lorcon_multi_interface_t **all = all_stack, **cand = cand_stack;
+    int *depth = depth_stack;
+    lorcon_multi_interface_t *intf = NULL, *ti;
+    int nall = 0, ncand = 0, start, x, y, td, r = -1;
+
+    if (ctx->num_interfaces == 0) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Cannot inject with no interfaces");
+        return -1;
+    }
+
+    if (ctx->num_interfaces > LORCON_MULTI_TX_STACK) {
+        all = (lorcon_multi_interface_t **)
+            malloc(sizeof(lorcon_multi_interface_t *) * ctx->num_interfaces);
+        cand = (lorcon_multi_interface_t **)
+            malloc(sizeof(lorcon_multi_interface_t *) * ctx->num_interfaces);
+        depth = (int *) malloc(sizeof(int) * ctx->num_interfaces);
+
+        if (all == NULL || cand == NULL || depth == NULL) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+            goto done;
+        }
+    }
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf)) &&
+            nall < ctx->num_interfaces)
+        all[nall++] = intf;
+
+    /* Without a channel there's nothing to match */
+    if (policy == LORCON_MULTI_TX_CHANNEL && packet->channel <= 0)
+        policy = LORCON_MULTI_TX_ROUNDROBIN;
+
+    start = (int) (__atomic_fetch_add(&ctx->tx_rr, 1, __ATOMIC_RELAXED) % nall);
+
+    /* Rotate so ties, and failover, spread across interfaces */
+    for (x = 0; x < nall; x++) {
+        intf = all[(start + x) % nall];
+
+        if (policy == LORCON_MULTI_TX_CHANNEL &&
+                lorcon_get_channel(intf->lorcon_intf) != packet->channel)
+            continue;
+
+        cand[ncand] = intf;
+
+        if (policy == LORCON_MULTI_TX_LEASTQUEUE) {
+            depth[ncand] = lorcon_multi_tx_depth(intf);
+
+            /* Insertion sort, shallowest queue first */
+            for (y = ncand; y > 0 && depth[y - 1] > depth[y]; y--) {
+                ti = cand[y];
+                cand[y] = cand[y - 1];
+                cand[y - 1] = ti;
+
+                td = depth[y];
+                depth[y] = depth[y - 1];
+                depth[y - 1] = td;
+            }
+        }
+
+        ncand++;
+    }
+
+    if (ncand == 0) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "No interface tuned to channel %d", packet->channel);
+        goto done;
+    }
+
+    for (x = 0; x < ncand; x++) {
+        intf = cand[x];
+
+        r = lorcon_inject(intf->lorcon_intf, packet);
+
+        if (r < 0) {
+            __atomic_add_fetch(&intf->tx_errors, 1, __ATOMIC_RELAXED);
+
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "%s: %s",
+                    lorcon_get_capiface(intf->lorcon_intf),
+                    lorcon_get_error(intf->lorcon_intf));
+            continue;
+        }
+
+        __atomic_add_fetch(&intf->tx_packets, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&intf->tx_bytes, r, __ATOMIC_RELAXED);
+
+        if (x > 0)
+            __atomic_add_fetch(&intf->tx_failovers, 1, __ATOMIC_RELAXED);
+
+        goto done;
+    }
+
+    r = -1;
+
+done:
+    if (all != all_stack) {
+        free(all);
+        free(cand);
+        free(depth);
+    }
+
+    return r;
+}
+
+int lorcon_multi_get_tx_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_interface,
+        lorcon_multi_tx_stats_t *stats) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_interface) {
+            stats->packets = __atomic_load_n(&intf->tx_packets, __ATOMIC_RELAXED);
+            stats->bytes = __atomic_load_n(&intf->tx_bytes, __ATOMIC_RELAXED);
+            stats->errors = __atomic_load_n(&intf->tx_errors, __ATOMIC_RELAXED);
+            stats->failovers = __atomic_load_n(&intf->tx_failovers, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
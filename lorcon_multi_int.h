@@ -21,19 +21,238 @@
 #define __LORCON_MULTI_INT_H__
 
 #include <stdint.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
 #include "lorcon.h"
 #include "lorcon_multi.h"
 
+/* Packets per interface turn unless set by lorcon_multi_set_budget */
+#define LORCON_MULTI_DEFAULT_BUDGET 64
+
+/* Events fetched per epoll_wait */
+#define LORCON_MULTI_MAX_EVENTS     64
+
 struct lorcon_multi_interface {
     struct lorcon_multi_interface *next;
     lorcon_t *lorcon_intf;
 
     lorcon_multi_error_handler error_handler;
     void *error_aux;
+
+    /* Capture fd registered with epoll */
+    int fd;
+
+    /* fd can't be polled (regular capture files); treat as always ready */
+    int always_ready;
+
+    /* Fair draining: the interface may take budget * weight packets per
+     * round, see lorcon_multi_set_budget() */
+    unsigned int weight;
+    int deficit;
+
+    /* pcap blocking mode to restore when the interface is removed */
+    int prev_nonblock;
+
+    uint64_t drain_wakeups;
+    uint64_t drain_packets;
+    uint64_t drain_exhausted;
+    unsigned int drain_max;
+
+    /* Capture counters, see lorcon_multi_get_stats(); updated atomically
+     * since threaded consumers add callback time */
+    uint64_t st_packets;
+    uint64_t st_bytes;
+    uint64_t st_callback_ns;
+    int64_t st_last_us;
+
+    /* Transmit counters, see lorcon_multi_inject() */
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_errors;
+    uint64_t tx_failovers;
+
+    /* Channels the radio supports, fetched from nl80211 or set by the
+     * user, and its part of the coverage plan */
+    int *plan_supported;
+    int plan_num_supported;
+    int plan_fetched;
+    struct lorcon_multi_plan_entry *plan;
+    int plan_len;
+    uint64_t plan_load;
+
+    /* Channel last set by lorcon_multi_plan_tune() */
+    int plan_channel;
+
+    /* Threaded capture worker */
+    int cpu;
+    pthread_t worker;
+    int worker_started;
+
+    /* The worker stopped on a capture error or EOF; the interface is
+     * failed once threaded capture stops */
+    int thr_failed;
+
+    /* Updated atomically by the worker and consumers */
+    uint64_t thr_queued;
+    uint64_t thr_delivered;
+    uint64_t thr_dropped;
+};
+
+/* Bounded lock-free queue slot; seq implements the Vyukov MPMC protocol */
+struct lorcon_multi_queue_slot {
+    uint64_t seq;
+    struct lorcon_packet *packet;
+    struct lorcon_multi_interface *intf;
+};
+
+/* Frame remembered by duplicate suppression.  Entries live in a ring in
+ * arrival order and are indexed by an open addressed hash table */
+struct lorcon_multi_dedup_entry {
+    uint64_t key;
+    int64_t arrival_us;
+
+    /* Copy being held in LORCON_MULTI_DEDUP_BEST mode */
+    struct lorcon_packet *packet;
+};
+
+/* Bit posted to the control channel when interface changes are queued */
+#define LORCON_MULTI_CONTROL_OPS        4
+
+/* Interface change handed to the loop thread; lives on the stack of the
+ * thread which asked for it until done is set */
+struct lorcon_multi_control_op {
+    int add;
+    lorcon_t *lorcon_intf;
+    int free_interface;
+    int ret;
+    int done;
+    struct lorcon_multi_control_op *next;
+};
+
+/* Channel in the union covered by the plan */
+struct lorcon_multi_plan_chan {
+    int channel;
+    unsigned int weight;
+
+    /* Radios which support it, and the one it was given to */
+    int num_radios;
+    struct lorcon_multi_interface *owner;
+    unsigned int dwell_ms;
+};
+
+/* Packet held by the timestamp merge */
+struct lorcon_multi_merge_entry {
+    struct lorcon_packet *packet;
+    int64_t ts_us;
+    int64_t arrival_us;
 };
 
 struct lorcon_multi {
     struct lorcon_multi_interface *interfaces;
+    int num_interfaces;
+    int num_always_ready;
+
+    /* Persistent epoll set; interfaces are registered when they are added
+     * and removed when they are deleted */
+    int epoll_fd;
+
+    /* Control channel, always in the epoll set with data.ptr pointing at
+     * control_fd; see lorcon_multi_breakloop() */
+    int control_fd;
+    unsigned int control_pending;
+    lorcon_multi_wakeup_handler wakeup_cb;
+    void *wakeup_aux;
+
+    /* Interface changes asked for by other threads while the loop runs are
+     * queued here and made by the loop thread */
+    pthread_mutex_t control_lock;
+    pthread_cond_t control_cond;
+    struct lorcon_multi_control_op *control_ops;
+    int loop_running;
+    pthread_t loop_thread;
+
+    /* nl80211 listener fd when events are enabled, else -1; always in
+     * the epoll set with data.ptr pointing at events_fd */
+    int events_fd;
+
+    /* Interface being drained by lorcon_multi_loop, for its handler */
+    struct lorcon_multi_interface *drain_intf;
+
+    /* Periodic stats callback, see lorcon_multi_set_stats_callback() */
+    lorcon_multi_stats_handler stats_cb;
+    void *stats_aux;
+    int64_t stats_interval_us;
+    int64_t stats_due_us;
+
+    /* Next round-robin transmit position */
+    unsigned int tx_rr;
+
+    /* Channel coverage plan, see lorcon_multi_plan_channels(); cycle of 0
+     * when planning is off.  Weights hold only channels the user set */
+    unsigned int plan_cycle_ms;
+    struct lorcon_multi_plan_chan *plan_weights;
+    int plan_num_weights;
+    struct lorcon_multi_plan_chan *plan_union;
+    int plan_num_union;
+
+    /* Packets per interface per round */
+    unsigned int budget;
+
+    /* Events from the last wait which are still being processed, so that
+     * removing an interface can cancel its pending event */
+    struct epoll_event events[LORCON_MULTI_MAX_EVENTS];
+    int num_events;
+
+    /* Threaded capture, see lorcon_multi_start_threaded() */
+    int threaded;
+    int thr_stop;
+    int thr_workers_running;
+
+    /* Consumers sleep on this (EFD_SEMAPHORE) when the queue is empty */
+    int thr_wake_fd;
+    int thr_sleepers;
+
+    /* Workers wait on this alongside their capture fd */
+    int thr_stop_fd;
+
+    pthread_t *thr_consumers;
+    int thr_num_consumers;
+
+    struct lorcon_multi_queue_slot *thr_queue;
+    uint64_t thr_queue_mask;
+
+    /* Producer and consumer positions, padded onto separate cache lines */
+    uint64_t thr_head;
+    char thr_pad[64];
+    uint64_t thr_tail;
+
+    /* Duplicate suppression, see lorcon_multi_set_dedup(); NULL when
+     * disabled.  The table holds ring position + 1, 0 is an empty slot */
+    struct lorcon_multi_dedup_entry *dedup_ring;
+    uint64_t *dedup_table;
+    int dedup_mode;
+    unsigned int dedup_ring_mask;
+    unsigned int dedup_table_mask;
+    uint64_t dedup_head;
+    uint64_t dedup_tail;
+    int64_t dedup_window_us;
+    uint64_t dedup_unique;
+    uint64_t dedup_duplicates;
+    uint64_t dedup_forced;
+
+    /* Timestamp ordered merge, see lorcon_multi_set_merge(); min-heap on
+     * packet timestamp, NULL when disabled */
+    struct lorcon_multi_merge_entry *merge_heap;
+    unsigned int merge_held;
+    unsigned int merge_max;
+    int64_t merge_window_us;
+    int64_t merge_newest_us;
+    int64_t merge_released_us;
+    uint64_t merge_delivered;
+    uint64_t merge_late;
+    uint64_t merge_forced;
 
 	char errstr[LORCON_STATUS_MAX];
    
@@ -42,5 +261,95 @@ struct lorcon_multi {
 	void *handler_user;
 };
 
+static inline int64_t lorcon_multi_mono_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static inline int64_t lorcon_multi_mono_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/* Count a captured packet against the interface which captured it */
+static inline void lorcon_multi_account(struct lorcon_multi_interface *intf,
+        unsigned int len, const struct timeval *ts) {
+    __atomic_add_fetch(&intf->st_packets, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&intf->st_bytes, len, __ATOMIC_RELAXED);
+    __atomic_store_n(&intf->st_last_us,
+            ((int64_t) ts->tv_sec * 1000000) + ts->tv_usec, __ATOMIC_RELAXED);
+}
+
+/* Find the group entry for a lorcon interface, or NULL */
+struct lorcon_multi_interface *lorcon_multi_find_interface(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_intf);
+
+/* Run the stats callback if it is due, and the milliseconds until it next
+ * is, or -1 if there is none */
+void lorcon_multi_stats_tick(lorcon_multi_t *ctx);
+int lorcon_multi_stats_timeout(lorcon_multi_t *ctx);
+
+/* Drop a failed interface from the group, then call its error handler */
+void lorcon_multi_fail_interface(lorcon_multi_t *ctx,
+        struct lorcon_multi_interface *intf, const char *why);
+
+/* Hand a captured packet to the user callback, through the dedup and merge
+ * stages if they are enabled.  Packets which are not persistent point into
+ * a capture buffer and are copied if they must be held */
+void lorcon_multi_deliver(lorcon_multi_t *ctx, struct lorcon_packet *packet,
+        int persistent);
+
+/* Release packets held by the dedup and merge stages which are due; all of
+ * them if flush is set */
+void lorcon_multi_service(lorcon_multi_t *ctx, int flush);
+
+/* Milliseconds until a stage next needs servicing, or -1 if nothing is
+ * held */
+int lorcon_multi_service_timeout(lorcon_multi_t *ctx);
+
+/* Per-stage entry points used by the above */
+void lorcon_multi_dedup_push(lorcon_multi_t *ctx, struct lorcon_packet *packet,
+        int persistent);
+void lorcon_multi_dedup_release(lorcon_multi_t *ctx, int flush);
+int lorcon_multi_dedup_timeout(lorcon_multi_t *ctx);
+
+void lorcon_multi_merge_push(lorcon_multi_t *ctx, struct lorcon_packet *packet,
+        int persistent);
+void lorcon_multi_merge_release(lorcon_multi_t *ctx, int flush);
+int lorcon_multi_merge_timeout(lorcon_multi_t *ctx);
+
+/* Control channel setup and teardown */
+int lorcon_multi_control_open(lorcon_multi_t *ctx);
+void lorcon_multi_control_close(lorcon_multi_t *ctx);
+
+/* Mark the calling thread as running the loop, and on the way out make any
+ * interface changes still queued */
+void lorcon_multi_control_enter(lorcon_multi_t *ctx);
+void lorcon_multi_control_exit(lorcon_multi_t *ctx);
+
+/* If the loop is running in another thread, queue an interface change for
+ * it, wait for it to be made and return 1 with the result in ret.  Returns
+ * 0 if the caller should make the change itself */
+int lorcon_multi_control_defer(lorcon_multi_t *ctx, int add,
+        lorcon_t *lorcon_intf, int free_interface, int *ret);
+
+/* Post control events and wake the loop; with no events it just makes the
+ * loop work out its timeout again */
+void lorcon_multi_control_post(lorcon_multi_t *ctx, unsigned int events);
+
+/* Act on control events on the loop thread; returns 1 on a break */
+int lorcon_multi_control_service(lorcon_multi_t *ctx);
+
+/* Recompute the channel plan after the interface set changed, and release
+ * the plan state of an interface being removed */
+void lorcon_multi_plan_rebalance(lorcon_multi_t *ctx);
+void lorcon_multi_plan_release(struct lorcon_multi_interface *intf);
+
 #endif
 
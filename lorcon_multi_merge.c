@@ -0,0 +1,242 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_packet.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+
+#define LORCON_MULTI_DEFAULT_MERGE      4096
+
+static void lorcon_multi_call(lorcon_multi_t *ctx, lorcon_packet_t *packet) {
+    lorcon_multi_interface_t *intf;
+    lorcon_t *context = packet->interface;
+    int64_t start;
+
+    if (ctx->handler_cb == NULL) {
+        lorcon_packet_free(packet);
+        return;
+    }
+
+    start = lorcon_multi_mono_ns();
+
+    (*(ctx->handler_cb))(context, packet, (unsigned char *) ctx->handler_user);
+
+    /* The callback owns the packet now, so only context is safe to use */
+    if ((intf = lorcon_multi_find_interface(ctx, context)) != NULL)
+        __atomic_add_fetch(&intf->st_callback_ns,
+                lorcon_multi_mono_ns() - start, __ATOMIC_RELAXED);
+}
+
+static void lorcon_multi_heap_push(lorcon_multi_t *ctx,
+        struct lorcon_multi_merge_entry *e) {
+    struct lorcon_multi_merge_entry *heap = ctx->merge_heap;
+    unsigned int pos = ctx->merge_held++, parent;
+
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+
+        if (heap[parent].ts_us <= e->ts_us)
+            break;
+
+        heap[pos] = heap[parent];
+        pos = parent;
+    }
+
+    heap[pos] = *e;
+}
+
+static void lorcon_multi_heap_pop(lorcon_multi_t *ctx,
+        struct lorcon_multi_merge_entry *ret) {
+    struct lorcon_multi_merge_entry *heap = ctx->merge_heap;
+    struct lorcon_multi_merge_entry last;
+    unsigned int pos = 0, child;
+
+    *ret = heap[0];
+    last = heap[--ctx->merge_held];
+
+    while ((child = (pos * 2) + 1) < ctx->merge_held) {
+        if (child + 1 < ctx->merge_held && heap[child + 1].ts_us < heap[child].ts_us)
+            child++;
+
+        if (last.ts_us <= heap[child].ts_us)
+            break;
+
+        heap[pos] = heap[child];
+        pos = child;
+    }
+
+    heap[pos] = last;
+}
+
+/* Pop the oldest packet and hand it on */
+static void lorcon_multi_merge_pop_deliver(lorcon_multi_t *ctx) {
+    struct lorcon_multi_merge_entry e;
+
+    lorcon_multi_heap_pop(ctx, &e);
+
+    if (e.ts_us > ctx->merge_released_us)
+        ctx->merge_released_us = e.ts_us;
+
+    ctx->merge_delivered++;
+
+    lorcon_multi_call(ctx, e.packet);
+}
+
+void lorcon_multi_merge_release(lorcon_multi_t *ctx, int flush) {
+    int64_t now;
+
+    if (ctx->merge_heap == NULL || ctx->merge_held == 0)
+        return;
+
+    now = lorcon_multi_mono_us();
+
+    while (ctx->merge_held > 0) {
+        /* A packet is due once a packet newer by the window has been seen,
+         * or once it has been held for the window; the latter keeps quiet
+         * periods and replayed captures from stalling */
+        if (!flush &&
+                ctx->merge_heap[0].ts_us > ctx->merge_newest_us - ctx->merge_window_us &&
+                ctx->merge_heap[0].arrival_us + ctx->merge_window_us > now)
+            break;
+
+        lorcon_multi_merge_pop_deliver(ctx);
+    }
+}
+
+int lorcon_multi_merge_timeout(lorcon_multi_t *ctx) {
+    int64_t due;
+
+    if (ctx->merge_heap == NULL || ctx->merge_held == 0)
+        return -1;
+
+    due = ctx->merge_heap[0].arrival_us + ctx->merge_window_us -
+        lorcon_multi_mono_us();
+
+    if (due <= 0)
+        return 0;
+
+    return (int) ((due + 999) / 1000);
+}
+
+void lorcon_multi_merge_push(lorcon_multi_t *ctx, lorcon_packet_t *packet,
+        int persistent) {
+    struct lorcon_multi_merge_entry e;
+    lorcon_packet_t *copy;
+
+    if (ctx->merge_heap == NULL) {
+        lorcon_multi_call(ctx, packet);
+        return;
+    }
+
+    e.ts_us = ((int64_t) packet->ts.tv_sec * 1000000) + packet->ts.tv_usec;
+
+    /* Older than something already delivered; ordering can't be kept, so
+     * pass it straight on */
+    if (e.ts_us < ctx->merge_released_us) {
+        ctx->merge_late++;
+        lorcon_multi_call(ctx, packet);
+        return;
+    }
+
+    if (!persistent) {
+        if ((copy = lorcon_packet_dup(packet)) == NULL) {
+            lorcon_multi_call(ctx, packet);
+            return;
+        }
+
+        lorcon_packet_free(packet);
+        packet = copy;
+    }
+
+    if (ctx->merge_held == ctx->merge_max) {
+        ctx->merge_forced++;
+        lorcon_multi_merge_pop_deliver(ctx);
+    }
+
+    e.packet = packet;
+    e.arrival_us = lorcon_multi_mono_us();
+
+    lorcon_multi_heap_push(ctx, &e);
+
+    if (e.ts_us > ctx->merge_newest_us)
+        ctx->merge_newest_us = e.ts_us;
+
+    lorcon_multi_merge_release(ctx, 0);
+}
+
+int lorcon_multi_set_merge(lorcon_multi_t *ctx, unsigned int window_us,
+        unsigned int max_held) {
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Cannot change merging while threaded capture is running");
+        return -1;
+    }
+
+    lorcon_multi_merge_flush(ctx);
+
+    free(ctx->merge_heap);
+    ctx->merge_heap = NULL;
+
+    if (window_us == 0)
+        return 0;
+
+    if (max_held == 0)
+        max_held = LORCON_MULTI_DEFAULT_MERGE;
+
+    ctx->merge_heap = (struct lorcon_multi_merge_entry *)
+        malloc(sizeof(struct lorcon_multi_merge_entry) * max_held);
+
+    if (ctx->merge_heap == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+        return -1;
+    }
+
+    ctx->merge_held = 0;
+    ctx->merge_max = max_held;
+    ctx->merge_window_us = window_us;
+    ctx->merge_newest_us = 0;
+    ctx->merge_released_us = 0;
+    ctx->merge_delivered = ctx->merge_late = ctx->merge_forced = 0;
+
+    return 0;
+}
+
+void lorcon_multi_merge_flush(lorcon_multi_t *ctx) {
+    lorcon_multi_merge_release(ctx, 1);
+}
+
+void lorcon_multi_get_merge_stats(lorcon_multi_t *ctx,
+        lorcon_multi_merge_stats_t *stats) {
+    stats->delivered = ctx->merge_delivered;
+    stats->late = ctx->merge_late;
+    stats->forced = ctx->merge_forced;
+    stats->held = ctx->merge_held;
+}
+
@@ -0,0 +1,436 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+#include "nl80211_control.h"
+
+void lorcon_multi_plan_release(lorcon_multi_interface_t *intf) {
+    free(intf->plan_supported);
+    free(intf->plan);
+
+    intf->plan_supported = NULL;
+    intf->plan_num_supported = 0;
+    intf->plan_fetched = 0;
+    intf->plan = NULL;
+    intf->plan_len = 0;
+}
+
+/* Ask nl80211 once which channels the radio supports; radios which can't
+ * say are left out of the plan */
+static void lorcon_multi_plan_fetch(lorcon_multi_interface_t *intf) {
+    char errstr[LORCON_STATUS_MAX];
+    int *chans = NULL;
+    int nchans = 0;
+
+    if (intf->plan_fetched)
+        return;
+
+    intf->plan_fetched = 1;
+
+    if (nl80211_get_chanlist(lorcon_get_capiface(intf->lorcon_intf),
+                &nchans, &chans, errstr) < 0 || nchans <= 0) {
+        free(chans);
+        return;
+    }
+
+    intf->plan_supported = chans;
+    intf->plan_num_supported = nchans;
+}
+
+static unsigned int lorcon_multi_plan_weight(lorcon_multi_t *ctx, int channel) {
+    int x;
+
+    for (x = 0; x < ctx->plan_num_weights; x++) {
+        if (ctx->plan_weights[x].channel == channel)
+            return ctx->plan_weights[x].weight;
+    }
+
+    return 1;
+}
+
+static int lorcon_multi_plan_chan_cmp(const void *a, const void *b) {
+    const struct lorcon_multi_plan_chan *ca = (const struct lorcon_multi_plan_chan *) a;
+    const struct lorcon_multi_plan_chan *cb = (const struct lorcon_multi_plan_chan *) b;
+
+    return (ca->channel > cb->channel) - (ca->channel < cb->channel);
+}
+
+static int lorcon_multi_plan_entry_cmp(const void *a, const void *b) {
+    const lorcon_multi_plan_entry_t *ea = (const lorcon_multi_plan_entry_t *) a;
+    const lorcon_multi_plan_entry_t *eb = (const lorcon_multi_plan_entry_t *) b;
+
+    return (ea->channel > eb->channel) - (ea->channel < eb->channel);
+}
+
+/* Most constrained channels first, so channels only one radio can reach
+ * are placed before the shared ones fill it; then heaviest first */
+static int lorcon_multi_plan_order_cmp(const void *a, const void *b) {
+    const struct lorcon_multi_plan_chan *ca = *(const struct lorcon_multi_plan_chan **) a;
+    const struct lorcon_multi_plan_chan *cb = *(const struct lorcon_multi_plan_chan **) b;
+
+    if (ca->num_radios != cb->num_radios)
+        return ca->num_radios - cb->num_radios;
+
+    if (ca->weight != cb->weight)
+        return ca->weight < cb->weight ? 1 : -1;
+
+    return (ca->channel > cb->channel) - (ca->channel < cb->channel);
+}
+
+static int lorcon_multi_plan_supports(lorcon_multi_interface_t *intf, int channel) {
+    int x;
+
+    for (x = 0; x < intf->plan_num_supported; x++) {
+        if (intf->plan_supported[x] == channel)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int lorcon_multi_plan_build(lorcon_multi_t *ctx) {
+    lorcon_multi_interface_t *intf;
+    struct lorcon_multi_plan_chan *uni, **order, *c;
+    lorcon_multi_interface_t *best;
+    int total = 0, nuni = 0, norder = 0, x, y;
+    uint64_t cum;
+    unsigned int prev;
+
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        lorcon_multi_plan_fetch(intf);
+        total += intf->plan_num_supported;
+
+        free(intf->plan);
+        intf->plan = NULL;
+        intf->plan_len = 0;
+        intf->plan_load = 0;
+    }
+
+    free(ctx->plan_union);
+    ctx->plan_union = NULL;
+    ctx->plan_num_union = 0;
+
+    if (total == 0)
+        return 0;
+
+    uni = (struct lorcon_multi_plan_chan *)
+        malloc(sizeof(struct lorcon_multi_plan_chan) * total);
+    order = (struct lorcon_multi_plan_chan **)
+        malloc(sizeof(struct lorcon_multi_plan_chan *) * total);
+
+    if (uni == NULL || order == NULL) {
+        free(uni);
+        free(order);
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+        return -1;
+    }
+
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        for (x = 0; x < intf->plan_num_supported; x++)
+            uni[nuni++].channel = intf->plan_supported[x];
+
+        if (intf->plan_num_supported == 0)
+            continue;
+
+        intf->plan = (lorcon_multi_plan_entry_t *)
+            malloc(sizeof(lorcon_multi_plan_entry_t) * intf->plan_num_supported);
+
+        if (intf->plan == NULL) {
+            free(uni);
+            free(order);
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+            return -1;
+        }
+    }
+
+    /* Union of the supported channels */
+    qsort(uni, nuni, sizeof(struct lorcon_multi_plan_chan),
+            lorcon_multi_plan_chan_cmp);
+
+    for (x = 0, y = 0; x < nuni; x++) {
+        if (y > 0 && uni[y - 1].channel == uni[x].channel)
+            continue;
+
+        uni[y++].channel = uni[x].channel;
+    }
+
+    nuni = y;
+
+    for (x = 0; x < nuni; x++) {
+        c = &(uni[x]);
+
+        c->weight = lorcon_multi_plan_weight(ctx, c->channel);
+        c->owner = NULL;
+        c->dwell_ms = 0;
+        c->num_radios = 0;
+
+        for (intf = ctx->interfaces; intf != NULL; intf = intf->next)
+            c->num_radios += lorcon_multi_plan_supports(intf, c->channel);
+
+        if (c->weight > 0)
+            order[norder++] = c;
+    }
+
+    qsort(order, norder, sizeof(struct lorcon_multi_plan_chan *),
+            lorcon_multi_plan_order_cmp);
+
+    /* Give each channel to the least loaded radio which can tune it; no
+     * channel is given to two radios */
+    for (x = 0; x < norder; x++) {
+        c = order[x];
+        best = NULL;
+
+        for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+            if (!lorcon_multi_plan_supports(intf, c->channel))
+                continue;
+
+            if (best == NULL || intf->plan_load < best->plan_load ||
+                    (intf->plan_load == best->plan_load &&
+                     intf->plan_len < best->plan_len))
+                best = intf;
+        }
+
+        best->plan[best->plan_len].channel = c->channel;
+        best->plan[best->plan_len].dwell_ms = c->weight;
+        best->plan_len++;
+        best->plan_load += c->weight;
+
+        c->owner = best;
+    }
+
+    /* Split each cycle by weight.  Rounding the running total keeps the
+     * dwells summing to exactly the cycle */
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        if (intf->plan_len == 0)
+            continue;
+
+        qsort(intf->plan, intf->plan_len, sizeof(lorcon_multi_plan_entry_t),
+                lorcon_multi_plan_entry_cmp);
+
+        cum = 0;
+        prev = 0;
+
+        for (x = 0; x < intf->plan_len; x++) {
+            cum += intf->plan[x].dwell_ms;
+            intf->plan[x].dwell_ms =
+                (unsigned int) ((cum * ctx->plan_cycle_ms) / intf->plan_load) - prev;
+            prev += intf->plan[x].dwell_ms;
+        }
+    }
+
+    for (x = 0; x < nuni; x++) {
+        c = &(uni[x]);
+
+        if (c->owner == NULL)
+            continue;
+
+        for (y = 0; y < c->owner->plan_len; y++) {
+            if (c->owner->plan[y].channel == c->channel) {
+                c->dwell_ms = c->owner->plan[y].dwell_ms;
+                break;
+            }
+        }
+    }
+
+    free(order);
+
+    ctx->plan_union = uni;
+    ctx->plan_num_union = nuni;
+
+    return 0;
+}
+
+void lorcon_multi_plan_rebalance(lorcon_multi_t *ctx) {
+    lorcon_multi_plan_build(ctx);
+}
+
+int lorcon_multi_plan_channels(lorcon_multi_t *ctx, unsigned int cycle_ms) {
+    lorcon_multi_interface_t *intf;
+
+    ctx->plan_cycle_ms = cycle_ms;
+
+    if (cycle_ms == 0) {
+        for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+            free(intf->plan);
+            intf->plan = NULL;
+            intf->plan_len = 0;
+        }
+
+        free(ctx->plan_union);
+        ctx->plan_union = NULL;
+        ctx->plan_num_union = 0;
+
+        return 0;
+    }
+
+    return lorcon_multi_plan_build(ctx);
+}
+
+int lorcon_multi_set_channel_weight(lorcon_multi_t *ctx, int channel,
+        unsigned int weight) {
+    struct lorcon_multi_plan_chan *w;
+    int x;
+
+    for (x = 0; x < ctx->plan_num_weights; x++) {
+        if (ctx->plan_weights[x].channel == channel)
+            break;
+    }
+
+    if (x == ctx->plan_num_weights) {
+        w = (struct lorcon_multi_plan_chan *) realloc(ctx->plan_weights,
+                sizeof(struct lorcon_multi_plan_chan) * (x + 1));
+
+        if (w == NULL) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+            return -1;
+        }
+
+        ctx->plan_weights = w;
+        ctx->plan_num_weights++;
+        ctx->plan_weights[x].channel = channel;
+    }
+
+    ctx->plan_weights[x].weight = weight;
+
+    if (ctx->plan_cycle_ms != 0)
+        return lorcon_multi_plan_build(ctx);
+
+    return 0;
+}
+
+int lorcon_multi_set_interface_channels(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_interface, const int *channels, int num_channels) {
+    lorcon_multi_interface_t *intf = NULL;
+    int *chans = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_interface)
+            break;
+    }
+
+    if (intf == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+        return -1;
+    }
+
+    if (num_channels > 0) {
+        if ((chans = (int *) malloc(sizeof(int) * num_channels)) == NULL) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+            return -1;
+        }
+
+        memcpy(chans, channels, sizeof(int) * num_channels);
+    }
+
+    free(intf->plan_supported);
+
+    /* An empty list goes back to asking nl80211 */
+    intf->plan_supported = chans;
+    intf->plan_num_supported = num_channels > 0 ? num_channels : 0;
+    intf->plan_fetched = num_channels > 0;
+
+    if (ctx->plan_cycle_ms != 0)
+        return lorcon_multi_plan_build(ctx);
+
+    return 0;
+}
+
+int lorcon_multi_get_interface_plan(lorcon_multi_t *ctx,
+        lorcon_t *lorcon_interface, lorcon_multi_plan_entry_t *entries,
+        int max_entries) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_interface) {
+            memcpy(entries, intf->plan, sizeof(lorcon_multi_plan_entry_t) *
+                    (intf->plan_len < max_entries ? intf->plan_len : max_entries));
+            return intf->plan_len;
+        }
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
+int lorcon_multi_get_coverage(lorcon_multi_t *ctx,
+        lorcon_multi_coverage_t *coverage, int max_entries) {
+    int x;
+
+    for (x = 0; x < ctx->plan_num_union && x < max_entries; x++) {
+        coverage[x].channel = ctx->plan_union[x].channel;
+        coverage[x].weight = ctx->plan_union[x].weight;
+        coverage[x].interface = ctx->plan_union[x].owner == NULL ? NULL :
+            ctx->plan_union[x].owner->lorcon_intf;
+        coverage[x].duty_cycle = (double) ctx->plan_union[x].dwell_ms /
+            ctx->plan_cycle_ms;
+    }
+
+    return ctx->plan_num_union;
+}
+
+int lorcon_multi_plan_tune(lorcon_multi_t *ctx, uint64_t elapsed_ms) {
+    lorcon_multi_interface_t *intf;
+    unsigned int pos;
+    int x, ret = 0;
+
+    if (ctx->plan_cycle_ms == 0)
+        return 0;
+
+    for (intf = ctx->interfaces; intf != NULL; intf = intf->next) {
+        if (intf->plan_len == 0)
+            continue;
+
+        pos = (unsigned int) (elapsed_ms % ctx->plan_cycle_ms);
+
+        /* Find the slot covering this point of the cycle */
+        for (x = 0; x < intf->plan_len - 1; x++) {
+            if (pos < intf->plan[x].dwell_ms)
+                break;
+
+            pos -= intf->plan[x].dwell_ms;
+        }
+
+        if (intf->plan[x].channel == intf->plan_channel)
+            continue;
+
+        if (lorcon_set_channel(intf->lorcon_intf, intf->plan[x].channel) < 0) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "%s: %s",
+                    lorcon_get_capiface(intf->lorcon_intf),
+                    lorcon_get_error(intf->lorcon_intf));
+            ret = -1;
+            continue;
+        }
+
+        intf->plan_channel = intf->plan[x].channel;
+    }
+
+    return ret;
+}
+
@@ -0,0 +1,523 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+
+#include <pcap.h>
+
+#include "lorcon.h"
+#include "lorcon_int.h"
+#include "lorcon_packet.h"
+#include "lorcon_multi.h"
+#include "lorcon_multi_int.h"
+
+#define LORCON_MULTI_DEFAULT_QUEUE      4096
+
+/* Consumers re-check the queue at least this often while sleeping, so a
+ * missed wakeup can only cost latency */
+#define LORCON_MULTI_SLEEP_MS           100
+
+static int lorcon_multi_enqueue(lorcon_multi_t *ctx,
+        lorcon_multi_interface_t *intf, lorcon_packet_t *packet) {
+    struct lorcon_multi_queue_slot *slot;
+    uint64_t pos, seq;
+    int64_t diff;
+
+    pos = __atomic_load_n(&ctx->thr_head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &(ctx->thr_queue[pos & ctx->thr_queue_mask]);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t) seq - (int64_t) pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ctx->thr_head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* Full */
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ctx->thr_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->packet = packet;
+    slot->intf = intf;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int lorcon_multi_dequeue(lorcon_multi_t *ctx,
+        lorcon_multi_interface_t **intf, lorcon_packet_t **packet) {
+    struct lorcon_multi_queue_slot *slot;
+    uint64_t pos, seq;
+    int64_t diff;
+
+    pos = __atomic_load_n(&ctx->thr_tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &(ctx->thr_queue[pos & ctx->thr_queue_mask]);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t) seq - (int64_t) (pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ctx->thr_tail, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* Empty */
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ctx->thr_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    *packet = slot->packet;
+    *intf = slot->intf;
+    __atomic_store_n(&slot->seq, pos + ctx->thr_queue_mask + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void lorcon_multi_wake(lorcon_multi_t *ctx, uint64_t n) {
+    if (write(ctx->thr_wake_fd, &n, sizeof(uint64_t)) < 0)
+        return;
+}
+
+struct lorcon_multi_worker_aux {
+    lorcon_multi_t *ctx;
+    lorcon_multi_interface_t *intf;
+};
+
+/* Same as lorcon_pcap_handler, except the packet is copied out of the pcap
+ * buffer so it can outlive the dispatch */
+static void lorcon_multi_worker_handler(u_char *user,
+        const struct pcap_pkthdr *h, const u_char *bytes) {
+    struct lorcon_multi_worker_aux *aux = (struct lorcon_multi_worker_aux *) user;
+    lorcon_t *context = aux->intf->lorcon_intf;
+    lorcon_packet_t *packet;
+    u_char *copy;
+
+    if (context->pcap_handler_cb != NULL &&
+            (*(context->pcap_handler_cb))((u_char *) context, h, bytes) != 0)
+        return;
+
+    if ((copy = (u_char *) malloc(h->caplen)) == NULL) {
+        __atomic_add_fetch(&aux->intf->thr_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    memcpy(copy, bytes, h->caplen);
+
+    if ((packet = lorcon_packet_from_pcap(context, h, copy)) == NULL) {
+        free(copy);
+        return;
+    }
+
+    packet->free_data = 1;
+
+    if (lorcon_multi_enqueue(aux->ctx, aux->intf, packet) < 0) {
+        lorcon_packet_free(packet);
+        __atomic_add_fetch(&aux->intf->thr_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&aux->intf->thr_queued, 1, __ATOMIC_RELAXED);
+    lorcon_multi_account(aux->intf, h->caplen, &(h->ts));
+
+    if (__atomic_load_n(&aux->ctx->thr_sleepers, __ATOMIC_SEQ_CST) > 0)
+        lorcon_multi_wake(aux->ctx, 1);
+}
+
+static void *lorcon_multi_worker(void *arg) {
+    struct lorcon_multi_worker_aux aux =
+        *((struct lorcon_multi_worker_aux *) arg);
+    lorcon_t *context = aux.intf->lorcon_intf;
+    struct pollfd pfd[3];
+    cpu_set_t cpus;
+    int r, failed = 0;
+
+    free(arg);
+
+    if (aux.intf->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(aux.intf->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+
+    pfd[0].fd = aux.intf->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = aux.ctx->thr_stop_fd;
+    pfd[1].events = POLLIN;
+    pfd[2].fd = context->control_fd;
+    pfd[2].events = POLLIN;
+
+    while (!__atomic_load_n(&aux.ctx->thr_stop, __ATOMIC_ACQUIRE)) {
+        if (poll(pfd, 3, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            failed = 1;
+            break;
+        }
+
+        if (pfd[1].revents)
+            break;
+
+        /* lorcon_breakloop() on this interface */
+        if (pfd[2].revents && lorcon_service_control(context))
+            break;
+
+        if (pfd[0].revents == 0)
+            continue;
+
+        __atomic_add_fetch(&aux.intf->drain_wakeups, 1, __ATOMIC_RELAXED);
+
+        lorcon_pcap_enter(context);
+        r = pcap_dispatch(context->pcap, -1, lorcon_multi_worker_handler,
+                (u_char *) &aux);
+        lorcon_pcap_leave(context, r);
+
+        /* -2 is pcap_breakloop, 0 from a savefile is EOF */
+        if (r == -2)
+            break;
+
+        if (r == -1 || (r == 0 && aux.intf->always_ready)) {
+            failed = 1;
+            break;
+        }
+    }
+
+    /* The interface can't leave the group until capture stops, so the
+     * error handler runs then */
+    if (failed)
+        __atomic_store_n(&aux.intf->thr_failed, 1, __ATOMIC_RELEASE);
+
+    /* Last worker out wakes every consumer so they can drain and exit */
+    if (__atomic_sub_fetch(&aux.ctx->thr_workers_running, 1, __ATOMIC_SEQ_CST) == 0)
+        lorcon_multi_wake(aux.ctx, aux.ctx->thr_num_consumers);
+
+    return NULL;
+}
+
+static void *lorcon_multi_consumer(void *arg) {
+    lorcon_multi_t *ctx = (lorcon_multi_t *) arg;
+    lorcon_multi_interface_t *intf;
+    lorcon_packet_t *packet;
+    struct pollfd pfd;
+    uint64_t v;
+    int timeout;
+
+    pfd.fd = ctx->thr_wake_fd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        if (lorcon_multi_dequeue(ctx, &intf, &packet) == 0) {
+            __atomic_add_fetch(&intf->thr_delivered, 1, __ATOMIC_RELAXED);
+            lorcon_multi_deliver(ctx, packet, 1);
+            continue;
+        }
+
+        lorcon_multi_service(ctx, 0);
+
+        if (__atomic_load_n(&ctx->thr_workers_running, __ATOMIC_SEQ_CST) == 0) {
+            /* A worker may have queued its last packet after we looked, and
+             * a slot can read as empty while it is still being published;
+             * nothing is added now, so drain until head and tail meet */
+            while (__atomic_load_n(&ctx->thr_tail, __ATOMIC_SEQ_CST) !=
+                    __atomic_load_n(&ctx->thr_head, __ATOMIC_SEQ_CST)) {
+                if (lorcon_multi_dequeue(ctx, &intf, &packet) < 0) {
+                    sched_yield();
+                    continue;
+                }
+
+                __atomic_add_fetch(&intf->thr_delivered, 1, __ATOMIC_RELAXED);
+                lorcon_multi_deliver(ctx, packet, 1);
+            }
+
+            break;
+        }
+
+        /* Announce we're going to sleep, then look again so a packet queued
+         * in between is not missed */
+        __atomic_add_fetch(&ctx->thr_sleepers, 1, __ATOMIC_SEQ_CST);
+
+        if (lorcon_multi_dequeue(ctx, &intf, &packet) == 0) {
+            __atomic_sub_fetch(&ctx->thr_sleepers, 1, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&intf->thr_delivered, 1, __ATOMIC_RELAXED);
+            lorcon_multi_deliver(ctx, packet, 1);
+            continue;
+        }
+
+        /* Wake in time to release held packets */
+        timeout = lorcon_multi_service_timeout(ctx);
+
+        if (timeout < 0 || timeout > LORCON_MULTI_SLEEP_MS)
+            timeout = LORCON_MULTI_SLEEP_MS;
+
+        if (poll(&pfd, 1, timeout) > 0) {
+            if (read(ctx->thr_wake_fd, &v, sizeof(uint64_t)) < 0)
+                v = 0;
+        }
+
+        __atomic_sub_fetch(&ctx->thr_sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+
+    lorcon_multi_service(ctx, 1);
+
+    return NULL;
+}
+
+int lorcon_multi_set_interface_cpu(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+        int cpu) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf == lorcon_intf) {
+            intf->cpu = cpu;
+            return 0;
+        }
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
+/* Tear down whatever has been started; used by stop and by a failed start */
+static void lorcon_multi_thread_cleanup(lorcon_multi_t *ctx, int consumers) {
+    lorcon_multi_interface_t *intf = NULL;
+    lorcon_packet_t *packet;
+    uint64_t v = 1;
+    int c;
+
+    __atomic_store_n(&ctx->thr_stop, 1, __ATOMIC_RELEASE);
+
+    if (write(ctx->thr_stop_fd, &v, sizeof(uint64_t)) < 0)
+        fprintf(stderr, "lorcon_multi: could not signal capture workers\n");
+
+    /* Workers wait on thr_stop_fd and their captures are non-blocking, so
+     * they need no break; posting one would be left pending on the context
+     * and stop the next loop run on it */
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->worker_started) {
+            pthread_join(intf->worker, NULL);
+            intf->worker_started = 0;
+        }
+    }
+
+    /* Workers which never started never decremented the count */
+    __atomic_store_n(&ctx->thr_workers_running, 0, __ATOMIC_SEQ_CST);
+    lorcon_multi_wake(ctx, consumers + 1);
+
+    for (c = 0; c < consumers; c++)
+        pthread_join(ctx->thr_consumers[c], NULL);
+
+    /* Nothing left to deliver to if the consumers never started */
+    while (lorcon_multi_dequeue(ctx, &intf, &packet) == 0)
+        lorcon_packet_free(packet);
+
+    close(ctx->thr_wake_fd);
+    close(ctx->thr_stop_fd);
+    free(ctx->thr_consumers);
+    free(ctx->thr_queue);
+
+    ctx->thr_consumers = NULL;
+    ctx->thr_queue = NULL;
+    ctx->threaded = 0;
+
+    /* Now the queue is empty the failed interfaces can leave the group
+     * and be reported, as lorcon_multi_loop does.  The handler may change
+     * the list, so start over after each */
+    for (intf = ctx->interfaces; intf != NULL; ) {
+        if (intf->thr_failed) {
+            intf->thr_failed = 0;
+            lorcon_multi_fail_interface(ctx, intf, "stopped reporting packets");
+            intf = ctx->interfaces;
+            continue;
+        }
+
+        intf = intf->next;
+    }
+}
+
+int lorcon_multi_start_threaded(lorcon_multi_t *ctx, int num_consumers,
+        int queue_len, lorcon_handler callback, unsigned char *user) {
+    lorcon_multi_interface_t *intf = NULL;
+    struct lorcon_multi_worker_aux *aux;
+    uint64_t qlen = 1, x;
+    int c, r;
+
+    if (ctx->threaded) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Threaded capture already running");
+        return -1;
+    }
+
+    if (ctx->interfaces == NULL) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Cannot start threaded capture with no interfaces");
+        return -1;
+    }
+
+    if (num_consumers < 1)
+        num_consumers = 1;
+
+    if ((ctx->merge_heap != NULL || ctx->dedup_ring != NULL) && num_consumers > 1) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Merging and dedup need a single consumer thread");
+        return -1;
+    }
+
+    if (queue_len <= 0)
+        queue_len = LORCON_MULTI_DEFAULT_QUEUE;
+
+    while (qlen < (uint64_t) queue_len)
+        qlen <<= 1;
+
+    ctx->thr_queue = (struct lorcon_multi_queue_slot *)
+        malloc(sizeof(struct lorcon_multi_queue_slot) * qlen);
+    ctx->thr_consumers = (pthread_t *) malloc(sizeof(pthread_t) * num_consumers);
+
+    if (ctx->thr_queue == NULL || ctx->thr_consumers == NULL) {
+        free(ctx->thr_queue);
+        free(ctx->thr_consumers);
+        snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+        return -1;
+    }
+
+    for (x = 0; x < qlen; x++)
+        ctx->thr_queue[x].seq = x;
+
+    ctx->thr_queue_mask = qlen - 1;
+    ctx->thr_head = 0;
+    ctx->thr_tail = 0;
+
+    ctx->thr_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+    ctx->thr_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (ctx->thr_wake_fd < 0 || ctx->thr_stop_fd < 0) {
+        snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                "Could not create eventfd: %s", strerror(errno));
+        if (ctx->thr_wake_fd >= 0)
+            close(ctx->thr_wake_fd);
+        if (ctx->thr_stop_fd >= 0)
+            close(ctx->thr_stop_fd);
+        free(ctx->thr_queue);
+        free(ctx->thr_consumers);
+        return -1;
+    }
+
+    ctx->threaded = 1;
+    ctx->thr_stop = 0;
+    ctx->thr_sleepers = 0;
+    ctx->handler_cb = callback;
+    ctx->handler_user = user;
+    ctx->thr_num_consumers = num_consumers;
+    ctx->thr_workers_running = ctx->num_interfaces;
+
+    for (c = 0; c < num_consumers; c++) {
+        if ((r = pthread_create(&(ctx->thr_consumers[c]), NULL,
+                        lorcon_multi_consumer, ctx)) != 0) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                    "Could not start consumer thread: %s", strerror(r));
+            lorcon_multi_thread_cleanup(ctx, c);
+            return -1;
+        }
+    }
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        intf->thr_queued = intf->thr_delivered = intf->thr_dropped = 0;
+        intf->thr_failed = 0;
+
+        aux = (struct lorcon_multi_worker_aux *)
+            malloc(sizeof(struct lorcon_multi_worker_aux));
+
+        if (aux == NULL) {
+            snprintf(ctx->errstr, LORCON_STATUS_MAX, "Out of memory");
+            lorcon_multi_thread_cleanup(ctx, num_consumers);
+            return -1;
+        }
+
+        aux->ctx = ctx;
+        aux->intf = intf;
+
+        if ((r = pthread_create(&(intf->worker), NULL,
+                        lorcon_multi_worker, aux)) != 0) {
+            free(aux);
+            snprintf(ctx->errstr, LORCON_STATUS_MAX,
+                    "Could not start capture thread for %s: %s",
+                    lorcon_get_capiface(intf->lorcon_intf), strerror(r));
+            lorcon_multi_thread_cleanup(ctx, num_consumers);
+            return -1;
+        }
+
+        intf->worker_started = 1;
+    }
+
+    return 0;
+}
+
+void lorcon_multi_stop_threaded(lorcon_multi_t *ctx) {
+    if (!ctx->threaded)
+        return;
+
+    lorcon_multi_thread_cleanup(ctx, ctx->thr_num_consumers);
+}
+
+int lorcon_multi_get_queue_stats(lorcon_multi_t *ctx, lorcon_t *lorcon_intf,
+        lorcon_multi_queue_stats_t *stats) {
+    lorcon_multi_interface_t *intf = NULL;
+
+    while ((intf = lorcon_multi_get_next_interface(ctx, intf))) {
+        if (intf->lorcon_intf != lorcon_intf)
+            continue;
+
+        stats->queued = __atomic_load_n(&intf->thr_queued, __ATOMIC_RELAXED);
+        stats->delivered = __atomic_load_n(&intf->thr_delivered, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&intf->thr_dropped, __ATOMIC_RELAXED);
+
+        if (stats->queued > stats->delivered)
+            stats->depth = stats->queued - stats->delivered;
+        else
+            stats->depth = 0;
+
+        return 0;
+    }
+
+    snprintf(ctx->errstr, LORCON_STATUS_MAX, "Interface not in multi group");
+    return -1;
+}
+
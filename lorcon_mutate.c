@@ -0,0 +1,294 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "lorcon_packasm.h"
+#include "lorcon_rand.h"
+#include "lorcon_mutate.h"
+
+static const uint32_t lcpm_boundary_8[] =
+	{ 0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF };
+static const uint32_t lcpm_boundary_16[] =
+	{ 0x0000, 0x0001, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF };
+static const uint32_t lcpm_boundary_32[] =
+	{ 0x00000000, 0x00000001, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFE, 0xFFFFFFFF };
+
+#define LCPM_NUM_BOUNDARY	6
+
+static void lcpm_rebuild_mutable(lcpm_engine_t *engine) {
+	int x;
+
+	engine->num_mutable = 0;
+
+	for (x = 0; x < engine->num_components; x++) {
+		if (engine->components[x].strategies != 0)
+			engine->mutable_idx[engine->num_mutable++] = x;
+	}
+}
+
+lcpm_engine_t *lcpm_create(struct lcpa_metapack *in_template, uint64_t seed) {
+	lcpm_engine_t *engine;
+	struct lcpa_metapack *h, *i;
+	int ncomp = 0, offt = 0;
+
+	/* Find the head */
+	for (h = in_template; h->prev != NULL; h = h->prev)
+		;
+
+	for (i = h->next; i != NULL; i = i->next)
+		ncomp++;
+
+	if ((engine = (lcpm_engine_t *) malloc(sizeof(lcpm_engine_t))) == NULL)
+		return NULL;
+
+	memset(engine, 0, sizeof(lcpm_engine_t));
+
+	engine->seed = seed;
+	engine->max_mutations = 1;
+	engine->num_components = ncomp;
+	engine->frozen_len = lcpa_size(h);
+
+	/* Every component can gain an inserted IE of up to 257 bytes */
+	engine->out_max = engine->frozen_len + (ncomp * 257);
+
+	engine->frozen = (uint8_t *) malloc(engine->frozen_len + 1);
+	engine->out = (uint8_t *) malloc(engine->out_max + 1);
+	engine->components =
+		(struct lcpm_component *) malloc(sizeof(struct lcpm_component) * (ncomp + 1));
+	engine->mutable_idx = (int *) malloc(sizeof(int) * (ncomp + 1));
+	engine->chosen = (unsigned int *) malloc(sizeof(unsigned int) * (ncomp + 1));
+
+	if (engine->frozen == NULL || engine->out == NULL ||
+			engine->components == NULL || engine->mutable_idx == NULL ||
+			engine->chosen == NULL) {
+		lcpm_free(engine);
+		return NULL;
+	}
+
+	lcpa_freeze(h, engine->frozen);
+
+	ncomp = 0;
+	for (i = h->next; i != NULL; i = i->next) {
+		snprintf(engine->components[ncomp].type, 24, "%s", i->type);
+		engine->components[ncomp].offset = offt;
+		engine->components[ncomp].len = i->len;
+		engine->components[ncomp].strategies = 0;
+
+		offt += i->len;
+		ncomp++;
+	}
+
+	return engine;
+}
+
+void lcpm_free(lcpm_engine_t *engine) {
+	free(engine->frozen);
+	free(engine->out);
+	free(engine->components);
+	free(engine->mutable_idx);
+	free(engine->chosen);
+	free(engine);
+}
+
+int lcpm_set_strategy(lcpm_engine_t *engine, const char *type,
+		unsigned int strategies) {
+	int x, matched = 0;
+
+	for (x = 0; x < engine->num_components; x++) {
+		if (strcmp(engine->components[x].type, type) == 0) {
+			engine->components[x].strategies = strategies;
+			matched++;
+		}
+	}
+
+	lcpm_rebuild_mutable(engine);
+
+	return matched;
+}
+
+int lcpm_set_strategy_index(lcpm_engine_t *engine, int index,
+		unsigned int strategies) {
+	if (index < 0 || index >= engine->num_components)
+		return -1;
+
+	engine->components[index].strategies = strategies;
+
+	lcpm_rebuild_mutable(engine);
+
+	return 0;
+}
+
+void lcpm_set_max_mutations(lcpm_engine_t *engine, int max_mutations) {
+	if (max_mutations < 1)
+		max_mutations = 1;
+
+	engine->max_mutations = max_mutations;
+}
+
+/* Pick one strategy bit out of a mask */
+static unsigned int lcpm_pick_strategy(lorcon_rand_t *r, unsigned int mask) {
+	unsigned int bits[8], nbits = 0, b;
+
+	for (b = 0; b < 8; b++) {
+		if (mask & (1 << b))
+			bits[nbits++] = (1 << b);
+	}
+
+	if (nbits == 0)
+		return 0;
+
+	return bits[lorcon_rand_bounded(r, nbits)];
+}
+
+static void lcpm_put_le(uint8_t *dst, uint32_t val, int width) {
+	int b;
+
+	for (b = 0; b < width; b++)
+		dst[b] = (uint8_t) (val >> (b * 8));
+}
+
+int lcpm_generate(lcpm_engine_t *engine, uint64_t variant, uint8_t **ret_data) {
+	lorcon_rand_t r;
+	struct lcpm_component *c;
+	uint8_t *dst;
+	int nmut, x, len, offt = 0, width, pos, run = 0;
+	unsigned int nflip, ielen;
+
+	if (engine->num_mutable == 0)
+		return -1;
+
+	/* Derive the variant stream from the seed and index alone so any
+	 * variant can be regenerated on its own */
+	lorcon_rand_seed(&r, engine->seed ^ (variant * 0xD1B54A32D192ED03ULL));
+
+	memset(engine->chosen, 0, sizeof(unsigned int) * engine->num_components);
+
+	nmut = 1 + lorcon_rand_bounded(&r, engine->max_mutations);
+
+	for (x = 0; x < nmut; x++) {
+		pos = engine->mutable_idx[lorcon_rand_bounded(&r, engine->num_mutable)];
+		engine->chosen[pos] |=
+			lcpm_pick_strategy(&r, engine->components[pos].strategies);
+	}
+
+	for (x = 0; x < engine->num_components; x++) {
+		c = &(engine->components[x]);
+
+		if (engine->chosen[x] == 0)
+			continue;
+
+		/* Copy the untouched run before this component in one go */
+		if (run < x) {
+			len = c->offset - engine->components[run].offset;
+			memcpy(engine->out + offt, engine->frozen + engine->components[run].offset, len);
+			offt += len;
+		}
+
+		run = x + 1;
+
+		dst = engine->out + offt;
+		len = c->len;
+
+		if ((engine->chosen[x] & LCPM_STRAT_TRUNCATE) && len > 0)
+			len = lorcon_rand_bounded(&r, len);
+
+		memcpy(dst, engine->frozen + c->offset, len);
+
+		if ((engine->chosen[x] & LCPM_STRAT_LENGTH) && len >= 2) {
+			switch (lorcon_rand_bounded(&r, 5)) {
+				case 0:
+					dst[1] = 0;
+					break;
+				case 1:
+					dst[1] = 0xFF;
+					break;
+				case 2:
+					dst[1] = (uint8_t) (len - 2 + 1);
+					break;
+				case 3:
+					dst[1] = (uint8_t) (len - 2 - 1);
+					break;
+				default:
+					dst[1] = (uint8_t) lorcon_rand_next32(&r);
+					break;
+			}
+		}
+
+		if ((engine->chosen[x] & LCPM_STRAT_BOUNDARY) && len > 0) {
+			if (len >= 4 && lorcon_rand_bounded(&r, 3) == 2)
+				width = 4;
+			else if (len >= 2 && lorcon_rand_bounded(&r, 2) == 1)
+				width = 2;
+			else
+				width = 1;
+
+			pos = lorcon_rand_bounded(&r, len - width + 1);
+
+			if (width == 4)
+				lcpm_put_le(dst + pos,
+						lcpm_boundary_32[lorcon_rand_bounded(&r, LCPM_NUM_BOUNDARY)], 4);
+			else if (width == 2)
+				lcpm_put_le(dst + pos,
+						lcpm_boundary_16[lorcon_rand_bounded(&r, LCPM_NUM_BOUNDARY)], 2);
+			else
+				dst[pos] =
+					(uint8_t) lcpm_boundary_8[lorcon_rand_bounded(&r, LCPM_NUM_BOUNDARY)];
+		}
+
+		if ((engine->chosen[x] & LCPM_STRAT_BITFLIP) && len > 0) {
+			nflip = 1 + lorcon_rand_bounded(&r, 8);
+
+			while (nflip--) {
+				pos = lorcon_rand_bounded(&r, len * 8);
+				dst[pos / 8] ^= (1 << (pos % 8));
+			}
+		}
+
+		offt += len;
+
+		if (engine->chosen[x] & LCPM_STRAT_INSERT_IE) {
+			ielen = lorcon_rand_bounded(&r, 256);
+
+			engine->out[offt] = (uint8_t) lorcon_rand_next32(&r);
+			engine->out[offt + 1] = (uint8_t) ielen;
+			lorcon_rand_fill(&r, engine->out + offt + 2, ielen);
+
+			offt += ielen + 2;
+		}
+	}
+
+	if (run < engine->num_components) {
+		len = engine->frozen_len - engine->components[run].offset;
+		memcpy(engine->out + offt, engine->frozen + engine->components[run].offset, len);
+		offt += len;
+	}
+
+	*ret_data = engine->out;
+
+	return offt;
+}
+
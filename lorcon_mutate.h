@@ -0,0 +1,119 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Lorcon Packet Mutator
+ *
+ * Structured mutation of a frame built with the packet assembly (lcpa_)
+ * and forge (lcpf_) functions.  The template is frozen once when the
+ * engine is created; component boundaries and names are remembered so that
+ * mutation strategies can be assigned per component.
+ *
+ * Each variant is identified by a 64 bit index.  The same engine seed and
+ * index always produce the same bytes, independent of which variants were
+ * generated before, so a crashing variant can be replayed directly.
+ *
+ * Variants are written into a buffer owned by the engine; generating a
+ * variant performs no allocation.
+ *
+ * An engine must not be used by more than one thread at a time.
+ *
+ * All lorcon packet mutator functions use the lcpm_ namespace
+ */
+
+#ifndef __LORCON_MUTATE_H__
+#define __LORCON_MUTATE_H__
+
+#include <stdint.h>
+
+#ifndef __PACKET_ASSEMBLY_H__
+#include <lorcon_packasm.h>
+#endif
+
+/* Flip 1 to 8 random bits in the component */
+#define LCPM_STRAT_BITFLIP      (1 << 0)
+/* Overwrite a random 1, 2 or 4 byte field with a boundary value (0, 1,
+ * signed/unsigned min and max) */
+#define LCPM_STRAT_BOUNDARY     (1 << 1)
+/* Treat the component as a tag/length/value and lie about the length
+ * (byte 1); intended for IETAG components */
+#define LCPM_STRAT_LENGTH       (1 << 2)
+/* Cut the component short */
+#define LCPM_STRAT_TRUNCATE     (1 << 3)
+/* Insert a random IE tag after the component */
+#define LCPM_STRAT_INSERT_IE    (1 << 4)
+
+#define LCPM_STRAT_ALL          (0x1F)
+
+struct lcpm_component {
+	char type[24];
+	int offset;
+	int len;
+	unsigned int strategies;
+};
+
+struct lcpm_engine {
+	/* Frozen template and its components */
+	uint8_t *frozen;
+	int frozen_len;
+
+	struct lcpm_component *components;
+	int num_components;
+
+	/* Scratch list of components with strategies, rebuilt on change */
+	int *mutable_idx;
+	int num_mutable;
+
+	/* Chosen strategies per component for the current variant */
+	unsigned int *chosen;
+
+	uint64_t seed;
+	int max_mutations;
+
+	/* Output buffer, sized for the worst case */
+	uint8_t *out;
+	int out_max;
+};
+typedef struct lcpm_engine lcpm_engine_t;
+
+/* Create an engine from a template frame.  The template is copied and may
+ * be freed or changed afterwards.  No strategies are enabled initially. */
+lcpm_engine_t *lcpm_create(struct lcpa_metapack *in_template, uint64_t seed);
+void lcpm_free(lcpm_engine_t *engine);
+
+/* Set the strategies for every component named `type'.  Returns the number
+ * of components matched */
+int lcpm_set_strategy(lcpm_engine_t *engine, const char *type,
+		unsigned int strategies);
+
+/* Set the strategies for a component by position (0 is the first component
+ * after the list head).  Returns 0, or -1 if the index is out of range */
+int lcpm_set_strategy_index(lcpm_engine_t *engine, int index,
+		unsigned int strategies);
+
+/* Maximum number of mutations applied to one variant (default 1) */
+void lcpm_set_max_mutations(lcpm_engine_t *engine, int max_mutations);
+
+/* Generate a variant.  *ret_data points to the engine buffer and remains
+ * valid until the next call.  Returns the variant length, or -1 if no
+ * component has a strategy. */
+int lcpm_generate(lcpm_engine_t *engine, uint64_t variant, uint8_t **ret_data);
+
+#endif
+
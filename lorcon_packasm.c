@@ -21,6 +21,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -42,6 +47,8 @@ struct lcpa_metapack *lcpa_init() {
 	c->len = 0;
 	c->data = NULL;
 	c->freedata = 0;
+	c->release = NULL;
+	c->release_aux = NULL;
 	snprintf(c->type, 24, "INIT");
 
 	c->prev = NULL;
@@ -61,6 +68,8 @@ struct lcpa_metapack *lcpa_append_copy(struct lcpa_metapack *in_pack,
 	c->data = (uint8_t *) malloc(in_len);
 	memcpy(c->data, in_data, in_len);
 	c->freedata = 1;
+	c->release = NULL;
+	c->release_aux = NULL;
 	snprintf(c->type, 24, "%s", in_type);
 
 	/* Find the end of the list */
@@ -86,6 +95,8 @@ struct lcpa_metapack *lcpa_append(struct lcpa_metapack *in_pack,
 	c->len = in_len;
 	c->data = in_data;
 	c->freedata = 0;
+	c->release = NULL;
+	c->release_aux = NULL;
 	snprintf(c->type, 24, "%s", in_type);
 
 	j = i;
@@ -100,6 +111,31 @@ struct lcpa_metapack *lcpa_append(struct lcpa_metapack *in_pack,
 	return c;
 }
 
+struct lcpa_metapack *lcpa_append_shared(struct lcpa_metapack *in_pack,
+                                         const char *in_type,
+                                         int in_len, uint8_t *in_data,
+                                         void (*release)(void *),
+                                         void *release_aux) {
+	struct lcpa_metapack *c = lcpa_append(in_pack, in_type, in_len, in_data);
+
+	c->release = release;
+	c->release_aux = release_aux;
+
+	return c;
+}
+
+/* Drop whatever data a component currently owns */
+static void lcpa_release_data(struct lcpa_metapack *in_pack) {
+	if (in_pack->freedata) 
+		free(in_pack->data);
+
+	if (in_pack->release != NULL)
+		(*(in_pack->release))(in_pack->release_aux);
+
+	in_pack->release = NULL;
+	in_pack->release_aux = NULL;
+}
+
 struct lcpa_metapack *lcpa_insert_copy(struct lcpa_metapack *in_pack, 
                                        const char *in_type,
 									   int in_len, uint8_t *in_data) {
@@ -110,6 +146,8 @@ struct lcpa_metapack *lcpa_insert_copy(struct lcpa_metapack *in_pack,
 	c->data = (uint8_t *) malloc(in_len);
 	memcpy(c->data, in_data, in_len);
 	c->freedata = 1;
+	c->release = NULL;
+	c->release_aux = NULL;
 	snprintf(c->type, 24, "%s", in_type);
 
 	c->next = in_pack->next;
@@ -127,6 +165,9 @@ struct lcpa_metapack *lcpa_insert(struct lcpa_metapack *in_pack,
 
 	c->len = in_len;
 	c->data = in_data;
+	c->freedata = 0;
+	c->release = NULL;
+	c->release_aux = NULL;
 	snprintf(c->type, 24, "%s", in_type);
 
 	c->next = in_pack->next;
@@ -151,9 +192,7 @@ struct lcpa_metapack *lcpa_find_name(struct lcpa_metapack *in_head,
 void lcpa_replace_copy(struct lcpa_metapack *in_pack, 
                        const char *in_type,
 					   int in_len, uint8_t *in_data) {
-	if (in_pack->freedata) {
-		free(in_pack->data);
-	}
+	lcpa_release_data(in_pack);
 
 	in_pack->data = (uint8_t *) malloc(in_len);
 	memcpy(in_pack->data, in_data, in_len);
@@ -164,9 +203,7 @@ void lcpa_replace_copy(struct lcpa_metapack *in_pack,
 
 void lcpa_replace(struct lcpa_metapack *in_pack, const char *in_type,
 				  int in_len, uint8_t *in_data) {
-	if (in_pack->freedata) {
-		free(in_pack->data);
-	}
+	lcpa_release_data(in_pack);
 
 	in_pack->data = in_data;
 	in_pack->len = in_len;
@@ -181,19 +218,13 @@ void lcpa_free(struct lcpa_metapack *in_head) {
 	for (i = in_head; i->prev != NULL; i = i->prev)
 		;
 
-	j = NULL;
-	for (i = i; i != NULL; i = i->next) {
-		if (j == NULL) {
-			j = i;
-			continue;
-		}
-
-		if (j->freedata)
-			free(j->data);
+	while (i != NULL) {
+		j = i->next;
 
-		free(j);
+		lcpa_release_data(i);
+		free(i);
 
-		j = i;
+		i = j;
 	}
 }
 
@@ -234,3 +265,351 @@ void lcpa_freeze(struct lcpa_metapack *in_head, u_char *bytes) {
 	}
 }
 
+
+#define LCPA_SERIAL_HDRLEN		16
+#define LCPA_SERIAL_COMPLEN		32
+#define LCPA_LIBRARY_HDRLEN		16
+
+static void lcpa_put32(uint8_t *dst, uint32_t val) {
+	dst[0] = (uint8_t) val;
+	dst[1] = (uint8_t) (val >> 8);
+	dst[2] = (uint8_t) (val >> 16);
+	dst[3] = (uint8_t) (val >> 24);
+}
+
+static uint32_t lcpa_get32(const uint8_t *src) {
+	return (uint32_t) src[0] | ((uint32_t) src[1] << 8) |
+		((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+int lcpa_serialize_size(struct lcpa_metapack *in_head) {
+	struct lcpa_metapack *h = NULL, *i = NULL;
+	int len = LCPA_SERIAL_HDRLEN;
+
+	for (h = in_head; h->prev != NULL; h = h->prev)
+		;
+
+	for (i = h->next; i != NULL; i = i->next)
+		len += LCPA_SERIAL_COMPLEN + i->len;
+
+	return (len + 7) & ~7;
+}
+
+int lcpa_serialize(struct lcpa_metapack *in_head, uint8_t *buf, int buf_len) {
+	struct lcpa_metapack *h = NULL, *i = NULL;
+	uint8_t *comp, *data;
+	uint32_t flags;
+	size_t tlen;
+	int len, ncomp = 0, dlen = 0;
+
+	if ((len = lcpa_serialize_size(in_head)) > buf_len)
+		return -1;
+
+	for (h = in_head; h->prev != NULL; h = h->prev)
+		;
+
+	for (i = h->next; i != NULL; i = i->next) {
+		ncomp++;
+		dlen += i->len;
+	}
+
+	memset(buf, 0, len);
+
+	lcpa_put32(buf, len);
+	lcpa_put32(buf + 4, ncomp);
+	lcpa_put32(buf + 8, dlen);
+
+	comp = buf + LCPA_SERIAL_HDRLEN;
+	data = comp + (ncomp * LCPA_SERIAL_COMPLEN);
+
+	for (i = h->next; i != NULL; i = i->next) {
+		flags = 0;
+
+		if (i->freedata)
+			flags |= LCPA_SERIAL_F_OWNED;
+		if (i->release != NULL)
+			flags |= LCPA_SERIAL_F_SHARED;
+
+		tlen = strnlen(i->type, 23);
+		memcpy(comp, i->type, tlen);
+		comp[tlen] = 0;
+		lcpa_put32(comp + 24, i->len);
+		lcpa_put32(comp + 28, flags);
+
+		memcpy(data, i->data, i->len);
+
+		comp += LCPA_SERIAL_COMPLEN;
+		data += i->len;
+	}
+
+	return len;
+}
+
+/* Validate a record header against the space available.  Returns the record
+ * length, or -1 */
+static int lcpa_record_check(uint8_t *buf, size_t buf_len,
+		uint32_t *ret_ncomp, uint32_t *ret_dlen) {
+	uint32_t rlen, ncomp, dlen, len, clen = 0, x;
+
+	if (buf_len < LCPA_SERIAL_HDRLEN)
+		return -1;
+
+	rlen = lcpa_get32(buf);
+	ncomp = lcpa_get32(buf + 4);
+	dlen = lcpa_get32(buf + 8);
+
+	/* Work in 64 bits so hostile counts can't wrap */
+	if (rlen > buf_len || rlen > 0x7FFFFFFF ||
+			(uint64_t) LCPA_SERIAL_HDRLEN +
+			((uint64_t) ncomp * LCPA_SERIAL_COMPLEN) + dlen > rlen)
+		return -1;
+
+	/* Check each length against what's left before adding it, so the
+	 * total can't wrap back under dlen */
+	for (x = 0; x < ncomp; x++) {
+		len = lcpa_get32(buf + LCPA_SERIAL_HDRLEN +
+				(x * LCPA_SERIAL_COMPLEN) + 24);
+
+		if (len > dlen - clen)
+			return -1;
+
+		clen += len;
+	}
+
+	if (clen != dlen)
+		return -1;
+
+	*ret_ncomp = ncomp;
+	*ret_dlen = dlen;
+
+	return (int) rlen;
+}
+
+struct lcpa_metapack *lcpa_deserialize(uint8_t *buf, int buf_len, int copy) {
+	struct lcpa_metapack *head, *c;
+	uint8_t *comp, *data;
+	uint32_t ncomp, dlen, x, clen, flags;
+	char type[24];
+
+	if (buf_len < 0 || lcpa_record_check(buf, buf_len, &ncomp, &dlen) < 0)
+		return NULL;
+
+	if ((head = lcpa_init()) == NULL)
+		return NULL;
+
+	comp = buf + LCPA_SERIAL_HDRLEN;
+	data = comp + (ncomp * LCPA_SERIAL_COMPLEN);
+
+	for (x = 0; x < ncomp; x++) {
+		memcpy(type, comp, 23);
+		type[23] = 0;
+		clen = lcpa_get32(comp + 24);
+		flags = lcpa_get32(comp + 28);
+
+		if (copy && (flags & LCPA_SERIAL_F_OWNED))
+			c = lcpa_append_copy(head, type, clen, data);
+		else
+			c = lcpa_append(head, type, clen, data);
+
+		if (c == NULL) {
+			lcpa_free(head);
+			return NULL;
+		}
+
+		comp += LCPA_SERIAL_COMPLEN;
+		data += clen;
+	}
+
+	return head;
+}
+
+int lcpa_library_write(const char *path, struct lcpa_metapack **frames,
+		int num_frames) {
+	uint8_t hdr[LCPA_LIBRARY_HDRLEN], offt[4], *rec = NULL;
+	uint32_t pos;
+	int fd, x, len, rec_max = 0, err;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+
+	memcpy(hdr, "LCPA", 4);
+	hdr[4] = LCPA_SERIAL_VERSION & 0xFF;
+	hdr[5] = (LCPA_SERIAL_VERSION >> 8) & 0xFF;
+	hdr[6] = LCPA_LIBRARY_HDRLEN;
+	hdr[7] = 0;
+	lcpa_put32(hdr + 8, num_frames);
+	lcpa_put32(hdr + 12, 0);
+
+	if (write(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+		goto fail;
+
+	/* Index, keeping the first record 8 byte aligned */
+	pos = (LCPA_LIBRARY_HDRLEN + (num_frames * 4) + 7) & ~7;
+
+	for (x = 0; x < num_frames; x++) {
+		lcpa_put32(offt, pos);
+
+		if (write(fd, offt, 4) != 4)
+			goto fail;
+
+		pos += lcpa_serialize_size(frames[x]);
+	}
+
+	memset(offt, 0, sizeof(offt));
+	len = ((LCPA_LIBRARY_HDRLEN + (num_frames * 4) + 7) & ~7) -
+		(LCPA_LIBRARY_HDRLEN + (num_frames * 4));
+
+	if (len > 0 && write(fd, offt, len) != len)
+		goto fail;
+
+	for (x = 0; x < num_frames; x++) {
+		len = lcpa_serialize_size(frames[x]);
+
+		if (len > rec_max) {
+			free(rec);
+			rec_max = len;
+
+			if ((rec = (uint8_t *) malloc(rec_max)) == NULL)
+				goto fail;
+		}
+
+		lcpa_serialize(frames[x], rec, rec_max);
+
+		if (write(fd, rec, len) != len)
+			goto fail;
+	}
+
+	free(rec);
+
+	if (close(fd) < 0)
+		return -1;
+
+	return 0;
+
+fail:
+	err = errno;
+	free(rec);
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+lcpa_library_t *lcpa_library_open_buffer(uint8_t *buf, size_t len) {
+	lcpa_library_t *lib;
+	uint32_t nframes;
+
+	if (len < LCPA_LIBRARY_HDRLEN || memcmp(buf, "LCPA", 4) != 0)
+		return NULL;
+
+	/* Newer versions may change the record layout */
+	if ((buf[4] | (buf[5] << 8)) > LCPA_SERIAL_VERSION ||
+			buf[6] < LCPA_LIBRARY_HDRLEN)
+		return NULL;
+
+	nframes = lcpa_get32(buf + 8);
+
+	if ((uint64_t) buf[6] + ((uint64_t) nframes * 4) > len)
+		return NULL;
+
+	if ((lib = (lcpa_library_t *) malloc(sizeof(lcpa_library_t))) == NULL)
+		return NULL;
+
+	lib->base = buf;
+	lib->len = len;
+	lib->mapped = 0;
+	lib->num_frames = nframes;
+	lib->index = buf + buf[6];
+
+	return lib;
+}
+
+lcpa_library_t *lcpa_library_open(const char *path) {
+	lcpa_library_t *lib;
+	struct stat st;
+	uint8_t *base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < LCPA_LIBRARY_HDRLEN) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Private and writable, so rebuilt frames can be edited in place
+	 * without touching the file */
+	base = (uint8_t *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (base == MAP_FAILED)
+		return NULL;
+
+	if ((lib = lcpa_library_open_buffer(base, st.st_size)) == NULL) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	lib->mapped = 1;
+
+	return lib;
+}
+
+void lcpa_library_close(lcpa_library_t *lib) {
+	if (lib->mapped)
+		munmap(lib->base, lib->len);
+
+	free(lib);
+}
+
+int lcpa_library_count(lcpa_library_t *lib) {
+	return (int) lib->num_frames;
+}
+
+/* Locate and validate record n */
+static uint8_t *lcpa_library_record(lcpa_library_t *lib, int n,
+		int *ret_len, uint32_t *ret_ncomp, uint32_t *ret_dlen) {
+	uint32_t offt;
+
+	if (n < 0 || (uint32_t) n >= lib->num_frames)
+		return NULL;
+
+	offt = lcpa_get32(lib->index + (n * 4));
+
+	if (offt >= lib->len)
+		return NULL;
+
+	*ret_len = lcpa_record_check(lib->base + offt, lib->len - offt,
+			ret_ncomp, ret_dlen);
+
+	if (*ret_len < 0)
+		return NULL;
+
+	return lib->base + offt;
+}
+
+uint8_t *lcpa_library_frame_bytes(lcpa_library_t *lib, int n, int *ret_len) {
+	uint8_t *rec;
+	uint32_t ncomp, dlen;
+	int rlen;
+
+	if ((rec = lcpa_library_record(lib, n, &rlen, &ncomp, &dlen)) == NULL)
+		return NULL;
+
+	*ret_len = (int) dlen;
+
+	return rec + LCPA_SERIAL_HDRLEN + (ncomp * LCPA_SERIAL_COMPLEN);
+}
+
+struct lcpa_metapack *lcpa_library_frame(lcpa_library_t *lib, int n) {
+	uint8_t *rec;
+	uint32_t ncomp, dlen;
+	int rlen;
+
+	if ((rec = lcpa_library_record(lib, n, &rlen, &ncomp, &dlen)) == NULL)
+		return NULL;
+
+	return lcpa_deserialize(rec, rlen, 0);
+}
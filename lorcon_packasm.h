@@ -63,6 +63,11 @@ struct lcpa_metapack {
 	/* Do we free this data when we free the list, or is it controlled
 	 * by the user application? */
 	int freedata;
+
+	/* Shared data is released through this callback instead of being
+	 * freed, see lcpa_append_shared() */
+	void (*release)(void *aux);
+	void *release_aux;
 };
 typedef struct lcpa_metapack lcpa_metapack_t;
 
@@ -92,6 +97,19 @@ struct lcpa_metapack *lcpa_append(struct lcpa_metapack *in_pack,
                                   const char *in_type,
 								  int in_len, uint8_t *in_data);
 
+/* Append a shared data item to a list.  The data is NOT copied; instead
+ * release(release_aux) is called when the component is freed or its data
+ * is replaced.  This allows reference-counted data (such as forge IE blocks)
+ * to be attached to any number of lists.
+ *
+ * The new component is returned.
+ */
+struct lcpa_metapack *lcpa_append_shared(struct lcpa_metapack *in_pack,
+                                         const char *in_type,
+                                         int in_len, uint8_t *in_data,
+                                         void (*release)(void *),
+                                         void *release_aux);
+
 /* Insert a component into the packet.  This copied data will be freed when the list
  * is freed, and the caller may destroy the original data at will.
  * in_pack may be any component of the list.  Data will be inserted after
@@ -169,5 +187,93 @@ int lcpa_size(struct lcpa_metapack *in_head);
  * for providing a bytestream of sufficient length. */
 void lcpa_freeze(struct lcpa_metapack *in_head, u_char *bytes);
 
+/*
+ * Serialized packets and frame libraries
+ *
+ * A packet list can be stored in a compact binary record which keeps the
+ * component names, boundaries and data ownership.  The component data is
+ * stored frozen and contiguous, so the frame can be injected straight from
+ * the record.  All fields are little endian; records are padded to 8 bytes.
+ *
+ * Record:
+ *   uint32 record length (including header and padding)
+ *   uint32 number of components
+ *   uint32 frozen data length
+ *   uint32 reserved (0)
+ *   components * { char type[24]; uint32 len; uint32 flags; }
+ *   frozen data
+ *
+ * A frame library is a file of records:
+ *   "LCPA", uint16 version, uint16 header length, uint32 number of frames,
+ *   uint32 reserved, frames * uint32 record offset, records
+ *
+ * Libraries are mapped rather than read; fetching a frame does not allocate
+ * or copy anything.
+ */
+
+#define LCPA_SERIAL_VERSION     1
+
+/* Component owned its data (freedata) */
+#define LCPA_SERIAL_F_OWNED     (1 << 0)
+/* Component data was shared through lcpa_append_shared() */
+#define LCPA_SERIAL_F_SHARED    (1 << 1)
+
+/* Size of the serialized record for a packet */
+int lcpa_serialize_size(struct lcpa_metapack *in_head);
+
+/* Serialize a packet into buf.  Returns the number of bytes written, or -1
+ * if buf_len is too small */
+int lcpa_serialize(struct lcpa_metapack *in_head, uint8_t *buf, int buf_len);
+
+/* Rebuild a packet list from a serialized record.
+ *
+ * If copy is 0 no component data is copied; every component references buf
+ * and buf MUST remain valid until the list is freed.
+ *
+ * If copy is non-zero, components which owned their data when serialized
+ * are copied and owned by the new list.  Components which did not own their
+ * data still reference buf, as they referenced caller memory originally.
+ *
+ * Returns NULL if the record is malformed or truncated.
+ */
+struct lcpa_metapack *lcpa_deserialize(uint8_t *buf, int buf_len, int copy);
+
+struct lcpa_library {
+	uint8_t *base;
+	size_t len;
+
+	/* Mapped from a file, unmapped on close */
+	int mapped;
+
+	uint32_t num_frames;
+	uint8_t *index;
+};
+typedef struct lcpa_library lcpa_library_t;
+
+/* Write a library of frames to a file.  Returns 0, or -1 on error with
+ * errno set */
+int lcpa_library_write(const char *path, struct lcpa_metapack **frames,
+		int num_frames);
+
+/* Map a library file.  The mapping is private; changes made through frames
+ * rebuilt from it are never written back.  Returns NULL on error */
+lcpa_library_t *lcpa_library_open(const char *path);
+
+/* Use a library already in memory; buf must remain valid until the library
+ * is closed */
+lcpa_library_t *lcpa_library_open_buffer(uint8_t *buf, size_t len);
+
+void lcpa_library_close(lcpa_library_t *lib);
+
+int lcpa_library_count(lcpa_library_t *lib);
+
+/* Frozen bytes of frame n, pointing into the library.  Returns NULL if n is
+ * out of range or the record is malformed */
+uint8_t *lcpa_library_frame_bytes(lcpa_library_t *lib, int n, int *ret_len);
+
+/* Rebuild frame n as a packet list referencing the library (see
+ * lcpa_deserialize with copy 0) */
+struct lcpa_metapack *lcpa_library_frame(lcpa_library_t *lib, int n);
+
 #endif
 
@@ -38,6 +38,7 @@
 #include "lorcon_packasm.h"
 #include "lorcon_forge.h"
 #include "lorcon_int.h"
+#include "lorcon_crc32.h"
 #include "ieee80211.h"
 
 /* for DLT_PRISM_HEADER */
@@ -73,6 +74,10 @@
 #define IEEE80211_RADIOTAP_F_FCS        0x10    /* frame includes FCS */
 #endif
 
+#ifndef IEEE80211_RADIOTAP_F_BADFCS
+#define IEEE80211_RADIOTAP_F_BADFCS     0x40    /* frame failed FCS check */
+#endif
+
 #ifndef IEEE80211_IOC_CHANNEL
 #define IEEE80211_IOC_CHANNEL 0
 #endif
@@ -201,6 +206,9 @@ void lorcon_packet_free(lorcon_packet_t *packet) {
 			lcpa_free(packet->lcpa);
 	}
 
+	/* Decode info is always ours */
+	free(packet->extra_info);
+
 	free(packet);
 }
 
@@ -222,7 +230,9 @@ int lorcon_packet_decode(lorcon_packet_t *packet) {
 	radiotap_header *rtaphdr = (radiotap_header *) packet->packet_raw;
 	int innerdlt = packet->dlt, offt = 0, rtpos = 0;
 	u_int16_t *pu16, eu16, fcs = 0;
-	u_int8_t rt_wr_flags;
+	u_int8_t rt_wr_flags = 0;
+	u_int32_t rt_present, rt_word;
+	int rtlen;
 	struct lorcon_dot11_extra *extra;
     struct lorcon_dot3_extra *dot3extra;
 
@@ -264,24 +274,64 @@ int lorcon_packet_decode(lorcon_packet_t *packet) {
 			packet->packet_header = &(packet->packet_raw[lorcon_le16(rtaphdr->it_len)]);
 			packet->length_header = packet->length - lorcon_le16(rtaphdr->it_len);
 
-			if (rtpos < packet->length &&
-				(rtaphdr->it_present & BIT(TX_IEEE80211_RADIOTAP_TSFT))) {
-				rtpos += 8;
+			rtlen = lorcon_le16(rtaphdr->it_len);
+			rt_present = lorcon_le32(rtaphdr->it_present);
+
+			/* Fields start after any extended presence bitmaps, and are
+			 * aligned to their natural size from the start of the header */
+			rtpos = sizeof(radiotap_header);
+			rt_word = rt_present;
+
+			while ((rt_word & BIT(TX_IEEE80211_RADIOTAP_EXT)) && rtpos + 4 <= rtlen) {
+				memcpy(&rt_word, &(packet->packet_raw[rtpos]), 4);
+				rt_word = lorcon_le32(rt_word);
+				rtpos += 4;
 			}
 
-			if (rtpos < packet->length &&
-				(rtaphdr->it_present & BIT(TX_IEEE80211_RADIOTAP_FLAGS))) {
+			if (rt_present & BIT(TX_IEEE80211_RADIOTAP_TSFT))
+				rtpos = ((rtpos + 7) & ~7) + 8;
 
-				rt_wr_flags = packet->packet_raw[sizeof(radiotap_header) + rtpos];
-				rtpos += 1;
+			if (rt_present & BIT(TX_IEEE80211_RADIOTAP_FLAGS)) {
+				if (rtpos < rtlen) {
+					rt_wr_flags = packet->packet_raw[rtpos];
 
-				if (rt_wr_flags & IEEE80211_RADIOTAP_F_FCS) {
-					fcs = 1;
+					if (rt_wr_flags & IEEE80211_RADIOTAP_F_FCS) {
+						fcs = 1;
+					}
 				}
+
+				rtpos += 1;
+			}
+
+			if (rt_present & BIT(TX_IEEE80211_RADIOTAP_RATE))
+				rtpos += 1;
+
+			if (rt_present & BIT(TX_IEEE80211_RADIOTAP_CHANNEL))
+				rtpos = ((rtpos + 1) & ~1) + 4;
+
+			if (rt_present & BIT(TX_IEEE80211_RADIOTAP_FHSS))
+				rtpos += 2;
+
+			if ((rt_present & BIT(TX_IEEE80211_RADIOTAP_DBM_ANTSIGNAL)) && 
+				rtpos < rtlen) {
+				packet->signal_dbm = (int8_t) packet->packet_raw[rtpos];
+				packet->signal_present = 1;
 			}
 
 			if (fcs && packet->length_header > 4) {
 				packet->length_header -= 4;
+				packet->fcs_present = 1;
+
+				/* Trust the driver if it already flagged the frame, otherwise
+				 * check it ourselves if the context asked for it */
+				if (rt_wr_flags & IEEE80211_RADIOTAP_F_BADFCS) {
+					packet->fcs_bad = 1;
+				} else if (packet->interface != NULL &&
+						packet->interface->validate_fcs) {
+					packet->fcs_bad = 
+						!lorcon_crc32_check(packet->packet_header, 
+								packet->length_header + 4);
+				}
 			}
 
 			innerdlt = DLT_IEEE802_11;
@@ -320,6 +370,8 @@ int lorcon_packet_decode(lorcon_packet_t *packet) {
 		packet->extra_info = extra;
 		packet->extra_type = LORCON_PACKET_EXTRA_80211;
 
+		extra->corrupt = packet->fcs_bad;
+
 		extra->type = WLAN_FC_FRAMETYPE(packet->packet_header[0]);
 		extra->subtype = WLAN_FC_FRAMESUBTYPE(packet->packet_header[0]);
 
@@ -455,9 +507,10 @@ lorcon_packet_t *lorcon_packet_from_lcpa(struct lorcon *context,
 	return l_packet;
 }
 
-lorcon_packet_t *lorcon_packet_from_pcap(lorcon_t *context,
-										 const struct pcap_pkthdr *h, 
-										 const u_char *bytes) {
+/* Build a packet from pcap data without treating it as a new capture */
+static lorcon_packet_t *lorcon_packet_build(lorcon_t *context,
+											const struct pcap_pkthdr *h,
+											const u_char *bytes) {
 	lorcon_packet_t *l_packet;
 
 	if (bytes == NULL)
@@ -476,6 +529,21 @@ lorcon_packet_t *lorcon_packet_from_pcap(lorcon_t *context,
 	l_packet->length_header = 0;
 	l_packet->length_data = 0;
 	l_packet->channel = 0;
+
+	l_packet->fcs_present = 0;
+	l_packet->fcs_bad = 0;
+
+	l_packet->signal_present = 0;
+	l_packet->signal_dbm = 0;
+
+	l_packet->num_receivers = 0;
+
+	l_packet->tuned_epoch = 0;
+	l_packet->tuned_freq = 0;
+	l_packet->tuned_type = 0;
+	l_packet->tuned_center_freq_1 = 0;
+	l_packet->tuned_center_freq_2 = 0;
+	l_packet->channel_ambiguous = 0;
 	
 	l_packet->free_data = 0;
 
@@ -486,11 +554,70 @@ lorcon_packet_t *lorcon_packet_from_pcap(lorcon_t *context,
 	l_packet->packet_header = NULL;
 	l_packet->packet_data = NULL;
 
+	l_packet->extra_info = NULL;
+	l_packet->extra_type = LORCON_PACKET_EXTRA_NONE;
+
+	l_packet->set_tx_mcs = 0;
+
 	lorcon_packet_decode(l_packet);
 
 	return l_packet;
 }
 
+lorcon_packet_t *lorcon_packet_from_pcap(lorcon_t *context,
+										 const struct pcap_pkthdr *h, 
+										 const u_char *bytes) {
+	lorcon_packet_t *l_packet;
+
+	if ((l_packet = lorcon_packet_build(context, h, bytes)) == NULL)
+		return NULL;
+
+	lorcon_channel_stamp(context, l_packet);
+
+	if (context->hop != NULL)
+		lorcon_hop_stamp(context->hop, l_packet);
+
+	return l_packet;
+}
+
+lorcon_packet_t *lorcon_packet_dup(lorcon_packet_t *packet) {
+	lorcon_packet_t *l_packet;
+	struct pcap_pkthdr h;
+	u_char *copy;
+
+	if (packet->packet_raw == NULL || packet->interface == NULL)
+		return NULL;
+
+	if ((copy = (u_char *) malloc(packet->length)) == NULL)
+		return NULL;
+
+	memcpy(copy, packet->packet_raw, packet->length);
+
+	h.ts.tv_sec = packet->ts.tv_sec;
+	h.ts.tv_usec = packet->ts.tv_usec;
+	h.caplen = h.len = packet->length;
+
+	if ((l_packet = lorcon_packet_build(packet->interface, &h, copy)) == NULL) {
+		free(copy);
+		return NULL;
+	}
+
+	l_packet->free_data = 1;
+	l_packet->channel = packet->channel;
+
+	l_packet->tuned_epoch = packet->tuned_epoch;
+	l_packet->tuned_freq = packet->tuned_freq;
+	l_packet->tuned_type = packet->tuned_type;
+	l_packet->tuned_center_freq_1 = packet->tuned_center_freq_1;
+	l_packet->tuned_center_freq_2 = packet->tuned_center_freq_2;
+	l_packet->channel_ambiguous = packet->channel_ambiguous;
+
+	memcpy(l_packet->receivers, packet->receivers, sizeof(packet->receivers));
+	l_packet->num_receivers = packet->num_receivers;
+
+	return l_packet;
+}
+
 int lorcon_packet_txprep_by_ctx(lorcon_t *context, lorcon_packet_t *packet,
 								u_char **data) {
 	u_char *ret;
@@ -552,62 +679,6 @@ int lorcon_packet_txprep_by_ctx(lorcon_t *context, lorcon_packet_t *packet,
 	return rlen;
 }
 
-/* CRC32 index for verifying WEP - cribbed from ethereal */
-static const uint32_t wep_crc32_table[256] = {
-    0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
-    0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
-    0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
-    0x90bf1d91L, 0x1db71064L, 0x6ab020f2L, 0xf3b97148L, 0x84be41deL,
-    0x1adad47dL, 0x6ddde4ebL, 0xf4d4b551L, 0x83d385c7L, 0x136c9856L,
-    0x646ba8c0L, 0xfd62f97aL, 0x8a65c9ecL, 0x14015c4fL, 0x63066cd9L,
-    0xfa0f3d63L, 0x8d080df5L, 0x3b6e20c8L, 0x4c69105eL, 0xd56041e4L,
-    0xa2677172L, 0x3c03e4d1L, 0x4b04d447L, 0xd20d85fdL, 0xa50ab56bL,
-    0x35b5a8faL, 0x42b2986cL, 0xdbbbc9d6L, 0xacbcf940L, 0x32d86ce3L,
-    0x45df5c75L, 0xdcd60dcfL, 0xabd13d59L, 0x26d930acL, 0x51de003aL,
-    0xc8d75180L, 0xbfd06116L, 0x21b4f4b5L, 0x56b3c423L, 0xcfba9599L,
-    0xb8bda50fL, 0x2802b89eL, 0x5f058808L, 0xc60cd9b2L, 0xb10be924L,
-    0x2f6f7c87L, 0x58684c11L, 0xc1611dabL, 0xb6662d3dL, 0x76dc4190L,
-    0x01db7106L, 0x98d220bcL, 0xefd5102aL, 0x71b18589L, 0x06b6b51fL,
-    0x9fbfe4a5L, 0xe8b8d433L, 0x7807c9a2L, 0x0f00f934L, 0x9609a88eL,
-    0xe10e9818L, 0x7f6a0dbbL, 0x086d3d2dL, 0x91646c97L, 0xe6635c01L,
-    0x6b6b51f4L, 0x1c6c6162L, 0x856530d8L, 0xf262004eL, 0x6c0695edL,
-    0x1b01a57bL, 0x8208f4c1L, 0xf50fc457L, 0x65b0d9c6L, 0x12b7e950L,
-    0x8bbeb8eaL, 0xfcb9887cL, 0x62dd1ddfL, 0x15da2d49L, 0x8cd37cf3L,
-    0xfbd44c65L, 0x4db26158L, 0x3ab551ceL, 0xa3bc0074L, 0xd4bb30e2L,
-    0x4adfa541L, 0x3dd895d7L, 0xa4d1c46dL, 0xd3d6f4fbL, 0x4369e96aL,
-    0x346ed9fcL, 0xad678846L, 0xda60b8d0L, 0x44042d73L, 0x33031de5L,
-    0xaa0a4c5fL, 0xdd0d7cc9L, 0x5005713cL, 0x270241aaL, 0xbe0b1010L,
-    0xc90c2086L, 0x5768b525L, 0x206f85b3L, 0xb966d409L, 0xce61e49fL,
-    0x5edef90eL, 0x29d9c998L, 0xb0d09822L, 0xc7d7a8b4L, 0x59b33d17L,
-    0x2eb40d81L, 0xb7bd5c3bL, 0xc0ba6cadL, 0xedb88320L, 0x9abfb3b6L,
-    0x03b6e20cL, 0x74b1d29aL, 0xead54739L, 0x9dd277afL, 0x04db2615L,
-    0x73dc1683L, 0xe3630b12L, 0x94643b84L, 0x0d6d6a3eL, 0x7a6a5aa8L,
-    0xe40ecf0bL, 0x9309ff9dL, 0x0a00ae27L, 0x7d079eb1L, 0xf00f9344L,
-    0x8708a3d2L, 0x1e01f268L, 0x6906c2feL, 0xf762575dL, 0x806567cbL,
-    0x196c3671L, 0x6e6b06e7L, 0xfed41b76L, 0x89d32be0L, 0x10da7a5aL,
-    0x67dd4accL, 0xf9b9df6fL, 0x8ebeeff9L, 0x17b7be43L, 0x60b08ed5L,
-    0xd6d6a3e8L, 0xa1d1937eL, 0x38d8c2c4L, 0x4fdff252L, 0xd1bb67f1L,
-    0xa6bc5767L, 0x3fb506ddL, 0x48b2364bL, 0xd80d2bdaL, 0xaf0a1b4cL,
-    0x36034af6L, 0x41047a60L, 0xdf60efc3L, 0xa867df55L, 0x316e8eefL,
-    0x4669be79L, 0xcb61b38cL, 0xbc66831aL, 0x256fd2a0L, 0x5268e236L,
-    0xcc0c7795L, 0xbb0b4703L, 0x220216b9L, 0x5505262fL, 0xc5ba3bbeL,
-    0xb2bd0b28L, 0x2bb45a92L, 0x5cb36a04L, 0xc2d7ffa7L, 0xb5d0cf31L,
-    0x2cd99e8bL, 0x5bdeae1dL, 0x9b64c2b0L, 0xec63f226L, 0x756aa39cL,
-    0x026d930aL, 0x9c0906a9L, 0xeb0e363fL, 0x72076785L, 0x05005713L,
-    0x95bf4a82L, 0xe2b87a14L, 0x7bb12baeL, 0x0cb61b38L, 0x92d28e9bL,
-    0xe5d5be0dL, 0x7cdcefb7L, 0x0bdbdf21L, 0x86d3d2d4L, 0xf1d4e242L,
-    0x68ddb3f8L, 0x1fda836eL, 0x81be16cdL, 0xf6b9265bL, 0x6fb077e1L,
-    0x18b74777L, 0x88085ae6L, 0xff0f6a70L, 0x66063bcaL, 0x11010b5cL,
-    0x8f659effL, 0xf862ae69L, 0x616bffd3L, 0x166ccf45L, 0xa00ae278L,
-    0xd70dd2eeL, 0x4e048354L, 0x3903b3c2L, 0xa7672661L, 0xd06016f7L,
-    0x4969474dL, 0x3e6e77dbL, 0xaed16a4aL, 0xd9d65adcL, 0x40df0b66L,
-    0x37d83bf0L, 0xa9bcae53L, 0xdebb9ec5L, 0x47b2cf7fL, 0x30b5ffe9L,
-    0xbdbdf21cL, 0xcabac28aL, 0x53b39330L, 0x24b4a3a6L, 0xbad03605L,
-    0xcdd70693L, 0x54de5729L, 0x23d967bfL, 0xb3667a2eL, 0xc4614ab8L,
-    0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
-    0x2d02ef8dL
-};
-
 lorcon_packet_t *lorcon_packet_decrypt(lorcon_t *context, lorcon_packet_t *packet) {
 	lorcon_packet_t *ret;
 	lorcon_wep_t *wepidx = context->wepkeys;
@@ -88,6 +88,8 @@ enum lorcon_mod_flags {
 #define LORCON_RATE_54MB 		108
 #define LORCON_RATE_108MB 		216
 
+#define LORCON_PACKET_MAX_RECEIVERS		8
+
 struct lorcon_packet {
 	struct timeval ts;
 	int dlt;
@@ -128,6 +130,33 @@ struct lorcon_packet {
     unsigned int tx_mcs_rate;
     unsigned int tx_mcs_short_guard;
     unsigned int tx_mcs_40mhz;
+
+    /* Captured frame carried an FCS (which has been trimmed from
+     * length_header), and whether it was flagged bad by the driver or by
+     * lorcon_set_fcs_validate() */
+    int fcs_present;
+    int fcs_bad;
+
+    /* Antenna signal in dBm, when the capture header carries it */
+    int signal_present;
+    int signal_dbm;
+
+    /* Channel the interface was tuned to when the frame arrived, from the
+     * channel epoch (see lorcon_get_channel_epoch): frequency, channel type
+     * and center frequencies.  0 if lorcon hasn't changed the channel.
+     * channel_ambiguous is set if the frame arrived while the channel was
+     * changing, so it may have been heard on the previous channel */
+    unsigned int tuned_epoch;
+    unsigned int tuned_freq;
+    unsigned int tuned_type;
+    unsigned int tuned_center_freq_1;
+    unsigned int tuned_center_freq_2;
+    int channel_ambiguous;
+
+    /* Interfaces which received this frame, when duplicates from several
+     * interfaces have been merged (see lorcon_multi_set_dedup) */
+    struct lorcon *receivers[LORCON_PACKET_MAX_RECEIVERS];
+    int num_receivers;
 };
 typedef struct lorcon_packet lorcon_packet_t;
 
@@ -183,6 +212,12 @@ lorcon_packet_t *lorcon_packet_from_pcap(struct lorcon *context,
 										 const struct pcap_pkthdr *h, 
 										 const u_char *bytes);
 
+/* Copy a captured packet so it remains valid after the capture callback
+ * returns (packets passed to a lorcon_loop handler point into the capture
+ * buffer).  The copy owns its data.  Returns NULL if the packet has no raw
+ * data or interface */
+lorcon_packet_t *lorcon_packet_dup(lorcon_packet_t *packet);
+
 /* Transform a lorcon packet into a bytestream for injection via the settings in
  * the LORCON context (IE DLT translation is controlled by the context DLT, most
  * contexts will use this).  Caller is responsible for freeing bytes */
@@ -0,0 +1,179 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "lorcon_rand.h"
+
+static __thread lorcon_rand_t thread_rand;
+static __thread int thread_rand_init = 0;
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Pull a seed from the kernel, falling back to time and pid if /dev/urandom
+ * is not available (chroots, early boot) */
+static uint64_t lorcon_rand_sysseed(void *salt) {
+    uint64_t seed = 0;
+    struct timeval tv;
+    int fd;
+
+    if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+        if (read(fd, &seed, sizeof(seed)) != sizeof(seed))
+            seed = 0;
+        close(fd);
+    }
+
+    if (seed == 0) {
+        gettimeofday(&tv, NULL);
+        seed = ((uint64_t) tv.tv_sec << 20) ^ (uint64_t) tv.tv_usec ^
+            ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) salt;
+    }
+
+    return seed;
+}
+
+void lorcon_rand_seed(lorcon_rand_t *r, uint64_t seed) {
+    uint64_t x = seed;
+
+    r->s[0] = splitmix64(&x);
+    r->s[1] = splitmix64(&x);
+    r->s[2] = splitmix64(&x);
+    r->s[3] = splitmix64(&x);
+}
+
+lorcon_rand_t *lorcon_rand_create(uint64_t seed) {
+    lorcon_rand_t *r = (lorcon_rand_t *) malloc(sizeof(lorcon_rand_t));
+
+    if (r == NULL)
+        return NULL;
+
+    if (seed == 0)
+        seed = lorcon_rand_sysseed(r);
+
+    lorcon_rand_seed(r, seed);
+
+    return r;
+}
+
+void lorcon_rand_free(lorcon_rand_t *r) {
+    free(r);
+}
+
+lorcon_rand_t *lorcon_rand_thread() {
+    if (!thread_rand_init) {
+        lorcon_rand_seed(&thread_rand, lorcon_rand_sysseed(&thread_rand));
+        thread_rand_init = 1;
+    }
+
+    return &thread_rand;
+}
+
+void lorcon_rand_thread_seed(uint64_t seed) {
+    lorcon_rand_seed(&thread_rand, seed);
+    thread_rand_init = 1;
+}
+
+/* xoshiro256** */
+uint64_t lorcon_rand_next64(lorcon_rand_t *r) {
+    uint64_t result = rotl64(r->s[1] * 5, 7) * 9;
+    uint64_t t = r->s[1] << 17;
+
+    r->s[2] ^= r->s[0];
+    r->s[3] ^= r->s[1];
+    r->s[1] ^= r->s[2];
+    r->s[0] ^= r->s[3];
+
+    r->s[2] ^= t;
+    r->s[3] = rotl64(r->s[3], 45);
+
+    return result;
+}
+
+uint32_t lorcon_rand_next32(lorcon_rand_t *r) {
+    return (uint32_t) (lorcon_rand_next64(r) >> 32);
+}
+
+/* Lemire's multiply-and-reject method; the retry is taken with probability
+ * bound / 2^32 at worst, so it almost never loops */
+uint32_t lorcon_rand_bounded(lorcon_rand_t *r, uint32_t bound) {
+    uint64_t m;
+    uint32_t l, t;
+
+    if (bound == 0)
+        return 0;
+
+    m = (uint64_t) lorcon_rand_next32(r) * bound;
+    l = (uint32_t) m;
+
+    if (l < bound) {
+        t = -bound % bound;
+
+        while (l < t) {
+            m = (uint64_t) lorcon_rand_next32(r) * bound;
+            l = (uint32_t) m;
+        }
+    }
+
+    return (uint32_t) (m >> 32);
+}
+
+/* Bytes are taken least-significant first so a seed produces the same byte
+ * stream regardless of host endian */
+void lorcon_rand_fill(lorcon_rand_t *r, uint8_t *buf, size_t len) {
+    uint64_t v;
+    unsigned int b;
+
+    while (len >= 8) {
+        v = lorcon_rand_next64(r);
+
+        for (b = 0; b < 8; b++)
+            buf[b] = (uint8_t) (v >> (b * 8));
+
+        buf += 8;
+        len -= 8;
+    }
+
+    if (len > 0) {
+        v = lorcon_rand_next64(r);
+
+        for (b = 0; b < len; b++)
+            buf[b] = (uint8_t) (v >> (b * 8));
+    }
+}
+
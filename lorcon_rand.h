@@ -0,0 +1,70 @@
+/*
+    This file is part of lorcon
+
+    lorcon is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    lorcon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with lorcon; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/* LORCON RANDOM
+ *
+ * Small, fast pseudo-random generator used by the packet forge helpers
+ * (xoshiro256** seeded via splitmix64).  This is NOT a cryptographic RNG;
+ * it exists so that frame generation and fuzzing do not contend on the
+ * libc rand() lock and so that runs can be reproduced from a seed.
+ *
+ * Each lorcon_rand_t is independent and must not be shared between threads
+ * without external locking.  Helpers which are not given an explicit
+ * generator use a per-thread generator, see lorcon_rand_thread().
+ */
+
+#ifndef __LORCON_RAND_H__
+#define __LORCON_RAND_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct lorcon_rand {
+    uint64_t s[4];
+};
+typedef struct lorcon_rand lorcon_rand_t;
+
+/* Allocate a generator seeded with `seed'.  A seed of 0 requests a seed
+ * from the system entropy source */
+lorcon_rand_t *lorcon_rand_create(uint64_t seed);
+void lorcon_rand_free(lorcon_rand_t *r);
+
+/* Re-seed an existing (possibly stack-allocated) generator.  The same seed
+ * always produces the same sequence, on every platform. */
+void lorcon_rand_seed(lorcon_rand_t *r, uint64_t seed);
+
+/* Per-thread generator used by the forge helpers when no generator is
+ * supplied.  It is seeded from system entropy on first use unless
+ * lorcon_rand_thread_seed() is called first. */
+lorcon_rand_t *lorcon_rand_thread();
+void lorcon_rand_thread_seed(uint64_t seed);
+
+/* Next 64 or 32 bits of output */
+uint64_t lorcon_rand_next64(lorcon_rand_t *r);
+uint32_t lorcon_rand_next32(lorcon_rand_t *r);
+
+/* Uniform value in [0, bound), without modulo bias.  A bound of 0 returns 0. */
+uint32_t lorcon_rand_bounded(lorcon_rand_t *r, uint32_t bound);
+
+/* Fill `len' bytes of `buf' with random data; every byte value, including
+ * 0xFF, is reachable */
+void lorcon_rand_fill(lorcon_rand_t *r, uint8_t *buf, size_t len);
+
+#endif
+
@@ -44,21 +44,37 @@
 
 #include "nl80211.h"
 #include <net/if.h>
+
+/* Newer than our copy of nl80211.h */
+#define NL80211_CHAN_WIDTH_320_COMPAT   13
+
+/* Per-iftype HE and EHT capabilities of a band, nested under
+ * NL80211_BAND_ATTR_IFTYPE_DATA */
+#define NL80211_BAND_ATTR_IFTYPE_DATA_COMPAT        9
+#define NL80211_BAND_ATTR_MAX_COMPAT                NL80211_BAND_ATTR_IFTYPE_DATA_COMPAT
+#define NL80211_BAND_IFTYPE_ATTR_HE_CAP_PHY_COMPAT  3
+#define NL80211_BAND_IFTYPE_ATTR_EHT_CAP_PHY_COMPAT 9
+#define NL80211_BAND_IFTYPE_ATTR_MAX_COMPAT         NL80211_BAND_IFTYPE_ATTR_EHT_CAP_PHY_COMPAT
 #endif
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include "nl80211_control.h"
-#include "wifi_ht_channels.h"
+#include "lorcon_chandb.h"
 
 // Libnl1->Libnl2 compatability mode since the API changed, cribbed from 'iw'
 #if defined(HAVE_LIBNL10)
 
 #define nl_sock nl_handle
+#define nl_socket_disable_seq_check nl_disable_sequence_check
+#define NLE_AGAIN EAGAIN
 
 static inline struct nl_handle *nl_socket_alloc(void) {
 #ifdef HAVE_LINUX_NETLINK
@@ -78,38 +94,60 @@ static inline void nl_socket_free(struct nl_sock *h) {
 
 #endif
 
+#ifdef HAVE_LINUX_NETLINK
+/* Control socket shared by every context for synchronous requests; see
+ * nl80211_control_acquire() */
+static pthread_mutex_t nl80211_control_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *nl80211_control_sock = NULL;
+static int nl80211_control_id = -1;
+#endif
 
-int ChanToFreq(int in_chan) {
-    /* 802.11 channels to frequency; if it looks like a frequency, return as
-     * pure frequency; derived from iwconfig */
-
-    if (in_chan > 250)
-        return in_chan;
+int nl80211_control_acquire(void **nl_sock, int *nl80211_id, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    pthread_mutex_lock(&nl80211_control_lock);
 
-    if (in_chan == 14)
-        return 2484;
-    else if (in_chan < 14)
-        return 2407 + in_chan * 5;
-    else if (in_chan >= 182 && in_chan <= 196)
-        return 4000 + in_chan * 5;
-    else
-        return 5000 + in_chan * 5;
+    if (nl80211_control_sock == NULL) {
+        if ((nl80211_control_sock = nl_socket_alloc()) == NULL) {
+            snprintf(errstr, LORCON_STATUS_MAX, 
+                    "unable to connect to netlink: could not allocate netlink socket");
+            pthread_mutex_unlock(&nl80211_control_lock);
+            return -1;
+        }
 
-    return in_chan;
-}
+        if (genl_connect(nl80211_control_sock) ||
+                (nl80211_control_id = genl_ctrl_resolve(nl80211_control_sock,
+                                                        "nl80211")) < 0) {
+            snprintf(errstr, LORCON_STATUS_MAX, 
+                    "unable to connect to netlink: could not connect to nl80211");
+            nl_socket_free(nl80211_control_sock);
+            nl80211_control_sock = NULL;
+            pthread_mutex_unlock(&nl80211_control_lock);
+            return -1;
+        }
+    }
 
-int FreqToChan(int in_freq) {
-    if (in_freq < 250)
-        return in_freq;
+    *nl_sock = nl80211_control_sock;
+    *nl80211_id = nl80211_control_id;
 
-    /* revamped from iw */
-    if (in_freq == 2484)
-        return 14;
+    return 0;
+#endif
+}
 
-    if (in_freq < 2484)
-        return (in_freq - 2407) / 5;
+void nl80211_control_release(int failed) {
+#ifdef HAVE_LINUX_NETLINK
+    /* Replies to a failed request may still be queued; start afresh rather
+     * than hand them to the next caller */
+    if (failed && nl80211_control_sock != NULL) {
+        nl_socket_free(nl80211_control_sock);
+        nl80211_control_sock = NULL;
+    }
 
-    return in_freq / 5 - 1000;
+    pthread_mutex_unlock(&nl80211_control_lock);
+#endif
 }
 
 int nl80211_connect(const char *interface, void **nl_sock, 
@@ -121,14 +159,14 @@ int nl80211_connect(const char *interface, void **nl_sock,
     return -1;
 #else
 
-    if ((*if_index = if_nametoindex(interface)) < 0) {
+    if ((*if_index = if_nametoindex(interface)) == 0) {
         snprintf(errstr, LORCON_STATUS_MAX,
                 "cannot connect to netlink:  Could not find interface '%s'", interface);
         return -1;
     }
 
     *nl_sock = nl_socket_alloc();
-    if (!nl_sock) {
+    if (!*nl_sock) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to connect to netlink: could not allocate netlink socket");
         return -1;
@@ -137,15 +175,18 @@ int nl80211_connect(const char *interface, void **nl_sock,
     if (genl_connect(*nl_sock)) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to connect to netlink: could not connect to generic netlink");
-        return -1;
         nl_socket_free(*nl_sock);
+        *nl_sock = NULL;
+        return -1;
     }
 
     *nl80211_id = genl_ctrl_resolve(*nl_sock, "nl80211");
-    if (nl80211_id < 0) {
+    if (*nl80211_id < 0) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to connect to netlink: could not resolve nl80211");
         nl_socket_free(*nl_sock);
+        *nl_sock = NULL;
+        return -1;
     }
 
     return 0;
@@ -175,34 +216,10 @@ int nl80211_createvif(const char *interface, const char *newinterface,
     if (if_nametoindex(newinterface) > 0) 
         return 1;
 
-    nl_sock = nl_socket_alloc();
-    if (!nl_sock) {
-        snprintf(errstr, LORCON_STATUS_MAX, 
-                "unable to create monitor vif %s:%s, unable to allocate netlink socket",
-                interface, newinterface);
-        return -1;
-    }
-
-    if (genl_connect(nl_sock)) {
-        snprintf(errstr, LORCON_STATUS_MAX, 
-                "unable to create monitor vif %s:%s, unable to connect generic netlink",
-                interface, newinterface);
-        nl_socket_free(nl_sock);
-    }
-
-    nl80211_id = genl_ctrl_resolve(nl_sock, "nl80211");
-    if (nl80211_id < 0) {
-        snprintf(errstr, LORCON_STATUS_MAX, 
-                "unable to create monitor vif %s:%s, unable to resolve nl80211",
-                interface, newinterface);
-        nl_socket_free(nl_sock);
-    }
-
     if ((msg = nlmsg_alloc()) == NULL) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to create monitor vif %s:%s, unable to allocate nl80211 "
                 "message", interface, newinterface);
-        nl_socket_free(nl_sock);
         return -1;
     }
 
@@ -210,7 +227,13 @@ int nl80211_createvif(const char *interface, const char *newinterface,
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to create monitor vif %s:%s, unable to allocate nl80211 flags",
                 interface, newinterface);
-        nl_socket_free(nl_sock);
+        nlmsg_free(msg);
+        return -1;
+    }
+
+    if (nl80211_control_acquire(&nl_sock, &nl80211_id, errstr) < 0) {
+        nlmsg_free(msg);
+        nlmsg_free(flags);
         return -1;
     }
 
@@ -230,13 +253,13 @@ int nl80211_createvif(const char *interface, const char *newinterface,
 nla_put_failure:
         snprintf(errstr, LORCON_STATUS_MAX, "failed to create monitor interface %s:%s",
                 interface, newinterface);
-        nl_socket_free(nl_sock);
+        nl80211_control_release(1);
         nlmsg_free(msg);
         nlmsg_free(flags);
         return -1;
     }
 
-    nl_socket_free(nl_sock);
+    nl80211_control_release(0);
     nlmsg_free(msg);
     nlmsg_free(flags);
 
@@ -251,6 +274,53 @@ nla_put_failure:
 #endif
 }
 
+#ifdef HAVE_LINUX_NETLINK
+/* Build the SET_WIPHY messages shared by the synchronous and asynchronous
+ * channel calls */
+static struct nl_msg *nl80211_msg_setchannel(int ifindex, int nl80211_id,
+        int channel, unsigned int chmode) {
+    struct nl_msg *msg;
+
+    if ((msg = nlmsg_alloc()) == NULL)
+        return NULL;
+
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, wifi_chan_to_freq(channel));
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_CHANNEL_TYPE, chmode);
+
+    return msg;
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return NULL;
+}
+
+static struct nl_msg *nl80211_msg_setfrequency(int ifindex, int nl80211_id,
+        unsigned int control_freq, unsigned int chan_width,
+        unsigned int center_freq1) {
+    struct nl_msg *msg;
+
+    if ((msg = nlmsg_alloc()) == NULL)
+        return NULL;
+
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, wifi_chan_to_freq(control_freq));
+    NLA_PUT_U32(msg, NL80211_ATTR_CHANNEL_WIDTH, chan_width);
+
+    if (center_freq1 != 0) {
+        NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, wifi_chan_to_freq(center_freq1));
+    }
+
+    return msg;
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return NULL;
+}
+#endif
+
 int nl80211_setchannel_cache(int ifindex, void *nl_sock,
         int nl80211_id, int channel, unsigned int chmode, char *errstr) {
 #ifndef HAVE_LINUX_NETLINK
@@ -266,17 +336,12 @@ int nl80211_setchannel_cache(int ifindex, void *nl_sock,
         return -1;
     }
 
-    if ((msg = nlmsg_alloc()) == NULL) {
+    if ((msg = nl80211_msg_setchannel(ifindex, nl80211_id, channel, chmode)) == NULL) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to set channel: unable to allocate mac80211 control message.");
         return -1;
     }
 
-    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
-    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, ChanToFreq(channel));
-    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_CHANNEL_TYPE, chmode);
-
     if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
         if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
             goto nla_put_failure;
@@ -289,7 +354,7 @@ int nl80211_setchannel_cache(int ifindex, void *nl_sock,
 nla_put_failure:
     snprintf(errstr, LORCON_STATUS_MAX, 
             "unable to set channel %u/%u mode %u via mac80211: "
-            "error code %d", channel, ChanToFreq(channel), chmode, ret);
+            "error code %d", channel, wifi_chan_to_freq(channel), chmode, ret);
     nlmsg_free(msg);
     return ret;
 #endif
@@ -304,15 +369,20 @@ int nl80211_set_channel(const char *interface, int channel,
 #else
     void *nl_sock;
     int nl80211_id;
-    int ifidx;
+    int ifidx, ret;
+
+    if ((ifidx = if_nametoindex(interface)) == 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to set channel: could not find interface '%s'", interface);
+        return -1;
+    }
 
-    if (nl80211_connect(interface, &nl_sock, &nl80211_id, &ifidx, errstr) < 0)
+    if (nl80211_control_acquire(&nl_sock, &nl80211_id, errstr) < 0)
         return -1;
 
-    int ret = 
-        nl80211_setchannel_cache(ifidx, nl_sock, nl80211_id, channel, chmode, errstr);
+    ret = nl80211_setchannel_cache(ifidx, nl_sock, nl80211_id, channel, chmode, errstr);
 
-    nl80211_disconnect(nl_sock);
+    nl80211_control_release(ret < 0);
 
     return ret;
 #endif
@@ -330,22 +400,14 @@ int nl80211_setfrequency_cache(int ifindex, void *nl_sock, int nl80211_id,
     struct nl_msg *msg;
     int ret = 0;
 
-    if ((msg = nlmsg_alloc()) == NULL) {
+    if ((msg = nl80211_msg_setfrequency(ifindex, nl80211_id, control_freq,
+                    chan_width, center_freq1)) == NULL) {
         snprintf(errstr, LORCON_STATUS_MAX, 
                 "unable to set channel/frequency: unable to allocate "
                 "mac80211 control message.");
         return -1;
     }
 
-    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
-    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, ChanToFreq(control_freq));
-    NLA_PUT_U32(msg, NL80211_ATTR_CHANNEL_WIDTH, chan_width);
-
-    if (center_freq1 != 0) {
-        NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, ChanToFreq(center_freq1));
-    }
-
     if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
         if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
             goto nla_put_failure;
@@ -374,200 +436,218 @@ int nl80211_setfrequency(const char *interface,
     return -1;
 #else
     void *nl_sock;
-    int ifidx;
     int nl80211_id;
+    int ifidx, ret;
 
-    if (nl80211_connect(interface, &nl_sock, &nl80211_id, &ifidx, errstr) < 0) {
+    if ((ifidx = if_nametoindex(interface)) == 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to set frequency: could not find interface '%s'", interface);
         return -1;
     }
 
-    int ret = 
-        nl80211_setfrequency_cache(ifidx, nl_sock, nl80211_id, 
-                control_freq, chan_width, center_freq1, center_freq2, errstr);
+    if (nl80211_control_acquire(&nl_sock, &nl80211_id, errstr) < 0)
+        return -1;
+
+    ret = nl80211_setfrequency_cache(ifidx, nl_sock, nl80211_id, 
+            control_freq, chan_width, center_freq1, center_freq2, errstr);
 
-    nl80211_disconnect(nl_sock);
+    nl80211_control_release(ret < 0);
 
     return ret;
 #endif
 }
 
-struct nl80211_channel_list {
-    /* Should be a string once we support ht/vht */
-    int channel;
-    struct nl80211_channel_list *next;
-};
+int nl80211_async_connect(const char *interface, void **nl_sock,
+        int *nl80211_id, int *if_index, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    if (nl80211_connect(interface, nl_sock, nl80211_id, if_index, errstr) < 0)
+        return -1;
 
-struct nl80211_channel_block {
-	char *phyname;
+    /* Replies are matched to requests by the caller, and several requests
+     * are in flight at once */
+    nl_socket_disable_seq_check(*nl_sock);
 
-	int nfreqs;
+    if (nl_socket_set_nonblocking(*nl_sock) < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to connect to netlink: could not make socket non-blocking");
+        nl_socket_free(*nl_sock);
+        *nl_sock = NULL;
+        return -1;
+    }
 
-    struct nl80211_channel_list *channel_list;
-    struct nl80211_channel_list *chan_list_last;
-};
+    return 0;
+#endif
+}
 
+int nl80211_async_fd(void *nl_sock) {
+#ifndef HAVE_LINUX_NETLINK
+    return -1;
+#else
+    return nl_socket_get_fd(nl_sock);
+#endif
+}
 
 #ifdef HAVE_LINUX_NETLINK
-static int nl80211_freqlist_cb(struct nl_msg *msg, void *arg) {
-    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
-    struct genlmsghdr *gnlh = (struct genlmsghdr *) nlmsg_data(nlmsg_hdr(msg));
-    struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
-    struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
-    struct nlattr *nl_band, *nl_freq;
-    int rem_band, rem_freq;
-    uint32_t freq;
-    struct nl80211_channel_block *chanb = (struct nl80211_channel_block *) arg;
-    char channel_str[32];
-    int band_ht40, band_ht80, band_ht160;
-    unsigned int hti;
+/* Send without waiting for the ack, returning the sequence number the
+ * kernel will echo in it */
+static int nl80211_async_send(void *nl_sock, struct nl_msg *msg,
+        unsigned int *ret_seq) {
+    int ret;
 
-    struct nl80211_channel_list *chan_list_new;
+    if ((ret = nl_send_auto_complete(nl_sock, msg)) < 0)
+        return ret;
 
-    nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
-            genlmsg_attrlen(gnlh, 0), NULL);
+    *ret_seq = nlmsg_hdr(msg)->nlmsg_seq;
 
-    if (tb_msg[NL80211_ATTR_WIPHY_NAME]) {
-        if (strcmp(nla_get_string(tb_msg[NL80211_ATTR_WIPHY_NAME]), chanb->phyname) != 0) {
-            return NL_SKIP;
-        }
+    return 0;
+}
+#endif
+
+int nl80211_setchannel_async(int ifindex, void *nl_sock, int nl80211_id,
+        int channel, unsigned int chmode, unsigned int *ret_seq, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    struct nl_msg *msg;
+    int ret;
+
+    if (chmode >= 4) {
+        snprintf(errstr, LORCON_STATUS_MAX, "unable to set channel: invalid channel mode");
+        return -1;
+    }
+
+    if ((msg = nl80211_msg_setchannel(ifindex, nl80211_id, channel, chmode)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to set channel: unable to allocate mac80211 control message.");
+        return -1;
     }
 
-    if (tb_msg[NL80211_ATTR_WIPHY_BANDS]) {
-        nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
-            band_ht40 = band_ht80 = band_ht160 = 0;
+    if ((ret = nl80211_async_send(nl_sock, msg, ret_seq)) < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to send channel %u/%u mode %u via mac80211: "
+                "error code %d", channel, wifi_chan_to_freq(channel), chmode, ret);
+        nlmsg_free(msg);
+        return ret;
+    }
 
-            nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band),
-                    nla_len(nl_band), NULL);
+    nlmsg_free(msg);
 
-            /* If we have a HT capability field, examine it for HT40 */
-            if (tb_band[NL80211_BAND_ATTR_HT_CAPA]) {
-                __u16 cap = nla_get_u16(tb_band[NL80211_BAND_ATTR_HT_CAPA]);
+    return 0;
+#endif
+}
 
-                /* bit 1 is the HT40 bit */
-                if (cap & (1 << 1))
-                    band_ht40 = 1;
-            }
+int nl80211_setfrequency_async(int ifindex, void *nl_sock, int nl80211_id,
+        unsigned int control_freq, unsigned int chan_width,
+        unsigned int center_freq1, unsigned int center_freq2,
+        unsigned int *ret_seq, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    struct nl_msg *msg;
+    int ret;
 
-            /* If we have a VHT field, we can assume we have HT80 and then we need
-             * to examine ht160.  
-             * TODO: figure out 160 80+80; do all devices that support 80+80 support
-             * 160?  For now we assume they do...
-             */
-            if (tb_band[NL80211_BAND_ATTR_VHT_CAPA]) {
-                band_ht80 = 1;
+    if ((msg = nl80211_msg_setfrequency(ifindex, nl80211_id, control_freq,
+                    chan_width, center_freq1)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to set channel/frequency: unable to allocate "
+                "mac80211 control message.");
+        return -1;
+    }
 
-                __u16 cap = nla_get_u32(tb_band[NL80211_BAND_ATTR_VHT_CAPA]);
+    if ((ret = nl80211_async_send(nl_sock, msg, ret_seq)) < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to send frequency %u %u %u via mac80211: error code %d",
+                control_freq, chan_width, center_freq1, ret);
+        nlmsg_free(msg);
+        return ret;
+    }
 
-                if (((cap >> 2) & 3) == 1) {
-                    band_ht160 = 1;
-                } else if (((cap >> 2) & 3) == 2) {
-                    band_ht160 = 1;
-                }
-            }
+    nlmsg_free(msg);
 
-            // fprintf(stderr, "debug - %u %u %u\n", band_ht40, band_ht80, band_ht160);
-
-            if (tb_band[NL80211_BAND_ATTR_FREQS]) {
-                nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
-                    nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX, nla_data(nl_freq),
-                            nla_len(nl_freq), NULL);
-
-                    if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
-                        continue;
-
-                    if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
-                        continue;
-
-                    /* We've got at least one actual frequency */
-                    freq = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
-
-                    chan_list_new = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-
-                    /* Ultimately channels will be strings to support HT/VHT
-                    snprintf(channel_str, 32, "%u", mac80211_freq_to_chan(freq));
-                    chan_list_new->channel = strdup(channel_str);
-                    */
-                    chan_list_new->channel = ChanToFreq(freq);
-
-                    chan_list_new->next = NULL;
-                    chanb->nfreqs++;
-                    chanb->chan_list_last->next = chan_list_new;
-                    chanb->chan_list_last = chan_list_new;
-
-#if 0
-                    /* This code from Kismet handles HT/VHT channels but we don't have
-                     * the infrastructure yet in lorcon to treat channels as strings,
-                     * so just def it out for now */
-
-                    /* Look us up in the wifi_ht_channels list and add channels if we
-                     * need to add HT capabilities.  We could convert this to a channel
-                     * but it's better to do a frequency lookup */
-                    for (hti = 0; hti < MAX_WIFI_HT_CHANNEL; hti++) {
-                        if (wifi_ht_channels[hti].freq == freq) {
-                            if (band_ht40) {
-                                if (wifi_ht_channels[hti].flags & WIFI_HT_HT40MINUS) {
-                                    chan_list_new = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-                                    snprintf(channel_str, 32, 
-                                            "%uHT40-", mac80211_freq_to_chan(freq));
-                                    chan_list_new->channel = strdup(channel_str);
-
-                                    chan_list_new->next = NULL;
-                                    chanb->nfreqs++;
-                                    chanb->chan_list_last->next = chan_list_new;
-                                    chanb->chan_list_last = chan_list_new;
-                                }
-
-                                if (wifi_ht_channels[hti].flags & WIFI_HT_HT40PLUS) {
-                                    chan_list_new = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-
-                                    snprintf(channel_str, 32, 
-                                            "%uHT40+", mac80211_freq_to_chan(freq));
-                                    chan_list_new->channel = strdup(channel_str);
-
-                                    chan_list_new->next = NULL;
-                                    chanb->nfreqs++;
-                                    chanb->chan_list_last->next = chan_list_new;
-                                    chanb->chan_list_last = chan_list_new;
-                                }
-                            }
-
-                            if (band_ht80 && wifi_ht_channels[hti].flags & WIFI_HT_HT80) {
-                                chan_list_new = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-                                snprintf(channel_str, 32, 
-                                        "%uVHT80", mac80211_freq_to_chan(freq));
-                                chan_list_new->channel = strdup(channel_str);
-
-                                chan_list_new->next = NULL;
-                                chanb->nfreqs++;
-                                chanb->chan_list_last->next = chan_list_new;
-                                chanb->chan_list_last = chan_list_new;
-                            }
-
-                            if (band_ht160 && wifi_ht_channels[hti].flags & WIFI_HT_HT160) {
-                                chan_list_new = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-                                snprintf(channel_str, 32, 
-                                        "%uVHT160", mac80211_freq_to_chan(freq));
-                                chan_list_new->channel = strdup(channel_str);
-
-                                chan_list_new->next = NULL;
-                                chanb->nfreqs++;
-                                chanb->chan_list_last->next = chan_list_new;
-                                chanb->chan_list_last = chan_list_new;
-                            }
-
-                            break;
-                        }
-                    }
+    return 0;
 #endif
-                }
-            }
-        }
-    }
+}
+
+#ifdef HAVE_LINUX_NETLINK
+struct nl80211_async_state {
+    nl80211_async_handler handler;
+    void *aux;
+    int count;
+};
+
+static int nl80211_async_ack_cb(struct nl_msg *msg, void *arg) {
+    struct nl80211_async_state *st = (struct nl80211_async_state *) arg;
+
+    (*(st->handler))(nlmsg_hdr(msg)->nlmsg_seq, 0, st->aux);
+    st->count++;
 
+    return NL_OK;
+}
+
+static int nl80211_async_error_cb(struct sockaddr_nl *nla, struct nlmsgerr *err,
+        void *arg) {
+    struct nl80211_async_state *st = (struct nl80211_async_state *) arg;
+
+    (*(st->handler))(err->msg.nlmsg_seq, err->error, st->aux);
+    st->count++;
+
+    /* Keep going; other replies may share the datagram */
     return NL_SKIP;
 }
 #endif
 
+int nl80211_async_complete(void *nl_sock, nl80211_async_handler handler,
+        void *aux, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    struct nl_cb *cb;
+    struct nl80211_async_state st;
+    struct pollfd pfd;
+    int ret;
+
+    if ((cb = nl_cb_alloc(NL_CB_DEFAULT)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to read netlink replies: could not allocate callbacks");
+        return -1;
+    }
+
+    st.handler = handler;
+    st.aux = aux;
+    st.count = 0;
+
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_async_ack_cb, &st);
+    nl_cb_err(cb, NL_CB_CUSTOM, nl80211_async_error_cb, &st);
+
+    pfd.fd = nl_socket_get_fd(nl_sock);
+    pfd.events = POLLIN;
+
+    /* Read only while replies are queued; this never blocks */
+    while (poll(&pfd, 1, 0) > 0) {
+        if ((ret = nl_recvmsgs(nl_sock, cb)) < 0 && ret != -NLE_AGAIN) {
+            snprintf(errstr, LORCON_STATUS_MAX,
+                    "unable to read netlink replies: error code %d", ret);
+            nl_cb_put(cb);
+            return -1;
+        }
+    }
+
+    nl_cb_put(cb);
+
+    return st.count;
+#endif
+}
+
 #ifdef HAVE_LINUX_NETLINK
 static int nl80211_error_cb(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg) {
 	int *ret = (int *) arg;
@@ -588,151 +668,1000 @@ static int nl80211_ack_cb(struct nl_msg *msg, void *arg) {
 }
 #endif
 
-int nl80211_get_chanlist(const char *interface, int *ret_num_chans, int **ret_chan_list,
-        char *errstr) {
-    struct nl80211_channel_block cblock = {
-        .phyname = NULL,
-        .nfreqs = 0,
-        .channel_list = NULL,
-        .chan_list_last = NULL
-    };
+#ifdef HAVE_LINUX_NETLINK
+/* Read the channel attributes carried by interface replies and channel
+ * switch events */
+static void nl80211_parse_chaninfo(struct nlattr **tb_msg,
+        struct nl80211_chaninfo *info) {
+    memset(info, 0, sizeof(struct nl80211_chaninfo));
+
+    if (tb_msg[NL80211_ATTR_IFINDEX])
+        info->ifindex = nla_get_u32(tb_msg[NL80211_ATTR_IFINDEX]);
+    if (tb_msg[NL80211_ATTR_WIPHY_FREQ])
+        info->freq = nla_get_u32(tb_msg[NL80211_ATTR_WIPHY_FREQ]);
+    if (tb_msg[NL80211_ATTR_CHANNEL_WIDTH])
+        info->width = nla_get_u32(tb_msg[NL80211_ATTR_CHANNEL_WIDTH]);
+    if (tb_msg[NL80211_ATTR_CENTER_FREQ1])
+        info->center_freq1 = nla_get_u32(tb_msg[NL80211_ATTR_CENTER_FREQ1]);
+    if (tb_msg[NL80211_ATTR_CENTER_FREQ2])
+        info->center_freq2 = nla_get_u32(tb_msg[NL80211_ATTR_CENTER_FREQ2]);
+}
 
-    unsigned int num_freq;
-    struct nl80211_channel_list *chan_list_cur, *chan_list_old;
+static int nl80211_ifchan_cb(struct nl_msg *msg, void *arg) {
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = (struct genlmsghdr *) nlmsg_data(nlmsg_hdr(msg));
+
+    nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+            genlmsg_attrlen(gnlh, 0), NULL);
+
+    nl80211_parse_chaninfo(tb_msg, (struct nl80211_chaninfo *) arg);
+
+    return NL_SKIP;
+}
+#endif
 
+int nl80211_get_interface_channel(int ifindex, void *nl_sock, int nl80211_id,
+        struct nl80211_chaninfo *info, char *errstr) {
 #ifndef HAVE_LINUX_NETLINK
-    snprintf(errstr, LORCON_STATUS_MAX, "Kismet was not compiled with netlink/nl80211 "
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
             "support, check the output of ./configure for why");
     return -1;
 #else
-
-    void *nl_sock;
-    int nl80211_id;
-
+    struct nl_msg *msg;
     struct nl_cb *cb;
     int err;
-    struct nl_msg *msg;
 
-    cblock.phyname = nl80211_find_parent(interface);
-    if (strlen(cblock.phyname) == 0) {
-        if (if_nametoindex(interface) <= 0) {
-            snprintf(errstr, LORCON_STATUS_MAX, 
-                    "failed to get channels from interface '%s': interface does "
-                    "not exist.", interface);
-            return -1;
-        } 
+    memset(info, 0, sizeof(struct nl80211_chaninfo));
 
+    if ((msg = nlmsg_alloc()) == NULL) {
         snprintf(errstr, LORCON_STATUS_MAX, 
-                "failed to find parent phy interface for interface '%s': interface "
-                "may not be a mac80211 wifi device?", interface);
+                "unable to get channel: unable to allocate mac80211 control message.");
         return -1;
     }
 
-    nl_sock = nl_socket_alloc();
-    if (!nl_sock) {
-        snprintf(errstr, LORCON_STATUS_MAX, "FATAL: Failed to allocate netlink socket");
+    if ((cb = nl_cb_alloc(NL_CB_DEFAULT)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to get channel: unable to allocate netlink callbacks.");
+        nlmsg_free(msg);
         return -1;
     }
 
-    if (genl_connect(nl_sock)) {
-        snprintf(errstr, LORCON_STATUS_MAX, "FATAL: Failed to connect to generic netlink");
-        nl_socket_free(nl_sock);
-    }
-
-    nl80211_id = genl_ctrl_resolve(nl_sock, "nl80211");
-    if (nl80211_id < 0) {
-        snprintf(errstr, LORCON_STATUS_MAX, "FATAL: Failed to resolve nl80211");
-        nl_socket_free(nl_sock);
-    }
-
-    msg = nlmsg_alloc();
-
-    cb = nl_cb_alloc(NL_CB_DEFAULT);
-
     err = 1;
 
-    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_freqlist_cb, &cblock);
-	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_ack_cb, &err);
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_ifchan_cb, info);
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_ack_cb, &err);
     nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_finish_cb, &err);
     nl_cb_err(cb, NL_CB_CUSTOM, nl80211_error_cb, &err);
 
-    genlmsg_put(msg, 0, 0, nl80211_id, 0, NLM_F_DUMP, NL80211_CMD_GET_WIPHY, 0);
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_GET_INTERFACE, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
 
-    /* Initialize the empty first channel list item */
-    cblock.channel_list = (struct nl80211_channel_list *) malloc(sizeof(struct nl80211_channel_list));
-    cblock.channel_list->channel = 0;
-    /*
-    cblock.channel_list->channel = NULL;
-    */
-    cblock.channel_list->next = NULL;
-    cblock.chan_list_last = cblock.channel_list;
+    if (nl_send_auto_complete(nl_sock, msg) < 0)
+        goto nla_put_failure;
 
-    if (nl_send_auto_complete((struct nl_sock *) nl_sock, msg) < 0) {
-        snprintf(errstr, LORCON_STATUS_MAX, 
-                "failed to fetch channels from interface '%s': failed to "
-                "write netlink command", interface);
-        nlmsg_free(msg);
-        nl_cb_put(cb);
-        nl_socket_free(nl_sock);
+    while (err > 0) {
+        if (nl_recvmsgs(nl_sock, cb) < 0 && err > 0)
+            err = -1;
+    }
+
+    nl_cb_put(cb);
+    nlmsg_free(msg);
+
+    if (err < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to get channel via mac80211: error code %d", err);
         return -1;
     }
 
-    while (err)
-        nl_recvmsgs((struct nl_sock *) nl_sock, cb);
+    /* Interfaces which aren't on a channel (down, or no channel context)
+     * don't report one */
+    if (info->freq == 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to get channel via mac80211: interface has no channel");
+        return -1;
+    }
 
+    return 0;
+
+nla_put_failure:
+    snprintf(errstr, LORCON_STATUS_MAX,
+            "unable to get channel: failed to write netlink command");
     nl_cb_put(cb);
     nlmsg_free(msg);
-    nl_socket_free(nl_sock);
+    return -1;
+#endif
+}
+
+#ifdef HAVE_LINUX_NETLINK
+struct nl80211_survey_fill {
+    lorcon_survey_entry_t *entries;
+    int num_entries;
+    int max_entries;
+    int err;
+};
+
+static int nl80211_survey_cb(struct nl_msg *msg, void *arg) {
+    struct nl80211_survey_fill *fill = (struct nl80211_survey_fill *) arg;
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = (struct genlmsghdr *) nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+    lorcon_survey_entry_t *e;
+    int nmax;
+
+    nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+            genlmsg_attrlen(gnlh, 0), NULL);
+
+    if (!tb_msg[NL80211_ATTR_SURVEY_INFO])
+        return NL_SKIP;
+
+    if (nla_parse_nested(sinfo, NL80211_SURVEY_INFO_MAX,
+                tb_msg[NL80211_ATTR_SURVEY_INFO], NULL) < 0 ||
+            !sinfo[NL80211_SURVEY_INFO_FREQUENCY])
+        return NL_SKIP;
+
+    if (fill->num_entries == fill->max_entries) {
+        nmax = fill->max_entries ? fill->max_entries * 2 : 32;
+
+        if ((e = (lorcon_survey_entry_t *) realloc(fill->entries,
+                        sizeof(lorcon_survey_entry_t) * nmax)) == NULL) {
+            fill->err = 1;
+            return NL_STOP;
+        }
+
+        fill->entries = e;
+        fill->max_entries = nmax;
+    }
+
+    e = &(fill->entries[fill->num_entries++]);
+    memset(e, 0, sizeof(lorcon_survey_entry_t));
+
+    e->freq = nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
+    e->in_use = sinfo[NL80211_SURVEY_INFO_IN_USE] != NULL;
+
+    if (sinfo[NL80211_SURVEY_INFO_NOISE]) {
+        e->present |= LORCON_SURVEY_NOISE;
+        e->noise_dbm = (int8_t) nla_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME]) {
+        e->present |= LORCON_SURVEY_ACTIVE;
+        e->active_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME_BUSY]) {
+        e->present |= LORCON_SURVEY_BUSY;
+        e->busy_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_BUSY]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME_EXT_BUSY]) {
+        e->present |= LORCON_SURVEY_EXT_BUSY;
+        e->ext_busy_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_EXT_BUSY]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME_RX]) {
+        e->present |= LORCON_SURVEY_RX;
+        e->rx_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_RX]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME_TX]) {
+        e->present |= LORCON_SURVEY_TX;
+        e->tx_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_TX]);
+    }
+    if (sinfo[NL80211_SURVEY_INFO_TIME_SCAN]) {
+        e->present |= LORCON_SURVEY_SCAN;
+        e->scan_ms = nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_SCAN]);
+    }
+
+    return NL_SKIP;
+}
+#endif
+
+int nl80211_get_survey(int ifindex, void *nl_sock, int nl80211_id,
+        lorcon_survey_entry_t **ret_entries, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    struct nl80211_survey_fill fill;
+    struct nl_msg *msg;
+    struct nl_cb *cb;
+    int err;
+
+    *ret_entries = NULL;
+
+    memset(&fill, 0, sizeof(struct nl80211_survey_fill));
 
-    /* Convert our linked list into a channel block */
+    if ((msg = nlmsg_alloc()) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to get survey: unable to allocate mac80211 control message.");
+        return -1;
+    }
 
-    (*ret_num_chans) = cblock.nfreqs;
-    (*ret_chan_list) = malloc(sizeof(char *) * cblock.nfreqs);
+    if ((cb = nl_cb_alloc(NL_CB_DEFAULT)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to get survey: unable to allocate netlink callbacks.");
+        nlmsg_free(msg);
+        return -1;
+    }
 
-    num_freq = 0;
+    err = 1;
 
-    /* Skip the first item which is our placeholder */
-    chan_list_cur = cblock.channel_list->next;
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_survey_cb, &fill);
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_ack_cb, &err);
+    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_finish_cb, &err);
+    nl_cb_err(cb, NL_CB_CUSTOM, nl80211_error_cb, &err);
 
-    while (chan_list_cur != NULL && num_freq < cblock.nfreqs) {
-        /* Use the dup'd string directly */
-        (*ret_chan_list)[num_freq++] = chan_list_cur->channel;
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, NLM_F_DUMP, NL80211_CMD_GET_SURVEY, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
 
-        // fprintf(stderr, "debug - %u %s\n", num_freq, chan_list_cur->channel);
+    if (nl_send_auto_complete(nl_sock, msg) < 0)
+        goto nla_put_failure;
 
-        /* Shuffle the pointers */
-        chan_list_old = chan_list_cur;
-        chan_list_cur = chan_list_cur->next;
-        free(chan_list_old);
+    while (err > 0) {
+        if (nl_recvmsgs(nl_sock, cb) < 0 && err > 0)
+            err = -1;
     }
 
-    /* If we didn't process all the channels before we hit the end of the list... */
-    if (chan_list_cur != NULL || num_freq != cblock.nfreqs) {
-        fprintf(stderr, "ERROR - linux_netlink_control miscalculated the number of "
-                "channels somehow...\n");
+    nl_cb_put(cb);
+    nlmsg_free(msg);
+
+    if (fill.err) {
+        snprintf(errstr, LORCON_STATUS_MAX, "unable to get survey: out of memory");
+        free(fill.entries);
+        return -1;
+    }
+
+    if (err < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to get survey via mac80211: error code %d", err);
+        free(fill.entries);
+        return -1;
+    }
 
-        /* Clean up list overrun */
-        while (chan_list_cur != NULL) {
-            chan_list_old = chan_list_cur;
-            chan_list_cur = chan_list_cur->next;
-            free(chan_list_old);
+    *ret_entries = fill.entries;
+
+    return fill.num_entries;
+
+nla_put_failure:
+    snprintf(errstr, LORCON_STATUS_MAX,
+            "unable to get survey: failed to write netlink command");
+    nl_cb_put(cb);
+    nlmsg_free(msg);
+    return -1;
+#endif
+}
+
+void nl80211_chaninfo_channel(const struct nl80211_chaninfo *info,
+        lorcon_channel_t *channel) {
+    memset(channel, 0, sizeof(lorcon_channel_t));
+
+    channel->channel = info->freq;
+    channel->center_freq_1 = info->center_freq1;
+    channel->center_freq_2 = info->center_freq2;
+
+#ifdef HAVE_LINUX_NETLINK
+    switch (info->width) {
+        case NL80211_CHAN_WIDTH_20:
+            channel->type = LORCON_CHANNEL_HT20;
+            break;
+        case NL80211_CHAN_WIDTH_40:
+            if (info->center_freq1 > info->freq)
+                channel->type = LORCON_CHANNEL_HT40P;
+            else
+                channel->type = LORCON_CHANNEL_HT40M;
+            break;
+        case NL80211_CHAN_WIDTH_80:
+            channel->type = LORCON_CHANNEL_VHT80;
+            break;
+        case NL80211_CHAN_WIDTH_80P80:
+            channel->type = LORCON_CHANNEL_VHT8080;
+            break;
+        case NL80211_CHAN_WIDTH_160:
+            channel->type = LORCON_CHANNEL_VHT160;
+            break;
+        case NL80211_CHAN_WIDTH_5:
+            channel->type = LORCON_CHANNEL_5MHZ;
+            break;
+        case NL80211_CHAN_WIDTH_10:
+            channel->type = LORCON_CHANNEL_10MHZ;
+            break;
+        case NL80211_CHAN_WIDTH_320_COMPAT:
+            channel->type = LORCON_CHANNEL_EHT320;
+            break;
+        default:
+            channel->type = LORCON_CHANNEL_BASIC;
+            break;
+    }
+#endif
+}
+
+int nl80211_event_connect(void **nl_sock, unsigned int groups, char *errstr) {
+#if !defined(HAVE_LINUX_NETLINK) || !defined(HAVE_LIBNL_NG)
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with support "
+            "for nl80211 events, check the output of ./configure for why");
+    return -1;
+#else
+    static const struct {
+        unsigned int group;
+        const char *name;
+    } group_names[] = {
+        { NL80211_EVENT_GROUP_CONFIG, NL80211_MULTICAST_GROUP_CONFIG },
+        { NL80211_EVENT_GROUP_MLME, NL80211_MULTICAST_GROUP_MLME },
+        { NL80211_EVENT_GROUP_REG, NL80211_MULTICAST_GROUP_REG },
+    };
+    unsigned int x;
+    int grp;
+
+    if ((*nl_sock = nl_socket_alloc()) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to listen for nl80211 events: could not allocate "
+                "netlink socket");
+        return -1;
+    }
+
+    if (genl_connect(*nl_sock)) {
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "unable to listen for nl80211 events: could not connect to "
+                "generic netlink");
+        nl_socket_free(*nl_sock);
+        *nl_sock = NULL;
+        return -1;
+    }
+
+    for (x = 0; x < sizeof(group_names) / sizeof(group_names[0]); x++) {
+        if ((groups & group_names[x].group) == 0)
+            continue;
+
+        if ((grp = genl_ctrl_resolve_grp(*nl_sock, "nl80211",
+                        group_names[x].name)) < 0 ||
+                nl_socket_add_membership(*nl_sock, grp) < 0) {
+            snprintf(errstr, LORCON_STATUS_MAX, 
+                    "unable to listen for nl80211 events: could not join the "
+                    "nl80211 %s group", group_names[x].name);
+            nl_socket_free(*nl_sock);
+            *nl_sock = NULL;
+            return -1;
         }
+    }
+
+    nl_socket_disable_seq_check(*nl_sock);
+    nl_socket_set_nonblocking(*nl_sock);
+
+    return 0;
+#endif
+}
+
+int nl80211_event_fd(void *nl_sock) {
+#ifndef HAVE_LINUX_NETLINK
+    return -1;
+#else
+    return nl_socket_get_fd(nl_sock);
+#endif
+}
+
+#ifdef HAVE_LINUX_NETLINK
+struct nl80211_event_state {
+    nl80211_event_handler handler;
+    void *aux;
+    int count;
+};
+
+static int nl80211_event_cb(struct nl_msg *msg, void *arg) {
+    struct nl80211_event_state *st = (struct nl80211_event_state *) arg;
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = (struct genlmsghdr *) nlmsg_data(nlmsg_hdr(msg));
+    struct nl80211_event ev;
+
+    nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+            genlmsg_attrlen(gnlh, 0), NULL);
+
+    switch (gnlh->cmd) {
+        case NL80211_CMD_CH_SWITCH_NOTIFY:
+            ev.type = NL80211_EVENT_CH_SWITCH;
+            break;
+        case NL80211_CMD_DEL_INTERFACE:
+            ev.type = NL80211_EVENT_DEL_INTERFACE;
+            break;
+        case NL80211_CMD_NEW_WIPHY:
+            ev.type = NL80211_EVENT_NEW_WIPHY;
+            break;
+        case NL80211_CMD_DEL_WIPHY:
+            ev.type = NL80211_EVENT_DEL_WIPHY;
+            break;
+        case NL80211_CMD_REG_CHANGE:
+        case NL80211_CMD_WIPHY_REG_CHANGE:
+            ev.type = NL80211_EVENT_REG_CHANGE;
+            break;
+        default:
+            ev.type = NL80211_EVENT_OTHER;
+            break;
+    }
+
+    ev.wiphy = -1;
+
+    if (tb_msg[NL80211_ATTR_WIPHY])
+        ev.wiphy = nla_get_u32(tb_msg[NL80211_ATTR_WIPHY]);
+
+    nl80211_parse_chaninfo(tb_msg, &(ev.chan));
 
-        /* Clean up list underrun */
-        for ( ; num_freq < cblock.nfreqs; num_freq++) {
-            /*
-            (*ret_chan_list)[num_freq] = NULL;
-            */
-            (*ret_chan_list)[num_freq] = 0;
+    (*(st->handler))(&ev, st->aux);
+    st->count++;
+
+    return NL_SKIP;
+}
+#endif
+
+int nl80211_event_process(void *nl_sock, nl80211_event_handler handler,
+        void *aux, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    struct nl80211_event_state st;
+    struct nl_cb *cb;
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = nl_socket_get_fd(nl_sock);
+    pfd.events = POLLIN;
+
+    /* Nearly always nothing is waiting; don't set anything up for that */
+    if (poll(&pfd, 1, 0) <= 0)
+        return 0;
+
+    if ((cb = nl_cb_alloc(NL_CB_DEFAULT)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "unable to read netlink events: could not allocate callbacks");
+        return -1;
+    }
+
+    st.handler = handler;
+    st.aux = aux;
+    st.count = 0;
+
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_event_cb, &st);
+
+    do {
+        if ((ret = nl_recvmsgs(nl_sock, cb)) < 0 && ret != -NLE_AGAIN) {
+            /* Usually an overrun; events were lost */
+            snprintf(errstr, LORCON_STATUS_MAX,
+                    "unable to read netlink events: error code %d", ret);
+            nl_cb_put(cb);
+            return -1;
         }
+    } while (poll(&pfd, 1, 0) > 0);
+
+    nl_cb_put(cb);
+
+    return st.count;
+#endif
+}
+
+#ifdef HAVE_LINUX_NETLINK
+/* Per-phy capability cache indexed by wiphy, see lorcon_get_phy_caps() */
+static pthread_mutex_t nl80211_phycap_lock = PTHREAD_MUTEX_INITIALIZER;
+static lorcon_phy_caps_t **nl80211_phycap_table = NULL;
+static int nl80211_phycap_table_len = 0;
+
+/* Socket listening for phy and regulatory changes which make cached
+ * records stale; dumps are made on the shared control socket */
+static int nl80211_phycap_listening = 0;
+static void *nl80211_phycap_event_sock = NULL;
+
+struct nl80211_phycap_fill {
+    lorcon_phy_caps_t *caps;
+    int max_freqs;
+    int err;
+};
+
+static void nl80211_phycap_free(lorcon_phy_caps_t *caps) {
+    free(caps->freqs);
+    free(caps->freq_index);
+    free(caps);
+}
+
+void nl80211_phycap_put(const lorcon_phy_caps_t *caps) {
+    lorcon_phy_caps_t *c = (lorcon_phy_caps_t *) caps;
+
+    if (c != NULL && __atomic_sub_fetch(&(c->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+        nl80211_phycap_free(c);
+}
+
+/* Drop the cache's reference to a phy's record, or every record for -1;
+ * callers still holding one keep it until they put it; lock held */
+static void nl80211_phycap_drop(int wiphy) {
+    int x;
+
+    for (x = 0; x < nl80211_phycap_table_len; x++) {
+        if (nl80211_phycap_table[x] == NULL || (wiphy >= 0 && x != wiphy))
+            continue;
+
+        nl80211_phycap_put(nl80211_phycap_table[x]);
+        nl80211_phycap_table[x] = NULL;
+    }
+}
+
+static void nl80211_phycap_event_cb(struct nl80211_event *event, void *aux) {
+    switch (event->type) {
+        case NL80211_EVENT_NEW_WIPHY:
+        case NL80211_EVENT_DEL_WIPHY:
+        case NL80211_EVENT_REG_CHANGE:
+            nl80211_phycap_drop(event->wiphy);
+            break;
     }
+}
+
+/* Subscribe to the config and regulatory groups.  Without group lookup
+ * (libnl1) the cache is only dropped by lorcon_flush_phy_caps */
+static void nl80211_phycap_listen(void) {
+    char errstr[LORCON_STATUS_MAX];
+
+    if (nl80211_event_connect(&nl80211_phycap_event_sock,
+                NL80211_EVENT_GROUP_CONFIG | NL80211_EVENT_GROUP_REG, errstr) < 0)
+        nl80211_phycap_event_sock = NULL;
+}
+
+/* Act on any phy or regulatory changes queued since the last lookup */
+static void nl80211_phycap_events(void) {
+    char errstr[LORCON_STATUS_MAX];
+
+    if (nl80211_phycap_event_sock == NULL)
+        return;
+
+    /* Events may have been lost (socket overrun); trust nothing */
+    if (nl80211_event_process(nl80211_phycap_event_sock, nl80211_phycap_event_cb,
+                NULL, errstr) < 0)
+        nl80211_phycap_drop(-1);
+}
+
+static int nl80211_phycap_add_freq(struct nl80211_phycap_fill *fill,
+        struct nlattr **tb_freq) {
+    lorcon_phy_caps_t *caps = fill->caps;
+    lorcon_phy_freq_t *f;
+    int nmax;
+
+    if (caps->num_freqs == fill->max_freqs) {
+        nmax = fill->max_freqs ? fill->max_freqs * 2 : 64;
+
+        if ((f = (lorcon_phy_freq_t *) realloc(caps->freqs,
+                        sizeof(lorcon_phy_freq_t) * nmax)) == NULL)
+            return -1;
+
+        caps->freqs = f;
+        fill->max_freqs = nmax;
+    }
+
+    f = &(caps->freqs[caps->num_freqs++]);
+    memset(f, 0, sizeof(lorcon_phy_freq_t));
+
+    f->freq = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
+
+    if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
+        f->flags |= LORCON_FREQ_DISABLED;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_IR])
+        f->flags |= LORCON_FREQ_NO_IR;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_RADAR])
+        f->flags |= LORCON_FREQ_RADAR;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_HT40_MINUS])
+        f->flags |= LORCON_FREQ_NO_HT40MINUS;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_HT40_PLUS])
+        f->flags |= LORCON_FREQ_NO_HT40PLUS;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_80MHZ])
+        f->flags |= LORCON_FREQ_NO_80MHZ;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_160MHZ])
+        f->flags |= LORCON_FREQ_NO_160MHZ;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_INDOOR_ONLY])
+        f->flags |= LORCON_FREQ_INDOOR_ONLY;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_20MHZ])
+        f->flags |= LORCON_FREQ_NO_20MHZ;
+    if (tb_freq[NL80211_FREQUENCY_ATTR_NO_10MHZ])
+        f->flags |= LORCON_FREQ_NO_10MHZ;
+
+    if (tb_freq[NL80211_FREQUENCY_ATTR_DFS_STATE])
+        f->dfs_state = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_DFS_STATE]);
+
+    if (tb_freq[NL80211_FREQUENCY_ATTR_MAX_TX_POWER])
+        f->max_power_mbm = nla_get_u32(tb_freq[NL80211_FREQUENCY_ATTR_MAX_TX_POWER]);
+
+    return 0;
+}
+
+/* Widths from the HE and EHT PHY capabilities of each iftype of a band;
+ * the first byte of each holds the channel width bits */
+static void nl80211_phycap_iftype_data(lorcon_phy_caps_t *caps,
+        struct nlattr *iftype_data) {
+    struct nlattr *tb_iftype[NL80211_BAND_IFTYPE_ATTR_MAX_COMPAT + 1];
+    struct nlattr *nl_iftype;
+    const uint8_t *phy;
+    int rem_iftype;
+
+    nla_for_each_nested(nl_iftype, iftype_data, rem_iftype) {
+        nla_parse(tb_iftype, NL80211_BAND_IFTYPE_ATTR_MAX_COMPAT, nla_data(nl_iftype),
+                nla_len(nl_iftype), NULL);
+
+        if (tb_iftype[NL80211_BAND_IFTYPE_ATTR_HE_CAP_PHY_COMPAT] &&
+                nla_len(tb_iftype[NL80211_BAND_IFTYPE_ATTR_HE_CAP_PHY_COMPAT]) >= 1) {
+            phy = (const uint8_t *)
+                nla_data(tb_iftype[NL80211_BAND_IFTYPE_ATTR_HE_CAP_PHY_COMPAT]);
+
+            /* 40 in 2.4GHz; 40 and 80, 160, 80+80 in 5 and 6GHz */
+            if (phy[0] & 0x02)
+                caps->widths |= LORCON_PHY_WIDTH_40;
+            if (phy[0] & 0x04)
+                caps->widths |= LORCON_PHY_WIDTH_40 | LORCON_PHY_WIDTH_80;
+            if (phy[0] & 0x08)
+                caps->widths |= LORCON_PHY_WIDTH_160;
+            if (phy[0] & 0x10)
+                caps->widths |= LORCON_PHY_WIDTH_8080;
+        }
+
+        if (tb_iftype[NL80211_BAND_IFTYPE_ATTR_EHT_CAP_PHY_COMPAT] &&
+                nla_len(tb_iftype[NL80211_BAND_IFTYPE_ATTR_EHT_CAP_PHY_COMPAT]) >= 1) {
+            phy = (const uint8_t *)
+                nla_data(tb_iftype[NL80211_BAND_IFTYPE_ATTR_EHT_CAP_PHY_COMPAT]);
+
+            /* 320 in 6GHz */
+            if (phy[0] & 0x02)
+                caps->widths |= LORCON_PHY_WIDTH_320;
+        }
+    }
+}
+
+/* Collect one message of a (possibly split) wiphy dump */
+static int nl80211_phycap_cb(struct nl_msg *msg, void *arg) {
+    struct nl80211_phycap_fill *fill = (struct nl80211_phycap_fill *) arg;
+    lorcon_phy_caps_t *caps = fill->caps;
+    struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+    struct genlmsghdr *gnlh = (struct genlmsghdr *) nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb_band[NL80211_BAND_ATTR_MAX_COMPAT + 1];
+    struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
+    struct nlattr *nl_band, *nl_freq, *nl_mode;
+    const uint8_t *ext;
+    int rem_band, rem_freq, rem_mode, ext_len;
+    uint32_t vht;
+
+    nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+            genlmsg_attrlen(gnlh, 0), NULL);
+
+    /* Kernels without filtered dumps send every phy */
+    if (!tb_msg[NL80211_ATTR_WIPHY] ||
+            (int) nla_get_u32(tb_msg[NL80211_ATTR_WIPHY]) != caps->wiphy)
+        return NL_SKIP;
+
+    if (tb_msg[NL80211_ATTR_WIPHY_NAME])
+        snprintf(caps->name, sizeof(caps->name), "%s",
+                nla_get_string(tb_msg[NL80211_ATTR_WIPHY_NAME]));
+
+    if (tb_msg[NL80211_ATTR_FEATURE_FLAGS]) {
+        caps->features = nla_get_u32(tb_msg[NL80211_ATTR_FEATURE_FLAGS]);
+        caps->active_monitor = (caps->features & NL80211_FEATURE_ACTIVE_MONITOR) != 0;
+    }
+
+    if (tb_msg[NL80211_ATTR_EXT_FEATURES]) {
+        ext = (const uint8_t *) nla_data(tb_msg[NL80211_ATTR_EXT_FEATURES]);
+        ext_len = nla_len(tb_msg[NL80211_ATTR_EXT_FEATURES]);
+
+        if (NL80211_EXT_FEATURE_MU_MIMO_AIR_SNIFFER / 8 < ext_len)
+            caps->mu_mimo_sniffer = (ext[NL80211_EXT_FEATURE_MU_MIMO_AIR_SNIFFER / 8] >>
+                    (NL80211_EXT_FEATURE_MU_MIMO_AIR_SNIFFER % 8)) & 1;
+    }
+
+    if (tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES]) {
+        nla_for_each_nested(nl_mode, tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES], rem_mode) {
+            if (nla_type(nl_mode) < 32)
+                caps->iftypes |= (1 << nla_type(nl_mode));
+        }
+    }
+
+    if (!tb_msg[NL80211_ATTR_WIPHY_BANDS])
+        return NL_SKIP;
+
+    nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
+        nla_parse(tb_band, NL80211_BAND_ATTR_MAX_COMPAT, nla_data(nl_band),
+                nla_len(nl_band), NULL);
+
+        if (tb_band[NL80211_BAND_ATTR_HT_CAPA]) {
+            caps->widths |= LORCON_PHY_WIDTH_HT20;
+
+            /* bit 1 is the HT40 bit */
+            if (nla_get_u16(tb_band[NL80211_BAND_ATTR_HT_CAPA]) & (1 << 1))
+                caps->widths |= LORCON_PHY_WIDTH_40;
+        }
+
+        /* VHT implies 80; the supported width set says if 160 and 80+80
+         * are too */
+        if (tb_band[NL80211_BAND_ATTR_VHT_CAPA]) {
+            caps->widths |= LORCON_PHY_WIDTH_80;
+
+            vht = nla_get_u32(tb_band[NL80211_BAND_ATTR_VHT_CAPA]);
+
+            if (((vht >> 2) & 3) >= 1)
+                caps->widths |= LORCON_PHY_WIDTH_160;
+            if (((vht >> 2) & 3) == 2)
+                caps->widths |= LORCON_PHY_WIDTH_8080;
+        }
+
+        /* HE and EHT, which is all a 6GHz band has */
+        if (tb_band[NL80211_BAND_ATTR_IFTYPE_DATA_COMPAT])
+            nl80211_phycap_iftype_data(caps, tb_band[NL80211_BAND_ATTR_IFTYPE_DATA_COMPAT]);
+
+        if (!tb_band[NL80211_BAND_ATTR_FREQS])
+            continue;
+
+        nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
+            nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX, nla_data(nl_freq),
+                    nla_len(nl_freq), NULL);
+
+            if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
+                continue;
+
+            caps->widths |= LORCON_PHY_WIDTH_20;
+
+            if (nl80211_phycap_add_freq(fill, tb_freq) < 0) {
+                fill->err = 1;
+                return NL_STOP;
+            }
+        }
+    }
+
+    return NL_SKIP;
+}
+
+/* Dump a phy from nl80211 into a new record; lock held */
+static lorcon_phy_caps_t *nl80211_phycap_fetch(int wiphy, char *errstr) {
+    struct nl80211_phycap_fill fill;
+    lorcon_phy_caps_t *caps;
+    struct nl_msg *msg;
+    struct nl_cb *cb;
+    void *nl_sock;
+    int nl80211_id;
+    unsigned int slot;
+    int err, x;
+
+    if (!nl80211_phycap_listening) {
+        /* Listen before the first dump so no change can slip in between */
+        nl80211_phycap_listening = 1;
+        nl80211_phycap_listen();
+    }
+
+    if ((caps = (lorcon_phy_caps_t *) malloc(sizeof(lorcon_phy_caps_t))) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "failed to fetch phy capabilities: out of memory");
+        return NULL;
+    }
+
+    memset(caps, 0, sizeof(lorcon_phy_caps_t));
+    caps->wiphy = wiphy;
+    caps->refcount = 1;
+
+    fill.caps = caps;
+    fill.max_freqs = 0;
+    fill.err = 0;
+
+    if ((msg = nlmsg_alloc()) == NULL || (cb = nl_cb_alloc(NL_CB_DEFAULT)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "failed to fetch phy capabilities: out of memory");
+        if (msg != NULL)
+            nlmsg_free(msg);
+        nl80211_phycap_free(caps);
+        return NULL;
+    }
+
+    if (nl80211_control_acquire(&nl_sock, &nl80211_id, errstr) < 0) {
+        nl_cb_put(cb);
+        nlmsg_free(msg);
+        nl80211_phycap_free(caps);
+        return NULL;
+    }
+
+    err = 1;
+
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_phycap_cb, &fill);
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_ack_cb, &err);
+    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_finish_cb, &err);
+    nl_cb_err(cb, NL_CB_CUSTOM, nl80211_error_cb, &err);
+
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, NLM_F_DUMP, NL80211_CMD_GET_WIPHY, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY, wiphy);
+    NLA_PUT_FLAG(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP);
+
+    if (nl_send_auto_complete(nl_sock, msg) < 0) 
+        goto nla_put_failure;
+
+    while (err > 0) {
+        if (nl_recvmsgs(nl_sock, cb) < 0 && err > 0)
+            err = -1;
+    }
+
+    nl80211_control_release(err < 0);
+
+    nl_cb_put(cb);
+    nlmsg_free(msg);
+
+    if (err < 0 || fill.err) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "failed to fetch capabilities of phy %d: error code %d", wiphy, err);
+        nl80211_phycap_free(caps);
+        return NULL;
+    }
+
+    if ((caps->freq_index = (unsigned short *) malloc(sizeof(unsigned short) *
+                    LORCON_PHY_FREQ_SLOTS)) == NULL) {
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "failed to fetch phy capabilities: out of memory");
+        nl80211_phycap_free(caps);
+        return NULL;
+    }
+
+    memset(caps->freq_index, 0, sizeof(unsigned short) * LORCON_PHY_FREQ_SLOTS);
+
+    for (x = 0; x < caps->num_freqs; x++) {
+        if (caps->freqs[x].freq < LORCON_PHY_FREQ_BASE ||
+                (caps->freqs[x].freq - LORCON_PHY_FREQ_BASE) % 5 != 0)
+            continue;
+
+        slot = (caps->freqs[x].freq - LORCON_PHY_FREQ_BASE) / 5;
+
+        if (slot < LORCON_PHY_FREQ_SLOTS)
+            caps->freq_index[slot] = x + 1;
+    }
+
+    return caps;
+
+nla_put_failure:
+    snprintf(errstr, LORCON_STATUS_MAX,
+            "failed to fetch capabilities of phy %d: failed to write netlink "
+            "command", wiphy);
+    nl80211_control_release(1);
+    nl_cb_put(cb);
+    nlmsg_free(msg);
+    nl80211_phycap_free(caps);
+    return NULL;
+}
+
+/* Cached record for a phy, fetching it if needed; lock held */
+static lorcon_phy_caps_t *nl80211_phycap_lookup(int wiphy, char *errstr) {
+    lorcon_phy_caps_t **table;
+    lorcon_phy_caps_t *caps;
+    int nlen;
+
+    if (wiphy < 0) {
+        snprintf(errstr, LORCON_STATUS_MAX, "invalid phy index %d", wiphy);
+        return NULL;
+    }
+
+    nl80211_phycap_events();
+
+    if (wiphy < nl80211_phycap_table_len && nl80211_phycap_table[wiphy] != NULL)
+        return nl80211_phycap_table[wiphy];
+
+    if ((caps = nl80211_phycap_fetch(wiphy, errstr)) == NULL)
+        return NULL;
+
+    if (wiphy >= nl80211_phycap_table_len) {
+        nlen = wiphy + 8;
+
+        if ((table = (lorcon_phy_caps_t **) realloc(nl80211_phycap_table,
+                        sizeof(lorcon_phy_caps_t *) * nlen)) == NULL) {
+            snprintf(errstr, LORCON_STATUS_MAX,
+                    "failed to fetch phy capabilities: out of memory");
+            nl80211_phycap_free(caps);
+            return NULL;
+        }
+
+        memset(table + nl80211_phycap_table_len, 0,
+                sizeof(lorcon_phy_caps_t *) * (nlen - nl80211_phycap_table_len));
+
+        nl80211_phycap_table = table;
+        nl80211_phycap_table_len = nlen;
+    }
+
+    nl80211_phycap_table[wiphy] = caps;
+
+    return caps;
+}
+#endif
+
+const lorcon_phy_caps_t *nl80211_phycap_get(int wiphy, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Lorcon was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return NULL;
+#else
+    lorcon_phy_caps_t *caps;
+
+    /* The caller's reference keeps the record if it's dropped meanwhile */
+    pthread_mutex_lock(&nl80211_phycap_lock);
+    if ((caps = nl80211_phycap_lookup(wiphy, errstr)) != NULL)
+        __atomic_add_fetch(&(caps->refcount), 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&nl80211_phycap_lock);
+
+    return caps;
+#endif
+}
+
+void nl80211_phycap_invalidate(int wiphy) {
+#ifdef HAVE_LINUX_NETLINK
+    pthread_mutex_lock(&nl80211_phycap_lock);
+    nl80211_phycap_drop(wiphy);
+    pthread_mutex_unlock(&nl80211_phycap_lock);
+#endif
+}
+
+#ifndef HAVE_LINUX_NETLINK
+/* Nothing is ever handed out */
+void nl80211_phycap_put(const lorcon_phy_caps_t *caps) {
+
+}
+#endif
+
+int nl80211_get_wiphy_index(const char *interface) {
+    char path[256];
+    FILE *f;
+    int wiphy;
+
+    snprintf(path, 256, "/sys/class/net/%s/phy80211/index", interface);
+
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+
+    if (fscanf(f, "%d", &wiphy) != 1)
+        wiphy = -1;
+
+    fclose(f);
+
+    return wiphy;
+}
+
+int nl80211_get_chanlist(const char *interface, int *ret_num_chans, int **ret_chan_list,
+        char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, LORCON_STATUS_MAX, "Kismet was not compiled with netlink/nl80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    lorcon_phy_caps_t *caps;
+    int wiphy, x, n = 0;
+
+    if ((wiphy = nl80211_get_wiphy_index(interface)) < 0) {
+        if (if_nametoindex(interface) <= 0) {
+            snprintf(errstr, LORCON_STATUS_MAX, 
+                    "failed to get channels from interface '%s': interface does "
+                    "not exist.", interface);
+            return -1;
+        } 
+
+        snprintf(errstr, LORCON_STATUS_MAX, 
+                "failed to find parent phy interface for interface '%s': interface "
+                "may not be a mac80211 wifi device?", interface);
+        return -1;
+    }
+
+    /* Copy under the lock; the record may be dropped once it's released */
+    pthread_mutex_lock(&nl80211_phycap_lock);
+
+    if ((caps = nl80211_phycap_lookup(wiphy, errstr)) == NULL) {
+        pthread_mutex_unlock(&nl80211_phycap_lock);
+        return -1;
+    }
+
+    if (((*ret_chan_list) = (int *) malloc(sizeof(int) * (caps->num_freqs + 1))) == NULL) {
+        pthread_mutex_unlock(&nl80211_phycap_lock);
+        snprintf(errstr, LORCON_STATUS_MAX,
+                "failed to get channels from interface '%s': out of memory",
+                interface);
+        return -1;
+    }
+
+    for (x = 0; x < caps->num_freqs; x++) {
+        if (caps->freqs[x].flags & LORCON_FREQ_DISABLED)
+            continue;
+
+        (*ret_chan_list)[n++] = caps->freqs[x].freq;
+    }
+
+    pthread_mutex_unlock(&nl80211_phycap_lock);
 
-    /* remove the list head ptr */
-    free(cblock.channel_list);
-    /* Remove the phyname */
-    free(cblock.phyname);
+    (*ret_num_chans) = n;
 
-    return (*ret_num_chans);
+    return n;
 #endif
 }
 
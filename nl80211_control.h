@@ -17,6 +17,7 @@
 */
 
 #include "config.h"
+#include "lorcon.h"
 
 #ifndef __NL80211_CONFIG__
 #define __NL80211_CONFIG__
@@ -29,6 +30,15 @@
 #define nl80211_mntr_flag_otherbss	4
 #define nl80211_mntr_flag_cookframe	5
 
+/* Process-wide nl80211 control socket, connected on first use with the
+ * family id resolved once.  Acquire locks it for one request and its
+ * replies; release unlocks it, and after a failed request reconnects on
+ * next use so stray replies can't reach the next caller.  The kernel runs
+ * nl80211 commands one at a time anyway, so serializing costs little */
+int nl80211_control_acquire(void **nl_sock, int *nl80211_id, char *errstr);
+void nl80211_control_release(int failed);
+
+/* Private socket, for callers which read replies themselves (async) */
 int nl80211_connect(const char *interface, void **nl_sock, int *nl80211_id, 
         int *if_index, char *errstr);
 void nl80211_disconnect(void *nl_sock);
@@ -37,8 +47,8 @@ void nl80211_disconnect(void *nl_sock);
 int nl80211_createvif(const char *interface, const char *newinterface, 
         unsigned int *in_flags, unsigned int flags_sz, char *errstr);
 
-/* Set channel or frequency.  Callers should prefer the cache_ option using nl80211_connect 
- * when setting multiple channels */
+/* Set channel or frequency.  The cache_ variants take a socket from
+ * nl80211_control_acquire */
 int nl80211_setchannel(const char *interface, int channel, unsigned int chmode, char *errstr);
 int nl80211_setchannel_cache(int ifidx, void *nl_sock, int nl80211_id,
         int channel, unsigned int chmode, char *errstr);
@@ -51,9 +61,95 @@ int nl80211_setfrequency_cache(int ifidx, void *nl_sock, int nl80211_id,
         unsigned int control_freq, unsigned int chan_width, unsigned int center_freq1, 
         unsigned int center_freq2, char *errstr);
 
+/* Asynchronous channel changes.  Requests are sent on a separate socket from
+ * nl80211_async_connect, which is non-blocking and doesn't check sequence
+ * numbers, and return without waiting for the kernel; ret_seq is the
+ * sequence number of the request.  When nl80211_async_fd is readable,
+ * nl80211_async_complete calls the handler with the sequence number and
+ * result (0 or a negative errno) of each reply waiting, and returns how
+ * many there were */
+typedef void (*nl80211_async_handler)(unsigned int seq, int error, void *aux);
+
+int nl80211_async_connect(const char *interface, void **nl_sock, int *nl80211_id,
+        int *if_index, char *errstr);
+int nl80211_async_fd(void *nl_sock);
+int nl80211_setchannel_async(int ifidx, void *nl_sock, int nl80211_id,
+        int channel, unsigned int chmode, unsigned int *ret_seq, char *errstr);
+int nl80211_setfrequency_async(int ifidx, void *nl_sock, int nl80211_id,
+        unsigned int control_freq, unsigned int chan_width, unsigned int center_freq1,
+        unsigned int center_freq2, unsigned int *ret_seq, char *errstr);
+int nl80211_async_complete(void *nl_sock, nl80211_async_handler handler,
+        void *aux, char *errstr);
+
 // Caller is expected to free return
 char *nl80211_find_parent(const char *interface);
 
+/* Channel of an interface, as nl80211 reports it; frequencies in MHz and
+ * width as an NL80211_CHAN_WIDTH_ value */
+struct nl80211_chaninfo {
+    int ifindex;
+    unsigned int freq;
+    unsigned int width;
+    unsigned int center_freq1;
+    unsigned int center_freq2;
+};
+
+/* Ask the kernel for the current channel of an interface (GET_INTERFACE) */
+int nl80211_get_interface_channel(int ifidx, void *nl_sock, int nl80211_id,
+        struct nl80211_chaninfo *info, char *errstr);
+
+/* Channel survey of the phy under an interface (GET_SURVEY dump).  Returns
+ * the number of entries, which the caller frees, or -1 */
+int nl80211_get_survey(int ifidx, void *nl_sock, int nl80211_id,
+        lorcon_survey_entry_t **ret_entries, char *errstr);
+
+/* Convert a channel reported by nl80211 */
+void nl80211_chaninfo_channel(const struct nl80211_chaninfo *info,
+        lorcon_channel_t *channel);
+
+/* nl80211 multicast events.  nl80211_event_connect opens a non-blocking
+ * socket in the groups asked for; nl80211_event_process calls the handler
+ * for each event waiting and returns how many there were, or -1 if events
+ * were lost.  It costs one poll when nothing is waiting */
+#define NL80211_EVENT_GROUP_CONFIG  1
+#define NL80211_EVENT_GROUP_MLME    2
+#define NL80211_EVENT_GROUP_REG     4
+
+#define NL80211_EVENT_OTHER         0
+#define NL80211_EVENT_CH_SWITCH     1
+#define NL80211_EVENT_DEL_INTERFACE 2
+#define NL80211_EVENT_NEW_WIPHY     3
+#define NL80211_EVENT_DEL_WIPHY     4
+#define NL80211_EVENT_REG_CHANGE    5
+
+struct nl80211_event {
+    /* NL80211_EVENT_ value; regulatory changes without a phy are global */
+    unsigned int type;
+
+    /* -1 if the event doesn't name a phy; chan.ifindex is 0 if it doesn't
+     * name an interface */
+    int wiphy;
+    struct nl80211_chaninfo chan;
+};
+
+typedef void (*nl80211_event_handler)(struct nl80211_event *event, void *aux);
+
+int nl80211_event_connect(void **nl_sock, unsigned int groups, char *errstr);
+int nl80211_event_fd(void *nl_sock);
+int nl80211_event_process(void *nl_sock, nl80211_event_handler handler,
+        void *aux, char *errstr);
+
+/* Capability cache, see lorcon_get_phy_caps(); get returns a reference to
+ * release with put.  -1 invalidates every phy */
+const lorcon_phy_caps_t *nl80211_phycap_get(int wiphy, char *errstr);
+void nl80211_phycap_put(const lorcon_phy_caps_t *caps);
+void nl80211_phycap_invalidate(int wiphy);
+
+/* wiphy index of the phy under an interface, or -1 */
+int nl80211_get_wiphy_index(const char *interface);
+
+/* Frequencies the phy under an interface can use, from the capability
+ * cache; caller frees the list */
 #define NL80211_CHANLIST_NO_INTERFACE		-2
 #define NL80211_CHANLIST_NOT_NL80211		-3
 #define NL80211_CHANLIST_GENERIC			-4
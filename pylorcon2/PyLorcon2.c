@@ -1382,8 +1382,12 @@ static PyObject* PyLorcon2_Multi_del_interface(PyLorcon2_Multi *self,
         return NULL;
     }
 
-    lorcon_multi_del_interface(self->multi, 
-            ((PyLorcon2_Context *) intf_obj)->context, 0);
+    if (lorcon_multi_del_interface(self->multi, 
+            ((PyLorcon2_Context *) intf_obj)->context, 0) < 0) {
+        PyErr_SetString(Lorcon2Exception, lorcon_multi_get_error(self->multi));
+        return NULL;
+    }
+
     Py_DECREF(intf_obj);
 
     Py_INCREF(Py_None);
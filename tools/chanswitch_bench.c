@@ -0,0 +1,365 @@
+/*
+    Measures how long channel changes take on an interface, for each
+    channel width, and turns the results into dwell hints for the lorcon
+    channel hopper.
+
+    Two latencies are measured for every change:
+
+        ack     From asking for the change until the kernel confirmed it
+        frame   From asking for the change until the first frame captured
+                on the new channel
+
+    Frames which may have been heard while the radio was still changing
+    don't count.  Changes which see no frame within the timeout are
+    reported as misses; pick busy channels for useful frame numbers.
+
+    The minimum dwell for a width is 4x its 99th percentile frame latency,
+    so switching costs at most about a quarter of the time on a channel.
+    Hints can be saved with -o and loaded into another program with
+    lorcon_hop_load_dwell_hints().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include <lorcon2/lorcon.h>
+#include <lorcon2/lorcon_packet.h>
+#include <lorcon2/lorcon_hop.h>
+
+#define MAX_CHANNELS    64
+
+/* Latencies measured for one channel type */
+struct width_stats {
+    unsigned int *ack_us;
+    unsigned int num_ack;
+
+    unsigned int *frame_us;
+    unsigned int num_frame;
+
+    unsigned int misses;
+    unsigned int failures;
+};
+
+static const char *type_names[LORCON_HOP_HINT_TYPES] = {
+    "basic", "HT20", "HT40+", "HT40-", "5MHz", "10MHz",
+    "VHT80", "VHT160", "VHT80+80", "EHT320"
+};
+
+void usage(char *argv[]) {
+    printf("\t-i <interface>        Radio interface\n");
+    printf("\t-c <channels>         Comma separated channels to switch between\n");
+    printf("\t-n <count>            Number of changes to make (default 500)\n");
+    printf("\t-t <ms>               Time to wait for a frame after a change\n");
+    printf("\t                      (default 200)\n");
+    printf("\t-o <file>             Save dwell hints to file\n");
+
+    printf("\nExample:\n");
+    printf("\t%s -i wlan0 -c 1,6,11,36VHT80,149HT40+ -n 1000 -o hints.txt\n\n",
+            argv[0]);
+}
+
+static int64_t tv_us(const struct timeval *tv) {
+    return ((int64_t) tv->tv_sec * 1000000) + tv->tv_usec;
+}
+
+static int64_t now_us(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv_us(&tv);
+}
+
+static int cmp_uint(const void *a, const void *b) {
+    unsigned int x = *((const unsigned int *) a);
+    unsigned int y = *((const unsigned int *) b);
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of a sorted set */
+static unsigned int percentile(const unsigned int *v, unsigned int n, unsigned int p) {
+    unsigned int r;
+
+    if (n == 0)
+        return 0;
+
+    r = (n * p + 99) / 100;
+
+    if (r == 0)
+        r = 1;
+
+    return v[r - 1];
+}
+
+/* Wait for the first frame captured on the channel of an epoch.  Returns
+ * the latency from the start of the change in us, or -1 on timeout */
+static int64_t wait_frame(lorcon_t *context, const lorcon_channel_epoch_t *epoch,
+        unsigned int timeout_ms) {
+    lorcon_packet_t *packet;
+    struct pollfd pfd;
+    int64_t deadline, remain, lat;
+    int r;
+
+    deadline = now_us() + ((int64_t) timeout_ms * 1000);
+
+    pfd.fd = lorcon_get_selectable_fd(context);
+    pfd.events = POLLIN;
+
+    for (;;) {
+        while ((r = lorcon_next_ex(context, &packet)) > 0) {
+            if (packet->tuned_epoch == epoch->id && !packet->channel_ambiguous) {
+                lat = tv_us(&(packet->ts)) - tv_us(&(epoch->started));
+                lorcon_packet_free(packet);
+                return lat < 0 ? 0 : lat;
+            }
+
+            lorcon_packet_free(packet);
+        }
+
+        if (r < 0)
+            return -1;
+
+        if ((remain = deadline - now_us()) <= 0)
+            return -1;
+
+        if (pfd.fd < 0)
+            continue;
+
+        if (poll(&pfd, 1, (int) ((remain + 999) / 1000)) < 0 && errno != EINTR)
+            return -1;
+    }
+}
+
+static int set_channel(lorcon_t *context, lorcon_channel_t *channel) {
+    if (channel->type == LORCON_CHANNEL_BASIC)
+        return lorcon_set_channel(context, channel->channel);
+
+    return lorcon_set_complex_channel(context, channel);
+}
+
+int main(int argc, char *argv[]) {
+    char *interface = NULL, *outfile = NULL;
+    char *chanlist = NULL, *tok, *saveptr = NULL;
+
+    lorcon_channel_t channels[MAX_CHANNELS];
+    unsigned int num_channels = 0;
+
+    unsigned int iterations = 500, timeout_ms = 200;
+    unsigned int x, t;
+    int c;
+
+    lorcon_driver_t *driver;
+    lorcon_t *context;
+
+    lorcon_channel_epoch_t epoch;
+    lorcon_hop_dwell_hint_t hint;
+    struct width_stats stats[LORCON_HOP_HINT_TYPES];
+    struct width_stats *ws;
+    int64_t lat;
+
+    printf("%s - Channel switch latency benchmark\n", argv[0]);
+    printf("-----------------------------------------------------\n\n");
+
+    while ((c = getopt(argc, argv, "hi:c:n:t:o:")) != EOF) {
+        switch (c) {
+            case 'i':
+                interface = strdup(optarg);
+                break;
+            case 'c':
+                chanlist = strdup(optarg);
+                break;
+            case 'n':
+                if (sscanf(optarg, "%u", &iterations) != 1 || iterations == 0) {
+                    printf("ERROR: Unable to parse number of changes\n");
+                    return -1;
+                }
+                break;
+            case 't':
+                if (sscanf(optarg, "%u", &timeout_ms) != 1 || timeout_ms == 0) {
+                    printf("ERROR: Unable to parse frame timeout\n");
+                    return -1;
+                }
+                break;
+            case 'o':
+                outfile = strdup(optarg);
+                break;
+            case 'h':
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+
+    if (interface == NULL || chanlist == NULL) {
+        printf("ERROR: Interface or channels not set (see -h for more info)\n");
+        return -1;
+    }
+
+    for (tok = strtok_r(chanlist, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        if (num_channels == MAX_CHANNELS) {
+            printf("ERROR: Too many channels, at most %d\n", MAX_CHANNELS);
+            return -1;
+        }
+
+        if (lorcon_parse_ht_channel(tok, &(channels[num_channels])) != 0) {
+            printf("ERROR: Unable to parse channel '%s'\n", tok);
+            return -1;
+        }
+
+        if (channels[num_channels].type >= LORCON_HOP_HINT_TYPES) {
+            printf("ERROR: Unsupported channel type in '%s'\n", tok);
+            return -1;
+        }
+
+        num_channels++;
+    }
+
+    if (num_channels < 2) {
+        printf("ERROR: Need at least two channels to switch between\n");
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(stats));
+
+    for (t = 0; t < LORCON_HOP_HINT_TYPES; t++) {
+        stats[t].ack_us = (unsigned int *) malloc(sizeof(unsigned int) * iterations);
+        stats[t].frame_us = (unsigned int *) malloc(sizeof(unsigned int) * iterations);
+
+        if (stats[t].ack_us == NULL || stats[t].frame_us == NULL) {
+            printf("ERROR: Out of memory\n");
+            return -1;
+        }
+    }
+
+    printf("[+] Using interface %s\n", interface);
+
+    if ((driver = lorcon_auto_driver(interface)) == NULL) {
+        printf("[!] Could not determine the driver for %s\n", interface);
+        return -1;
+    } else {
+        printf("[+]\t Driver: %s\n", driver->name);
+    }
+
+    if ((context = lorcon_create(interface, driver)) == NULL) {
+        printf("[!]\t Failed to create context\n");
+        return -1;
+    }
+
+    lorcon_free_driver_list(driver);
+
+    if (lorcon_open_monitor(context) < 0) {
+        printf("[!]\t Could not open monitor mode interface: %s\n",
+                lorcon_get_error(context));
+        return -1;
+    } else {
+        printf("[+]\t Monitor Mode VAP: %s\n", lorcon_get_vap(context));
+    }
+
+    if (lorcon_set_nonblock(context, 1) < 0) {
+        printf("[!]\t Could not set non-blocking capture: %s\n",
+                lorcon_get_error(context));
+        return -1;
+    }
+
+    /* Start from the last channel so the first change is a real one */
+    if (set_channel(context, &(channels[num_channels - 1])) < 0) {
+        printf("[!]\t Could not set initial channel: %s\n",
+                lorcon_get_error(context));
+        return -1;
+    }
+
+    printf("[+] Making %u changes across %u channels\n\n", iterations, num_channels);
+
+    for (x = 0; x < iterations; x++) {
+        lorcon_channel_t *ch = &(channels[x % num_channels]);
+
+        ws = &(stats[ch->type]);
+
+        if (set_channel(context, ch) < 0 ||
+                lorcon_get_channel_epoch(context, &epoch) < 0) {
+            ws->failures++;
+            continue;
+        }
+
+        ws->ack_us[ws->num_ack++] =
+            (unsigned int) (tv_us(&(epoch.completed)) - tv_us(&(epoch.started)));
+
+        if ((lat = wait_frame(context, &epoch, timeout_ms)) < 0)
+            ws->misses++;
+        else
+            ws->frame_us[ws->num_frame++] = (unsigned int) lat;
+
+        if ((x + 1) % 100 == 0) {
+            printf("\r[+] %u/%u", x + 1, iterations);
+            fflush(stdout);
+        }
+    }
+
+    printf("\r%-20s\n", "");
+    printf("%-9s %6s %6s %8s %8s %8s %8s %8s %8s %8s %8s %6s\n",
+            "width", "chg", "miss", "ack50", "ack90", "ack99", "ackmax",
+            "frm50", "frm90", "frm99", "frmmax", "dwell");
+
+    for (t = 0; t < LORCON_HOP_HINT_TYPES; t++) {
+        ws = &(stats[t]);
+
+        if (ws->num_ack == 0 && ws->failures == 0)
+            continue;
+
+        qsort(ws->ack_us, ws->num_ack, sizeof(unsigned int), cmp_uint);
+        qsort(ws->frame_us, ws->num_frame, sizeof(unsigned int), cmp_uint);
+
+        memset(&hint, 0, sizeof(hint));
+        hint.samples = ws->num_frame;
+        hint.ack_p50_us = percentile(ws->ack_us, ws->num_ack, 50);
+        hint.ack_p99_us = percentile(ws->ack_us, ws->num_ack, 99);
+        hint.frame_p50_us = percentile(ws->frame_us, ws->num_frame, 50);
+        hint.frame_p99_us = percentile(ws->frame_us, ws->num_frame, 99);
+        hint.min_dwell_ms = (hint.frame_p99_us * 4 + 999) / 1000;
+
+        printf("%-9s %6u %6u %8u %8u %8u %8u %8u %8u %8u %8u %6u\n",
+                type_names[t], ws->num_ack, ws->misses,
+                hint.ack_p50_us, percentile(ws->ack_us, ws->num_ack, 90),
+                hint.ack_p99_us,
+                ws->num_ack ? ws->ack_us[ws->num_ack - 1] : 0,
+                hint.frame_p50_us, percentile(ws->frame_us, ws->num_frame, 90),
+                hint.frame_p99_us,
+                ws->num_frame ? ws->frame_us[ws->num_frame - 1] : 0,
+                hint.min_dwell_ms);
+
+        if (ws->failures)
+            printf("%-9s %u changes failed\n", "", ws->failures);
+
+        /* Without frames there's nothing to base a dwell on */
+        if (ws->num_frame > 0)
+            lorcon_hop_set_dwell_hint(context, t, &hint);
+    }
+
+    printf("\nLatencies in microseconds, dwell in milliseconds\n");
+
+    if (outfile != NULL) {
+        if (lorcon_hop_save_dwell_hints(outfile) < 0) {
+            printf("[!] Could not save dwell hints to %s: %s\n", outfile,
+                    strerror(errno));
+        } else {
+            printf("[+] Saved dwell hints to %s\n", outfile);
+        }
+    }
+
+    lorcon_close(context);
+    lorcon_free(context);
+
+    for (t = 0; t < LORCON_HOP_HINT_TYPES; t++) {
+        free(stats[t].ack_us);
+        free(stats[t].frame_us);
+    }
+
+    return 0;
+}